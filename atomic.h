@@ -0,0 +1,236 @@
+//Portable atomic operations for lock-free structures.
+//
+//Read-modify-write operations (compareAndSwap, add, exchange) are full
+//memory barriers.  Loads and stores are only ordered as their names say.
+
+#ifndef SEASHELL_ATOMIC_H_
+#define SEASHELL_ATOMIC_H_
+
+#ifdef _WINDOWS
+#include <windows.h>
+#include <intrin.h>
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+  defined(__x86_64__)
+    //x86 never reorders loads with other loads, or stores with other stores,
+    //so acquire and release only need to stop the compiler.
+    #define SEASHELL_X86 1
+#else
+    #define SEASHELL_X86 0
+#endif
+
+//Assumed size of a cache line.  Data that threads write independently is
+//padded to this so that they do not share lines.
+#define SEASHELL_CACHE_LINE 64
+
+//Gives each thread its own copy of a variable, which must be plain data.
+#ifdef _WINDOWS
+    #define SEASHELL_THREAD_LOCAL __declspec(thread)
+#else
+    #define SEASHELL_THREAD_LOCAL __thread
+#endif
+
+namespace seashell
+{
+
+namespace atomic
+{
+
+/**Keeps the compiler from moving memory accesses across this point.  Does
+  *not stop the processor from doing so.
+  */
+inline void compilerBarrier()
+{
+#ifdef _WINDOWS
+    _ReadWriteBarrier();
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+
+
+/**Full memory barrier.
+  */
+inline void memoryBarrier()
+{
+#ifdef _WINDOWS
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+}
+
+
+
+/**Keeps loads before this point from being moved after loads after it.
+  */
+inline void loadBarrier()
+{
+#if SEASHELL_X86
+    compilerBarrier();
+#else
+    memoryBarrier();
+#endif
+}
+
+
+
+/**Keeps stores before this point from being moved after stores after it.
+  */
+inline void storeBarrier()
+{
+#if SEASHELL_X86
+    compilerBarrier();
+#else
+    memoryBarrier();
+#endif
+}
+
+
+
+/**Hints to the processor that the calling thread is spinning.
+  */
+inline void cpuRelax()
+{
+#if SEASHELL_X86
+#ifdef _WINDOWS
+    YieldProcessor();
+#else
+    __asm__ __volatile__("pause");
+#endif
+#endif
+}
+
+
+
+/**Replaces *dest with value if *dest equals expected.
+  * @return Returns the value *dest held before the operation.  The swap took
+  *place if and only if this equals expected.
+  */
+inline sint32 compareAndSwap(volatile sint32* dest, sint32 expected,
+  sint32 value)
+{
+#ifdef _WINDOWS
+    return (sint32)InterlockedCompareExchange((volatile LONG*)dest, value,
+      expected);
+#else
+    return __sync_val_compare_and_swap(dest, expected, value);
+#endif
+}
+
+
+
+/**64-bit version of compareAndSwap().
+  */
+inline sint64 compareAndSwap64(volatile sint64* dest, sint64 expected,
+  sint64 value)
+{
+#ifdef _WINDOWS
+    return (sint64)InterlockedCompareExchange64((volatile LONGLONG*)dest, 
+      value, expected);
+#else
+    return __sync_val_compare_and_swap(dest, expected, value);
+#endif
+}
+
+
+
+/**Pointer version of compareAndSwap().
+  */
+template<typename T>
+inline T* compareAndSwapPointer(T* volatile* dest, T* expected, T* value)
+{
+#ifdef _WINDOWS
+    return (T*)InterlockedCompareExchangePointer((void* volatile*)dest,
+      (void*)value, (void*)expected);
+#else
+    return __sync_val_compare_and_swap(dest, expected, value);
+#endif
+}
+
+
+
+/**Adds amount to *dest.
+  * @return Returns the new value of *dest.
+  */
+inline sint32 add(volatile sint32* dest, sint32 amount)
+{
+#ifdef _WINDOWS
+    return (sint32)InterlockedExchangeAdd((volatile LONG*)dest, amount) +
+      amount;
+#else
+    return __sync_add_and_fetch(dest, amount);
+#endif
+}
+
+
+
+/**64-bit version of add().
+  */
+inline sint64 add64(volatile sint64* dest, sint64 amount)
+{
+#ifdef _WINDOWS
+    return (sint64)InterlockedExchangeAdd64((volatile LONGLONG*)dest,
+      amount) + amount;
+#else
+    return __sync_add_and_fetch(dest, amount);
+#endif
+}
+
+
+
+/**Stores value in *dest.
+  * @return Returns the value *dest held before the operation.
+  */
+inline sint32 exchange(volatile sint32* dest, sint32 value)
+{
+#ifdef _WINDOWS
+    return (sint32)InterlockedExchange((volatile LONG*)dest, value);
+#else
+    //Only an acquire barrier by GCC's documentation; a full barrier on x86.
+#if !SEASHELL_X86
+    __sync_synchronize();
+#endif
+    return __sync_lock_test_and_set(dest, value);
+#endif
+}
+
+
+
+/**Loads *src.  No later memory access may be moved before this load.
+  */
+template<typename T>
+inline T loadAcquire(const volatile T* src)
+{
+    T value = *src;
+#if SEASHELL_X86
+    compilerBarrier();
+#else
+    memoryBarrier();
+#endif
+    return value;
+}
+
+
+
+/**Stores value in *dest.  No earlier memory access may be moved after this
+  *store.
+  */
+template<typename T>
+inline void storeRelease(volatile T* dest, T value)
+{
+#if SEASHELL_X86
+    compilerBarrier();
+#else
+    memoryBarrier();
+#endif
+    *dest = value;
+}
+
+} //atomic
+
+} //seashell
+
+#endif//SEASHELL_ATOMIC_H_
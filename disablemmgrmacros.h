@@ -22,5 +22,17 @@
 #ifdef strdup
 #undef strdup
 #endif
+#ifdef aligned_alloc
+#undef aligned_alloc
+#endif
+#ifdef posix_memalign
+#undef posix_memalign
+#endif
+#ifdef _aligned_malloc
+#undef _aligned_malloc
+#endif
+#ifdef _aligned_free
+#undef _aligned_free
+#endif
 
 #endif//MMGR
@@ -4,9 +4,19 @@
 //This file should ALWAYS be compiled with full compiler optimizations (that's
 //not to say that FAST need be defined.
 
+#ifdef _WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include <stdio.h>
 #include <malloc.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
 
 #include "seashell.h"
 #include "profiler_timinginfo.h"
@@ -42,6 +52,29 @@ sint defAllocSig = 0x80ff80ff;
 const char* ALLOC_NEW = "new/delete";
 const char* ALLOC_NEW_ARRAY = "new[]/delete[]";
 const char* ALLOC_MALLOC = "malloc/free";
+const char* ALLOC_NEW_ALIGNED = "aligned new/delete";
+const char* ALLOC_NEW_ARRAY_ALIGNED = "aligned new[]/delete[]";
+
+//Alignment of every allocation.  Allocators must give blocks aligned at 
+//least this well.
+const size_t MMGR_MIN_ALIGNMENT = 2 * sizeof(void*);
+
+//Passed to deallocator() when the size of the allocation is not known.
+const size_t unknownSize = (size_t)-1;
+
+//Passed to deallocator() when the alignment of the allocation is not known.
+const size_t unknownAlignment = (size_t)-1;
+
+//Mean bytes allocated per tracked allocation, or 0 to track them all.
+volatile size_t sampleBytes = MMGR_SAMPLE_BYTES;
+
+//Bytes this thread may still allocate before the next tracked allocation,
+//and the sampleBytes that this was picked for.
+static SEASHELL_THREAD_LOCAL sint64 bytesUntilSample = 0;
+static SEASHELL_THREAD_LOCAL size_t bytesUntilSampleFor = 0;
+
+//State of this thread's random numbers for sampling; 0 until first used.
+static SEASHELL_THREAD_LOCAL suint64 sampleRandom = 0;
 
 /**AllocTimeReference points to a time - in the code - at which an event occurs.
   */
@@ -66,10 +99,22 @@ struct AllocReference
     
     //The requested size of this allocation
     size_t size;
+
+    //Bytes of allocations this one stands for: its size, or more if it 
+    //was picked by sampling.
+    size_t weight;
+
+    //The alignment asked for, or 0 for MMGR_MIN_ALIGNMENT
+    size_t alignment;
     
     //The method of allocation (Ensures matching new and delete or malloc and free)
     const char* alloctype;
 
+    //The start of the memory that holds this allocation (and, unless it 
+    //is kept in a table, this AllocReference).  Allocations aligned beyond
+    //what a block gives start some way into it.
+    void* block;
+
 #if PROFILE
     //The profiler stack at time of creation
     void* profilerFingerprint;
@@ -78,6 +123,17 @@ struct AllocReference
     //Information on when this allocation was created
     AllocTimeReference creation;
 
+#if MMGR_SIDE_TABLE
+    //The allocation itself.
+    void* address;
+
+    //The next AllocReference in the same bucket of its stripe's table.
+    AllocReference* hashNext;
+
+    //Bytes of the pages (at block) holding a guarded allocation, or 0.
+    size_t pagesSize;
+#endif
+
     //The next allocation reference
     AllocReference* pNext;
     
@@ -112,16 +168,200 @@ const size_t checksize = checks * checktypesize;
 //same of the delete.  However, to fix this we can simply store the line number with
 //the new operator, and check if its value is 0 in the destructor.
 
+//Both are kept per thread, so that each thread's allocations are named by
+//its own mmgr_setNames() calls, and threads never write to the same lines.
+
 //lastknown stores the last known location settings from mmgr_setNames.
-AllocTimeReference lastknown = { 0 };
+static SEASHELL_THREAD_LOCAL AllocTimeReference lastknown = { 0 };
 
 //priorerror is similar to lastknown, but it is never unset.
-AllocTimeReference priorerror = { 0 };
+static SEASHELL_THREAD_LOCAL AllocTimeReference priorerror = { 0 };
+
+/**Allocations that are not tracked are preceded by an UntrackedHeader 
+  *instead of an AllocReference and checks.  The word before a tracked 
+  *allocation is always a check, pointing at its AllocReference, and so 
+  *is never odd, as an UntrackedHeader's tag always is.
+  */
+struct UntrackedHeader
+{
+    //The requested size of this allocation.
+    size_t size;
+
+    //Twice the bytes from the start of the block to this header, plus 1 
+    //(see makeUntrackedTag()).
+    void* tag;
+};
+
+/** @return Returns the tag of an UntrackedHeader that is offset bytes into 
+  *its block: 1 unless the allocation was aligned beyond the block.
+  */
+inline void* makeUntrackedTag(size_t offset)
+{
+    return (void*)(offset * 2 + 1);
+}
+
+/** @return Returns non-zero if the word before addr is an UntrackedHeader's 
+  *tag.
+  */
+inline char hasUntrackedTag(void* addr)
+{
+    return ((voidptr)((void**)addr)[-1] & 1) != 0;
+}
+
+/** @return Returns the block that holds the untracked allocation at addr.
+  */
+inline void* getUntrackedBlock(void* addr)
+{
+    UntrackedHeader* header = (UntrackedHeader*)addr - 1;
+    return (char*)header - ((voidptr)header->tag >> 1);
+}
+
+/** @return Returns p, rounded up to a multiple of alignment (a power of 
+  *two), or p if alignment is 0.
+  */
+inline char* alignUp(char* p, size_t alignment)
+{
+    if (!alignment)
+        return p;
+    return (char*)(((voidptr)p + alignment - 1) & ~(voidptr)(alignment - 1));
+}
+
+AllocReference* findReference(void* addr);
+
+/** @return Returns non-zero if the allocation at addr is not tracked.
+  */
+inline char isUntracked(void* addr)
+{
+    return !findReference(addr);
+}
+
+/** @return Returns the size of the allocation at addr.
+  */
+size_t getAllocationSize(void* addr)
+{
+    AllocReference* ar = findReference(addr);
+    if (!ar)
+        return ((UntrackedHeader*)addr - 1)->size;
+    return ar->size;
+}
+
+
+
+/** @return Returns the number of bytes to allocate before the next tracked
+  *allocation: exponentially distributed, with mean bytes, so that each
+  *byte allocated has the same chance of being the next one tracked.
+  */
+sint64 getSampleGap(size_t bytes)
+{
+    if (!sampleRandom) {
+        sampleRandom = ((suint64)(voidptr)&bytesUntilSample << 16) ^ 
+          (suint64)timing::getTicks() ^ 0x9e3779b97f4a7c15ULL;
+    }
+    //xorshift64
+    sampleRandom ^= sampleRandom << 13;
+    sampleRandom ^= sampleRandom >> 7;
+    sampleRandom ^= sampleRandom << 17;
+    const real64 uniform = ((real64)(sampleRandom >> 11) + 0.5) / 
+      9007199254740992.0; //2^53
+    return (sint64)(-log(uniform) * (real64)bytes) + 1;
+}
+
+
+
+/**Decides whether an allocation is tracked.  An allocation of size bytes 
+  *is tracked with a chance of 1 - e^(-size / sampleBytes).
+  * @param weight Set to the bytes of allocations a tracked allocation 
+  *stands for: size divided by its chance of being tracked.
+  * @return Returns non-zero if the allocation should be tracked.
+  */
+char shouldTrack(size_t size, size_t* weight)
+{
+    const size_t bytes = sampleBytes;
+    if (!bytes || !size) {
+        *weight = size;
+        return 1;
+    }
+
+    if (bytesUntilSampleFor != bytes) {
+        bytesUntilSampleFor = bytes;
+        bytesUntilSample = getSampleGap(bytes);
+    }
+    bytesUntilSample -= (sint64)size;
+    if (bytesUntilSample > 0)
+        return 0;
+    bytesUntilSample = getSampleGap(bytes);
+
+    const real64 chance = 1.0 - exp(-(real64)size / (real64)bytes);
+    *weight = (size_t)((real64)size / chance + 0.5);
+    if (*weight < size)
+        *weight = size;
+    return 1;
+}
+
+
+
+/** @return Returns the number of allocations that ar stands for: 1, or 
+  *more when sampling.
+  */
+inline sint64 getCount(const AllocReference* ar)
+{
+    return ar->size ? (sint64)((ar->weight + ar->size / 2) / ar->size) : 1;
+}
+
+
+
+//Number of stripes that AllocReferences are spread over; a power of two.  
+//Each stripe has its own chain and lock, so threads rarely wait on each 
+//other.
+const size_t MMGR_STRIPES = 64;
+
+//Times a thread spins on a busy stripe before it starts yielding.
+const sint MMGR_SPINS = 100;
+
+#if MMGR_SIDE_TABLE
+//Buckets in a stripe's table when it is first used; a power of two.
+const size_t MMGR_FIRST_BUCKETS = 64;
+#endif
+
+/**One stripe of the AllocReference chains: a circular chain, with its own
+  *root, and the lock that guards it.
+  */
+struct AllocStripeBody
+{
+    //The root AllocReference.
+    AllocReference root;
 
+    //Non-zero while a thread is changing the chain.
+    volatile sint32 lock;
 
+#if MMGR_SIDE_TABLE
+    //Hash table of the stripe's AllocReferences, keyed on address and 
+    //chained through hashNext; 0 until first used.
+    AllocReference** buckets;
 
-//This class manages the AllocReference chain and protects it from multithread
-//damages.
+    //Number of buckets (a power of two), and of AllocReferences in them.
+    size_t bucketCount;
+    size_t count;
+#endif
+
+    //Use by the stripe's allocations (see MmgrUsage), kept under its lock.
+    MmgrUsage usage;
+};
+
+//Stripes are padded so that threads working on different stripes do not 
+//share cache lines.
+struct AllocStripe : public AllocStripeBody
+{
+    char padding[SEASHELL_CACHE_LINE - 
+      sizeof(AllocStripeBody) % SEASHELL_CACHE_LINE];
+};
+
+
+
+//This class manages the AllocReference chains and protects them from 
+//multithread damages.  Allocations are spread over stripes by address, and
+//each stripe is guarded by a spin lock held for only a few stores, so no 
+//lock is shared by all allocations.
 static class AllocReferenceManager
 {
 public:
@@ -134,15 +374,24 @@ public:
 
 
 
-    /**Initializes the chain.
+    /**Initializes the chains.
       */
     void initialize()
     {
-        _root = (AllocReference*)malloc(sizeof(AllocReference));
-        _root->allocSig = defAllocSig;
-        _root->pNext = _root;
-        _root->pPrev = _root;
-        _root->creation.line = 1; //make the root appear valid for previous allocs needing names.
+        for (size_t i = 0; i < MMGR_STRIPES; i++) {
+            AllocReference* root = &_stripes[i].root;
+            root->allocSig = defAllocSig;
+            root->pNext = root;
+            root->pPrev = root;
+            root->creation.line = 1; //make the root appear valid for previous allocs needing names.
+            _stripes[i].lock = 0;
+            memset(&_stripes[i].usage, 0, sizeof(MmgrUsage));
+#if MMGR_SIDE_TABLE
+            _stripes[i].buckets = 0;
+            _stripes[i].bucketCount = 0;
+            _stripes[i].count = 0;
+#endif
+        }
 
         _deallocating_all = 0;
     }
@@ -156,13 +405,32 @@ public:
       */
     void allocFix(AllocReference* ar)
     {
-        LockMutex(_mutex);
-
-        ar->pPrev = _root->pPrev;
-        ar->pNext = _root;
-        _root->pPrev->pNext = ar;
-        _root->pPrev = ar;
+        AllocStripe* stripe = getStripe_(getKey_(ar));
+        AllocReference* root = &stripe->root;
+        lockStripe_(stripe);
+
+        ar->pPrev = root->pPrev;
+        ar->pNext = root;
+        root->pPrev->pNext = ar;
+        root->pPrev = ar;
         ar->allocSig = defAllocSig;
+#if MMGR_SIDE_TABLE
+        if (stripe->count >= stripe->bucketCount)
+            growTable_(stripe);
+        AllocReference** bucket = getBucket_(stripe, ar->address);
+        ar->hashNext = *bucket;
+        *bucket = ar;
+        stripe->count++;
+#endif
+        const sint64 count = getCount(ar);
+        stripe->usage.liveBytes += (sint64)ar->weight;
+        stripe->usage.liveCount += count;
+        stripe->usage.allocatedBytes += (suint64)ar->weight;
+        stripe->usage.allocations += (suint64)count;
+        stripe->usage.sizeClasses[profiler::getAllocationSizeClass(ar->size)]
+          += count;
+
+        unlockStripe_(stripe);
     }
 
 
@@ -173,12 +441,71 @@ public:
       */
     void allocUnfix(AllocReference* ar)
     {
-        LockMutex(_mutex);
+        AllocStripe* stripe = getStripe_(getKey_(ar));
+        lockStripe_(stripe);
 
         ar->pNext->pPrev = ar->pPrev;
         ar->pPrev->pNext = ar->pNext;
         ar->allocSig = 0;
+#if MMGR_SIDE_TABLE
+        AllocReference** link = getBucket_(stripe, ar->address);
+        while (*link != ar)
+            link = &(*link)->hashNext;
+        *link = ar->hashNext;
+        stripe->count--;
+#endif
+        const sint64 count = getCount(ar);
+        stripe->usage.liveBytes -= (sint64)ar->weight;
+        stripe->usage.liveCount -= count;
+        stripe->usage.sizeClasses[profiler::getAllocationSizeClass(ar->size)]
+          -= count;
+
+        unlockStripe_(stripe);
+    }
+
+
+
+    /**Fills usage with the total use of all stripes, holding one stripe's 
+      *lock at a time.
+      */
+    void getUsage(MmgrUsage* usage)
+    {
+        memset(usage, 0, sizeof(MmgrUsage));
+        for (size_t i = 0; i < MMGR_STRIPES; i++) {
+            AllocStripe* stripe = &_stripes[i];
+            lockStripe_(stripe);
+            usage->liveBytes += stripe->usage.liveBytes;
+            usage->liveCount += stripe->usage.liveCount;
+            usage->allocatedBytes += stripe->usage.allocatedBytes;
+            usage->allocations += stripe->usage.allocations;
+            for (sint k = 0; k < MMGR_SIZE_CLASSES; k++)
+                usage->sizeClasses[k] += stripe->usage.sizeClasses[k];
+            unlockStripe_(stripe);
+        }
+    }
+
+
+
+#if MMGR_SIDE_TABLE
+    /** @return Returns the AllocReference of the allocation at addr, or 0
+      *if there is none.
+      */
+    AllocReference* find(void* addr)
+    {
+        AllocStripe* stripe = getStripe_(addr);
+        lockStripe_(stripe);
+
+        AllocReference* ar = 0;
+        if (stripe->buckets) {
+            ar = *getBucket_(stripe, addr);
+            while (ar && ar->address != addr)
+                ar = ar->hashNext;
+        }
+
+        unlockStripe_(stripe);
+        return ar;
     }
+#endif
 
 
 
@@ -206,11 +533,20 @@ public:
         numPrints++;
         
         fprintf(f, "Memleaks log report print #%i\n-------------------\n", numPrints);
-        AllocReference* ar = _root->pNext;
-        if (ar == _root)
-            fprintf(f, "No memory leaks detected.\n");
-        else {
-            while (ar != _root) {
+        if (sampleBytes) {
+            fprintf(f, "Only about one allocation per %i bytes was tracked;"
+              " these leaks are a sample.\n-------------------\n",
+              (sint)sampleBytes);
+        }
+        char leaks = 0;
+        for (size_t i = 0; i < MMGR_STRIPES; i++) {
+            AllocStripe* stripe = &_stripes[i];
+            AllocReference* root = &stripe->root;
+            lockStripe_(stripe);
+            AllocReference* ar = root->pNext;
+            if (ar != root)
+                leaks = 1;
+            while (ar != root) {
 #if PROFILE
                 fprintf(f, "Profiler stack trace:\n");
                 profiler::printStackTrace(f, ar->profilerFingerprint);
@@ -230,11 +566,68 @@ public:
                 }
                 ar = ar->pNext;
             }
+            unlockStripe_(stripe);
         }
+        if (!leaks)
+            fprintf(f, "No memory leaks detected.\n");
             
         fclose(f);
     }
 
+    /**Copies a site for each outstanding allocation, holding one stripe's
+      *lock at a time.
+      * @param sites Set to the sites, from malloc(), or 0 if there are none.
+      * @param count Set to the number of sites.
+      * @return Returns zero if memory ran out.
+      */
+    char gatherSites(MmgrHeapSite** sites, size_t* count)
+    {
+        *sites = 0;
+        *count = 0;
+        size_t capacity = 0;
+        for (size_t i = 0; i < MMGR_STRIPES; i++) {
+            AllocStripe* stripe = &_stripes[i];
+            AllocReference* root = &stripe->root;
+            lockStripe_(stripe);
+            for (AllocReference* ar = root->pNext; ar != root; 
+              ar = ar->pNext) {
+                if (*count == capacity) {
+                    capacity = capacity ? capacity * 2 : 1024;
+                    MmgrHeapSite* grown = (MmgrHeapSite*)realloc(*sites, 
+                      capacity * sizeof(MmgrHeapSite));
+                    if (!grown) {
+                        unlockStripe_(stripe);
+                        free(*sites);
+                        *sites = 0;
+                        *count = 0;
+                        return 0;
+                    }
+                    *sites = grown;
+                }
+                MmgrHeapSite* site = &(*sites)[(*count)++];
+                if (ar->creation.line > 0) {
+                    site->file = ar->creation.file;
+                    site->line = ar->creation.line;
+                    site->func = ar->creation.func;
+                }
+                else {
+                    site->file = 0;
+                    site->line = 0;
+                    site->func = 0;
+                }
+#if PROFILE
+                site->profilerFingerprint = ar->profilerFingerprint;
+#else
+                site->profilerFingerprint = 0;
+#endif
+                site->count = getCount(ar);
+                site->bytes = (sint64)ar->weight;
+            }
+            unlockStripe_(stripe);
+        }
+        return 1;
+    }
+
     //Bypass global operator new
     void* operator new(std::size_t size)
     {
@@ -247,17 +640,123 @@ public:
     }
     
 private:
-    /**The root AllocReference.
+    /** @return Returns the address that ar is filed under: the allocation
+      *itself when AllocReferences are kept in tables, else ar.
       */
-    AllocReference* _root;
+    static void* getKey_(AllocReference* ar)
+    {
+#if MMGR_SIDE_TABLE
+        return ar->address;
+#else
+        return ar;
+#endif
+    }
 
-    /**Static deallocation time.
+
+
+    /** @return Returns a hash of an address.
       */
-    char _deallocating_all;
+    static size_t getHash_(void* key)
+    {
+        //malloc() aligns its blocks, so the lowest bits say nothing.
+        size_t hash = (size_t)key >> 4;
+        hash ^= hash >> 7;
+        hash ^= hash >> 13;
+        return hash;
+    }
+
+
+
+    /** @return Returns the stripe that AllocReferences filed under key 
+      *are kept in.
+      */
+    AllocStripe* getStripe_(void* key)
+    {
+        return &_stripes[getHash_(key) & (MMGR_STRIPES - 1)];
+    }
+
+
+
+#if MMGR_SIDE_TABLE
+    /** @return Returns the bucket of stripe's table for addr.  The table
+      *must exist.
+      */
+    static AllocReference** getBucket_(AllocStripe* stripe, void* addr)
+    {
+        //The low bits picked the stripe.
+        const size_t hash = getHash_(addr) / MMGR_STRIPES;
+        return &stripe->buckets[(hash ^ (hash >> 11)) & 
+          (stripe->bucketCount - 1)];
+    }
+
+
+
+    /**Doubles the buckets of a stripe's table (or makes the table), and 
+      *moves its AllocReferences over.  The stripe must be locked.  If 
+      *memory runs out, the old table is kept, only fuller.
+      */
+    static void growTable_(AllocStripe* stripe)
+    {
+        AllocReference** const old = stripe->buckets;
+        const size_t oldCount = stripe->bucketCount;
+        const size_t count = oldCount ? oldCount * 2 : MMGR_FIRST_BUCKETS;
+        AllocReference** buckets = 
+          (AllocReference**)calloc(count, sizeof(AllocReference*));
+        if (!buckets)
+            return;
+
+        stripe->buckets = buckets;
+        stripe->bucketCount = count;
+        for (size_t i = 0; i < oldCount; i++) {
+            AllocReference* ar = old[i];
+            while (ar) {
+                AllocReference* next = ar->hashNext;
+                AllocReference** bucket = getBucket_(stripe, ar->address);
+                ar->hashNext = *bucket;
+                *bucket = ar;
+                ar = next;
+            }
+        }
+        free(old);
+    }
+#endif
 
-    /**Locking mutex.
+
+
+    /**Takes a stripe's lock, spinning until it is free.  A holder that
+      *was preempted is given the processor after a while.
+      */
+    void lockStripe_(AllocStripe* stripe)
+    {
+        sint spins = 0;
+        while (seashell::atomic::exchange(&stripe->lock, 1)) {
+            while (stripe->lock) {
+                if (++spins < MMGR_SPINS)
+                    seashell::atomic::cpuRelax();
+                else
+                    timing::sleepThread(0);
+            }
+        }
+    }
+
+
+
+    /**Releases a stripe's lock.
+      */
+    void unlockStripe_(AllocStripe* stripe)
+    {
+        seashell::atomic::storeRelease(&stripe->lock, (sint32)0);
+    }
+
+
+
+    /**The AllocReference chains.
       */
-    seashell::Mutex _mutex;
+    AllocStripe _stripes[MMGR_STRIPES];
+
+    /**Static deallocation time.
+      */
+    char _deallocating_all;
 } *_allocReferences;
 
 
@@ -274,110 +773,675 @@ AllocReferenceManager* allocReferences()
 
 
 
-/**The timekeeper class which automatically logs all leaks at the end of 
-  *execution.
+/** @return Returns the AllocReference of the allocation at addr, or 0 if it
+  *is not tracked.
   */
-static class mmgr_timekeeper
-{public:
-    mmgr_timekeeper() {}
-    ~mmgr_timekeeper() { allocReferences()->staticDestruction(); }
-} mmgrtime;
+AllocReference* findReference(void* addr)
+{
+#if MMGR_SIDE_TABLE
+    return allocReferences()->find(addr);
+#else
+    if (hasUntrackedTag(addr))
+        return 0;
+    return (AllocReference*)((char*)addr - checksize - sizeof(AllocReference));
+#endif
+}
 
 
 
-/**init() sets up root and various other global variables pertaining to the manager.
+/**Orders sites by where they were made, for qsort().
   */
-void initialize()
+int compareSiteKeys(const void* a, const void* b)
 {
-    if (!initialized) {
-        initialized = 1;
-
-        allocReferences();
-    }
+    const MmgrHeapSite* x = (const MmgrHeapSite*)a;
+    const MmgrHeapSite* y = (const MmgrHeapSite*)b;
+    if (x->profilerFingerprint != y->profilerFingerprint)
+        return (size_t)x->profilerFingerprint < (size_t)y->profilerFingerprint
+          ? -1 : 1;
+    if (x->file != y->file)
+        return (size_t)x->file < (size_t)y->file ? -1 : 1;
+    if (x->line != y->line)
+        return x->line < y->line ? -1 : 1;
+    if (x->func != y->func)
+        return (size_t)x->func < (size_t)y->func ? -1 : 1;
+    return 0;
 }
 
-void* allocator(const char* type, size_t size)
-{	
-    try {
-        initialize();
 
-        //Solaris compilant alignment
-        static const sint bytes = BITS / 8;
-        if (size % bytes != 0)
-            size += bytes - (size % bytes);
 
-        const size_t realSize = sizeof(AllocReference) + size + 2 * checksize;
-        char* ret = (char*)malloc(realSize);
-        massert(ret, "Allocation failed - out of memory? (Attempted %i bytes)",
-          (sint)size);
-        
-        //First chunk of memory is the allocation reference.
-        AllocReference* ar = (AllocReference*)ret;
-        ret += sizeof(AllocReference);
+/**Orders sites by bytes, most first, for qsort().
+  */
+int compareSiteBytes(const void* a, const void* b)
+{
+    const MmgrHeapSite* x = (const MmgrHeapSite*)a;
+    const MmgrHeapSite* y = (const MmgrHeapSite*)b;
+    if (x->bytes != y->bytes)
+        return x->bytes > y->bytes ? -1 : 1;
+    return compareSiteKeys(a, b);
+}
 
-#if PROFILE
-        ar->profilerFingerprint = profiler::getStackFingerprint();
-#endif
-    
-        ar->size = size;
-        ar->alloctype = type;
-        if (lastknown.line > 0)	{
-            ar->creation = lastknown;
-        }
-        else {
-            ar->creation.line = 0;
-        }
 
-        allocReferences()->allocFix(ar);
-        
-        char* temp = ret;
 
-        //Wipe before and after the data with pointers to the AllocReference
-        for (size_t i = 0; i < checks; i++) {
-            *(AllocReference**)temp = ar;
-            temp += checktypesize;
-        }
-        temp += size;
-        for (size_t i = 0; i < checks; i++) {
-            *(AllocReference**)temp = ar;
-            temp += checktypesize;
+/** @return Returns a snapshot of sites (from malloc()), totalled by where 
+  *they were made and sorted by bytes, or 0 if memory ran out.  sites is 
+  *taken over or freed.
+  * @param dropEmpty Non-zero to leave out sites that total nothing.
+  */
+MmgrHeapSnapshot* makeSnapshot(MmgrHeapSite* sites, size_t count, 
+  char dropEmpty)
+{
+    MmgrHeapSnapshot* s = (MmgrHeapSnapshot*)malloc(sizeof(MmgrHeapSnapshot));
+    if (!s) {
+        free(sites);
+        return 0;
+    }
+    s->time = (sint64)::time(0);
+    s->count = 0;
+    s->bytes = 0;
+
+    if (count)
+        qsort(sites, count, sizeof(MmgrHeapSite), compareSiteKeys);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ) {
+        MmgrHeapSite site = sites[i];
+        for (i++; i < count && !compareSiteKeys(&site, &sites[i]); i++) {
+            site.count += sites[i].count;
+            site.bytes += sites[i].bytes;
         }
-        
-#if PROFILE
-        //Update usage information
-        profiler::TimingInfo* timing = 
-          (profiler::TimingInfo*)ar->profilerFingerprint;
-        if (timing)
-            timing->result.allocations += (big_suint)size;
-#endif
+        if (dropEmpty && !site.count && !site.bytes)
+            continue;
+        s->count += site.count;
+        s->bytes += site.bytes;
+        sites[kept++] = site;
+    }
+    if (kept)
+        qsort(sites, kept, sizeof(MmgrHeapSite), compareSiteBytes);
 
-        //After each new, it is ok to unset the names.  We know we have all of
-        //the information we need from them.
-        mmgr_unsetNames();
+    s->sites = sites;
+    s->siteCount = kept;
+    return s;
+}
 
-        ret = ret + checksize;
-        return (void*)ret;
-    }
-    catch (const Exception& e) {
-        elog(e);
-    }
-    catch (...) {
-    }
-    throw std::bad_alloc();
+
+
+static void writeU32(FILE* f, suint32 value)
+{
+    unsigned char bytes[4];
+    for (sint i = 0; i < 4; i++)
+        bytes[i] = (unsigned char)(value >> (i * 8));
+    fwrite(bytes, 1, 4, f);
 }
 
-void deallocator(const char* type, void* addr)
+
+
+static void writeU64(FILE* f, suint64 value)
+{
+    unsigned char bytes[8];
+    for (sint i = 0; i < 8; i++)
+        bytes[i] = (unsigned char)(value >> (i * 8));
+    fwrite(bytes, 1, 8, f);
+}
+
+
+
+static void writeString(FILE* f, const char* s)
+{
+    const suint32 length = s ? (suint32)strlen(s) : 0;
+    writeU32(f, length);
+    fwrite(s, 1, length, f);
+}
+
+
+
+#if PROFILE
+/**Writes the scopes around and including t, outermost first.
+  */
+static void writeScopes(FILE* f, profiler::TimingInfo* t)
+{
+    if (!t || t->line == 0)
+        return;
+    writeScopes(f, t->up);
+    writeU32(f, t->line);
+    writeString(f, t->file);
+    writeString(f, t->function);
+}
+#endif
+
+
+
+//Most ms that the recorder sleeps for at once, so that it stops promptly.
+const suint MMGR_RECORDER_POLL_MS = 10;
+
+/**Thread that samples memory use into a ring (see Recording, in mmgr.h).
+  */
+class Recorder : public seashell::Thread, public seashell::Mutex
+{
+public:
+    /**Constructor; starts recording.  See mmgr_startRecording().
+      */
+    Recorder(suint intervalMs, suint samples, const char* exitFile,
+      MmgrRecordingFormat exitFormat)
+    {
+        _interval = intervalMs ? intervalMs : 1;
+        _capacity = samples ? samples : 1;
+        _samples = (MmgrUsage*)malloc(_capacity * sizeof(MmgrUsage));
+        _count = 0;
+        _next = 0;
+        _exitFile = exitFile ? strdup(exitFile) : 0;
+        _exitFormat = exitFormat;
+        _startTime = (suint64)::time(0);
+        _startMs = timing::getSystemMs();
+        startThread();
+    }
+
+
+
+    /**Stops recording, and writes the exit file if there is one.
+      */
+    ~Recorder()
+    {
+        stopThread();
+        if (_exitFile)
+            write(_exitFile, _exitFormat);
+        free(_exitFile);
+        free(_samples);
+    }
+
+
+
+    void run()
+    {
+        big_suint last = 0;
+        char first = 1;
+        while (1) {
+            queryExit();
+
+            const big_suint time = timing::getSystemMs();
+            if (first || time - last >= _interval) {
+                first = 0;
+                last = time;
+                record_(time);
+            }
+            timing::sleepThread(_interval < MMGR_RECORDER_POLL_MS ? 
+              _interval : MMGR_RECORDER_POLL_MS);
+        }
+    }
+
+
+
+    /**Writes the samples so far.  See mmgr_writeRecording().
+      */
+    sint write(const char* file, MmgrRecordingFormat format)
+    {
+        //Copied out, so that recording carries on while the file is 
+        //written.
+        MmgrUsage* samples = 
+          (MmgrUsage*)malloc(_capacity * sizeof(MmgrUsage));
+        if (!samples || !_samples) {
+            free(samples);
+            return 0;
+        }
+        suint count;
+        {LockMutex(*this);
+            count = _count;
+            const suint oldest = (_next + _capacity - _count) % _capacity;
+            for (suint i = 0; i < count; i++)
+                samples[i] = _samples[(oldest + i) % _capacity];
+        }
+
+        //Written beside the destination and renamed over it, so that a
+        //reader never sees half of a recording.
+        const size_t tempLength = strlen(file) + 5;
+        char* temp = (char*)malloc(tempLength);
+        if (!temp) {
+            free(samples);
+            return 0;
+        }
+        StringCchCopy(temp, tempLength, file);
+        StringCchCat(temp, tempLength, ".tmp");
+
+        sint success = 0;
+        FILE* f = fopen(temp, format == MMGR_RECORDING_CSV ? "wt" : "wb");
+        if (f) {
+            if (format == MMGR_RECORDING_CSV)
+                writeCsv_(f, samples, count);
+            else
+                writeBinary_(f, samples, count);
+            success = !ferror(f);
+            if (fclose(f) != 0)
+                success = 0;
+        }
+        if (success) {
+#ifdef _WINDOWS
+            success = MoveFileExA(temp, file, MOVEFILE_REPLACE_EXISTING);
+#else
+            success = (rename(temp, file) == 0);
+#endif
+        }
+        free(temp);
+        free(samples);
+        return success;
+    }
+
+    //Bypass global operator new
+    void* operator new(std::size_t size)
+    {
+        return malloc(size);
+    }
+
+    void operator delete(void* mem)
+    {
+        free(mem);
+    }
+
+private:
+    /**Adds a sample of memory use now to the ring.
+      */
+    void record_(big_suint time)
+    {
+        if (!_samples)
+            return;
+        MmgrUsage usage;
+        allocReferences()->getUsage(&usage);
+        usage.timeMs = (suint64)(time - _startMs);
+
+        LockMutex(*this);
+        _samples[_next] = usage;
+        _next = (_next + 1) % _capacity;
+        if (_count < _capacity)
+            _count++;
+    }
+
+
+
+    /**Writes samples as CSV, with rates since the sample before.
+      */
+    static void writeCsv_(FILE* f, MmgrUsage* samples, suint count)
+    {
+        fprintf(f, "ms,live bytes,live allocations,bytes allocated,"
+          "allocations made,bytes allocated per s,allocations per s");
+        for (sint k = 0; k < MMGR_SIZE_CLASSES - 1; k++)
+            fprintf(f, ",live up to %i bytes", 16 << k);
+        fprintf(f, ",live larger\n");
+
+        for (suint i = 0; i < count; i++) {
+            const MmgrUsage* u = &samples[i];
+            real64 byteRate = 0;
+            real64 allocationRate = 0;
+            if (i > 0 && u->timeMs > samples[i - 1].timeMs) {
+                const real64 seconds = 
+                  (real64)(u->timeMs - samples[i - 1].timeMs) / 1000.0;
+                byteRate = (real64)(u->allocatedBytes - 
+                  samples[i - 1].allocatedBytes) / seconds;
+                allocationRate = (real64)(u->allocations - 
+                  samples[i - 1].allocations) / seconds;
+            }
+            fprintf(f, "%llu,%lld,%lld,%llu,%llu,%.0f,%.0f", u->timeMs, 
+              u->liveBytes, u->liveCount, u->allocatedBytes, u->allocations,
+              byteRate, allocationRate);
+            for (sint k = 0; k < MMGR_SIZE_CLASSES; k++)
+                fprintf(f, ",%lld", u->sizeClasses[k]);
+            fprintf(f, "\n");
+        }
+    }
+
+
+
+    /**Writes samples in the binary format described in mmgr.h.
+      */
+    void writeBinary_(FILE* f, MmgrUsage* samples, suint count)
+    {
+        fwrite("MMTS", 1, 4, f);
+        writeU32(f, 1);
+        writeU64(f, _startTime);
+        writeU32(f, MMGR_SIZE_CLASSES);
+        writeU32(f, count);
+        for (suint i = 0; i < count; i++) {
+            const MmgrUsage* u = &samples[i];
+            writeU64(f, u->timeMs);
+            writeU64(f, (suint64)u->liveBytes);
+            writeU64(f, (suint64)u->liveCount);
+            writeU64(f, u->allocatedBytes);
+            writeU64(f, u->allocations);
+            for (sint k = 0; k < MMGR_SIZE_CLASSES; k++)
+                writeU64(f, (suint64)u->sizeClasses[k]);
+        }
+    }
+
+
+
+    //ms between samples.
+    suint _interval;
+
+    //The ring of samples: room for _capacity, holding _count, the next
+    //written at _next.
+    MmgrUsage* _samples;
+    suint _capacity;
+    suint _count;
+    suint _next;
+
+    //File written when recording stops, or 0, and its format.
+    char* _exitFile;
+    MmgrRecordingFormat _exitFormat;
+
+    //When recording started: seconds since the epoch, and system ms.
+    suint64 _startTime;
+    big_suint _startMs;
+};
+
+//The recorder, while recording is running.
+Recorder* recorder = 0;
+
+//Guards recorder: starting, stopping and writing recordings.
+seashell::SpinMutex recorderLock;
+
+
+
+/**The timekeeper class which automatically logs all leaks at the end of 
+  *execution.
+  */
+static class mmgr_timekeeper
+{public:
+    mmgr_timekeeper() {}
+    ~mmgr_timekeeper() 
+    {
+        //Stopped first, so that its own allocations are not leaks.
+        mmgr_stopRecording();
+        allocReferences()->staticDestruction();
+    }
+} mmgrtime;
+
+
+
+/**init() sets up root and various other global variables pertaining to the manager.
+  */
+void initialize()
+{
+    if (!initialized) {
+        initialized = 1;
+
+        allocReferences();
+    }
+}
+
+/** @return Returns memory for one of MMGR's blocks (an allocation and 
+  *its AllocReference and checks, or its UntrackedHeader), or 0 if memory 
+  *ran out.
+  */
+inline void* allocateBlock(size_t size)
+{
+#if SLABPOOL
+    return seashell::slabpool::allocate(size);
+#else
+    return malloc(size);
+#endif
+}
+
+/**Frees memory from allocateBlock().
+  */
+inline void freeBlock(void* block)
+{
+#if SLABPOOL
+    seashell::slabpool::deallocate(block);
+#else
+    free(block);
+#endif
+}
+
+#if MMGR_SIDE_TABLE && MMGR_GUARD_BYTES
+/** @return Returns the size of a page of virtual memory.
+  */
+size_t getPageSize()
+{
+    static size_t pageSize = 0;
+    if (!pageSize) {
+#ifdef _WINDOWS
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        pageSize = info.dwPageSize;
+#else
+        pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    }
+    return pageSize;
+}
+
+/**Allocates size bytes on pages of their own, ending where a page that 
+  *cannot be touched begins, so that writing or reading past the end faults
+  *at once.  size must be a multiple of the allocation alignment.
+  * @param alignment Alignment of the allocation, a power of two no larger 
+  *than a page, or 0.  Up to alignment - 1 bytes may be left between the 
+  *allocation and the guard page.
+  * @param pages Set to the start of the pages.
+  * @param pagesSize Set to the bytes of pages, including the guard page.
+  * @return Returns the allocation, or 0 if memory ran out.
+  */
+void* allocateGuarded(size_t size, size_t alignment, void** pages, 
+  size_t* pagesSize)
+{
+    const size_t pageSize = getPageSize();
+    if (alignment)
+        size = (size + alignment - 1) & ~(alignment - 1);
+    const size_t dataSize = (size + pageSize - 1) / pageSize * pageSize;
+    *pagesSize = dataSize + pageSize;
+#ifdef _WINDOWS
+    *pages = VirtualAlloc(0, *pagesSize, MEM_RESERVE | MEM_COMMIT, 
+      PAGE_READWRITE);
+    if (!*pages)
+        return 0;
+    DWORD oldProtection;
+    VirtualProtect((char*)*pages + dataSize, pageSize, PAGE_NOACCESS, 
+      &oldProtection);
+#else
+    *pages = mmap(0, *pagesSize, PROT_READ | PROT_WRITE, 
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (*pages == MAP_FAILED)
+        return 0;
+    mprotect((char*)*pages + dataSize, pageSize, PROT_NONE);
+#endif
+    return (char*)*pages + dataSize - size;
+}
+
+/**Frees pages from allocateGuarded().
+  */
+void freeGuarded(void* pages, size_t pagesSize)
+{
+#ifdef _WINDOWS
+    VirtualFree(pages, 0, MEM_RELEASE);
+#else
+    munmap(pages, pagesSize);
+#endif
+}
+#endif
+
+/** @return Returns size, rounded up to the word size as all allocations 
+  *are.
+  */
+inline size_t roundSize(size_t size)
+{
+    //Solaris compilant alignment
+    static const sint bytes = BITS / 8;
+    if (size % bytes != 0)
+        size += bytes - (size % bytes);
+    return size;
+}
+
+/** @param alignment Alignment that the allocation needs, a power of two, 
+  *or 0 for MMGR_MIN_ALIGNMENT.
+  */
+void* allocator(const char* type, size_t size, size_t alignment = 0)
+{	
+    try {
+        initialize();
+
+        size = roundSize(size);
+        if (alignment <= MMGR_MIN_ALIGNMENT)
+            alignment = 0;
+
+        //Aligned allocations are placed some way into a larger block.
+        const size_t slack = alignment ? alignment - 1 : 0;
+
+        size_t weight;
+        if (!shouldTrack(size, &weight)) {
+            char* block = (char*)allocateBlock(sizeof(UntrackedHeader) + 
+              size + slack);
+            massert(block, "Allocation failed - out of memory? (Attempted "
+              "%i bytes)", (sint)size);
+            UntrackedHeader* header = (UntrackedHeader*)alignUp(
+              block + sizeof(UntrackedHeader), alignment) - 1;
+            header->size = size;
+            header->tag = makeUntrackedTag((char*)header - block);
+            mmgr_unsetNames();
+            return (void*)(header + 1);
+        }
+
+#if MMGR_SIDE_TABLE
+        //The allocation is exactly as asked for; its AllocReference is 
+        //kept elsewhere.
+        AllocReference* ar = 
+          (AllocReference*)allocateBlock(sizeof(AllocReference));
+        massert(ar, "Allocation failed - out of memory? (Attempted %i bytes)",
+          (sint)sizeof(AllocReference));
+        ar->pagesSize = 0;
+        char* ret;
+#if MMGR_GUARD_BYTES
+        if (size >= MMGR_GUARD_BYTES && alignment <= getPageSize()) {
+            ret = (char*)allocateGuarded(size, 
+              alignment ? alignment : MMGR_MIN_ALIGNMENT, &ar->block, 
+              &ar->pagesSize);
+        }
+        else
+#endif
+        {
+            ar->block = allocateBlock((size ? size : 1) + slack);
+            ret = alignUp((char*)ar->block, alignment);
+        }
+        if (!ret)
+            freeBlock(ar);
+        massert(ret, "Allocation failed - out of memory? (Attempted %i "
+          "bytes)", (sint)size);
+        ar->address = ret;
+#else
+        //The allocation reference and checks come just before the 
+        //allocation, and are padded so that it is aligned.
+        const size_t headerSize = (sizeof(AllocReference) + checksize + 
+          MMGR_MIN_ALIGNMENT - 1) & ~(MMGR_MIN_ALIGNMENT - 1);
+        const size_t realSize = headerSize + size + checksize + slack;
+        char* block = (char*)allocateBlock(realSize);
+        massert(block, "Allocation failed - out of memory? (Attempted %i "
+          "bytes)", (sint)size);
+        
+        char* ret = alignUp(block + headerSize, alignment) - checksize;
+        AllocReference* ar = (AllocReference*)(ret - sizeof(AllocReference));
+        ar->block = block;
+#endif
+
+#if PROFILE
+        ar->profilerFingerprint = profiler::getStackFingerprint();
+#endif
+    
+        ar->size = size;
+        ar->weight = weight;
+        ar->alignment = alignment;
+        ar->alloctype = type;
+        if (lastknown.line > 0)	{
+            ar->creation = lastknown;
+        }
+        else {
+            ar->creation.line = 0;
+        }
+
+        allocReferences()->allocFix(ar);
+        
+#if !MMGR_SIDE_TABLE
+        char* temp = ret;
+
+        //Wipe before and after the data with pointers to the AllocReference
+        for (size_t i = 0; i < checks; i++) {
+            *(AllocReference**)temp = ar;
+            temp += checktypesize;
+        }
+        temp += size;
+        for (size_t i = 0; i < checks; i++) {
+            *(AllocReference**)temp = ar;
+            temp += checktypesize;
+        }
+        ret += checksize;
+#endif
+        
+#if PROFILE
+        //Update usage information
+        profiler::TimingInfo* timing = 
+          (profiler::TimingInfo*)ar->profilerFingerprint;
+        if (timing) {
+            const big_suint count = (big_suint)getCount(ar);
+            timing->result.allocations += (big_suint)weight;
+            timing->result.allocationCount += count;
+            timing->result.sizeClasses[profiler::getAllocationSizeClass(
+              size)] += count;
+            //Only this thread allocates against timing, but any thread may
+            //free against it.
+            const sint64 live = seashell::atomic::add64(
+              &timing->result.liveBytes, (sint64)weight);
+            sint64 peak = timing->result.peakBytes;
+            while (live > peak) {
+                const sint64 old = seashell::atomic::compareAndSwap64(
+                  &timing->result.peakBytes, peak, live);
+                if (old == peak)
+                    break;
+                peak = old;
+            }
+        }
+#endif
+
+        //After each new, it is ok to unset the names.  We know we have all of
+        //the information we need from them.
+        mmgr_unsetNames();
+
+        return (void*)ret;
+    }
+    catch (const Exception& e) {
+        elog(e);
+    }
+    catch (...) {
+    }
+    throw std::bad_alloc();
+}
+
+/** @param size Size that the allocation was made with, for sized 
+  *deallocations, or unknownSize.
+  *@param alignment Alignment that the allocation was made with, for aligned
+  *deallocations, or unknownAlignment.
+  */
+void deallocator(const char* type, void* addr, size_t size = unknownSize,
+  size_t alignment = unknownAlignment)
 {
     if (addr == 0) {
         return;
     }
 
-    char* const realaddr = (char*)addr - checksize - sizeof(AllocReference);
-    AllocReference* ar = (AllocReference*)realaddr;
+    AllocReference* const ar = findReference(addr);
+    if (!ar) {
+#if MMGR_SIDE_TABLE
+        //Not in the tables, so it had better be untracked.
+        try {
+            massert(hasUntrackedTag(addr), "Freed memory that was not "
+              "allocated, or was already freed");
+        }
+        catch (const Exception& e) {
+            elog(e);
+            mmgr_unsetNames();
+            return;
+        }
+#endif
+        mmgr_unsetNames();
+        freeBlock(getUntrackedBlock(addr));
+        return;
+    }
+
     try {
         initialize();
 
-        char* temp = realaddr;
         massert(ar->allocSig == defAllocSig, "Pre-allocation memory corrupted");
             
         //---------------------------------
@@ -392,7 +1456,19 @@ void deallocator(const char* type, void* addr)
         profiler::TimingInfo* current = 
           (profiler::TimingInfo*)profiler::getStackFingerprint();
         if (current) {
-            current->result.deallocations += (big_suint)ar->size;
+            current->result.deallocations += (big_suint)ar->weight;
+        }
+
+        //Live bytes belong to wherever the allocation was made, or 
+        //wherever that has since been merged.
+        profiler::TimingInfo* owner = 
+          (profiler::TimingInfo*)ar->profilerFingerprint;
+        if (owner) {
+            profiler::TimingInfo* into;
+            while ((into = seashell::atomic::loadAcquire(&owner->mergedInto)))
+                owner = into;
+            seashell::atomic::add64(&owner->result.liveBytes, 
+              -(sint64)ar->weight);
         }
 #endif
 
@@ -410,8 +1486,26 @@ void deallocator(const char* type, void* addr)
             //In RARE case this could mean pre-allocation corruption
         }
 
+        //Test for sized deallocations of the wrong size
+        if (size != unknownSize) {
+            size = roundSize(size);
+            massert(size == ar->size, "Mismatching sized deallocation: "
+              "allocated %i bytes, deallocated as %i", (sint)ar->size,
+              (sint)size);
+        }
+
+        //Test for aligned deallocations of the wrong alignment
+        if (alignment != unknownAlignment) {
+            if (alignment <= MMGR_MIN_ALIGNMENT)
+                alignment = 0;
+            massert(alignment == ar->alignment, "Mismatching aligned "
+              "deallocation: allocated aligned to %i, deallocated as %i",
+              (sint)ar->alignment, (sint)alignment);
+        }
+
+#if !MMGR_SIDE_TABLE
         //Test for memory corruption
-        temp += sizeof(AllocReference);
+        char* temp = (char*)ar + sizeof(AllocReference);
         for (size_t i = 0; i < checks; i++) {
             massert(ar == *(AllocReference**)temp, 
               "Pre-allocation memory corrupted");
@@ -423,6 +1517,7 @@ void deallocator(const char* type, void* addr)
               "Post-allocation memory corrupted");
             temp += checktypesize;
         }
+#endif
     }
     catch (const Exception& e) {
         elog(e);
@@ -432,7 +1527,17 @@ void deallocator(const char* type, void* addr)
     }
 
     allocReferences()->allocUnfix(ar);
-    free(realaddr);
+#if MMGR_SIDE_TABLE
+#if MMGR_GUARD_BYTES
+    if (ar->pagesSize)
+        freeGuarded(ar->block, ar->pagesSize);
+    else
+#endif
+        freeBlock(ar->block);
+    freeBlock(ar);
+#else
+    freeBlock(ar->block);
+#endif
     allocReferences()->printMemleaks();
 }
 
@@ -456,6 +1561,179 @@ void mmgr_unsetNames()
     mmgr::lastknown.line = 0;
 }
 
+void mmgr_setSampleBytes(size_t bytes)
+{
+    mmgr::sampleBytes = bytes;
+}
+
+size_t mmgr_getSampleBytes()
+{
+    return mmgr::sampleBytes;
+}
+
+void mmgr_getUsage(MmgrUsage* usage)
+{
+    mmgr::initialize();
+    mmgr::allocReferences()->getUsage(usage);
+}
+
+void mmgr_startRecording(suint intervalMs, suint samples, 
+  const char* exitFile, MmgrRecordingFormat exitFormat)
+{
+    mmgr::initialize();
+    LockMutex(mmgr::recorderLock);
+    if (mmgr::recorder)
+        return;
+    mmgr::recorder = new mmgr::Recorder(intervalMs, samples, exitFile, 
+      exitFormat);
+}
+
+void mmgr_stopRecording()
+{
+    LockMutex(mmgr::recorderLock);
+    delete mmgr::recorder;
+    mmgr::recorder = 0;
+}
+
+sint mmgr_writeRecording(const char* file, MmgrRecordingFormat format)
+{
+    LockMutex(mmgr::recorderLock);
+    if (!mmgr::recorder)
+        return 0;
+    return mmgr::recorder->write(file, format);
+}
+
+MmgrHeapSnapshot* mmgr_takeSnapshot()
+{
+    mmgr::initialize();
+    MmgrHeapSite* sites;
+    size_t count;
+    if (!mmgr::allocReferences()->gatherSites(&sites, &count))
+        return 0;
+    return mmgr::makeSnapshot(sites, count, 0);
+}
+
+MmgrHeapSnapshot* mmgr_diffSnapshots(const MmgrHeapSnapshot* before, 
+  const MmgrHeapSnapshot* after)
+{
+    //Before's sites are taken away from after's.
+    const size_t count = before->siteCount + after->siteCount;
+    MmgrHeapSite* sites = 
+      (MmgrHeapSite*)malloc((count ? count : 1) * sizeof(MmgrHeapSite));
+    if (!sites)
+        return 0;
+    for (size_t i = 0; i < before->siteCount; i++) {
+        sites[i] = before->sites[i];
+        sites[i].count = -sites[i].count;
+        sites[i].bytes = -sites[i].bytes;
+    }
+    memcpy(sites + before->siteCount, after->sites, 
+      after->siteCount * sizeof(MmgrHeapSite));
+
+    MmgrHeapSnapshot* diff = mmgr::makeSnapshot(sites, count, 1);
+    if (diff)
+        diff->time = after->time;
+    return diff;
+}
+
+void mmgr_printSnapshot(FILE* f, const MmgrHeapSnapshot* s, size_t maxSites)
+{
+    fprintf(f, "%lld bytes in %lld allocations at %i sites\n"
+      "-------------------\n", s->bytes, s->count, (sint)s->siteCount);
+    if (mmgr::sampleBytes) {
+        fprintf(f, "Only about one allocation per %i bytes was tracked;"
+          " these are estimates.\n-------------------\n",
+          (sint)mmgr::sampleBytes);
+    }
+    size_t count = s->siteCount;
+    if (maxSites && maxSites < count)
+        count = maxSites;
+    for (size_t i = 0; i < count; i++) {
+        const MmgrHeapSite* site = &s->sites[i];
+        fprintf(f, "%lld bytes in %lld allocations\n", site->bytes, 
+          site->count);
+        if (site->line > 0) {
+            fprintf(f, "%s(%i)\nFunction '%s'\n", site->file, site->line, 
+              site->func);
+        }
+        else {
+            fprintf(f, "Exact location unknown\n");
+        }
+#if PROFILE
+        if (site->profilerFingerprint) {
+            fprintf(f, "Profiler stack trace:\n");
+            profiler::printStackTrace(f, site->profilerFingerprint);
+        }
+#endif
+        fprintf(f, "-------------------\n");
+    }
+    if (count < s->siteCount)
+        fprintf(f, "(%i more sites)\n", (sint)(s->siteCount - count));
+}
+
+sint mmgr_writeSnapshot(const char* file, const MmgrHeapSnapshot* s)
+{
+    //Written beside the destination and renamed over it, so that a reader
+    //never sees half of a snapshot.
+    const size_t tempLength = strlen(file) + 5;
+    char* temp = (char*)malloc(tempLength);
+    if (!temp)
+        return 0;
+    StringCchCopy(temp, tempLength, file);
+    StringCchCat(temp, tempLength, ".tmp");
+
+    sint success = 0;
+    FILE* f = fopen(temp, "wb");
+    if (f) {
+        fwrite("MMHS", 1, 4, f);
+        mmgr::writeU32(f, 1);
+        mmgr::writeU64(f, (suint64)s->time);
+        mmgr::writeU64(f, (suint64)s->count);
+        mmgr::writeU64(f, (suint64)s->bytes);
+        mmgr::writeU32(f, (suint32)s->siteCount);
+        for (size_t i = 0; i < s->siteCount; i++) {
+            const MmgrHeapSite* site = &s->sites[i];
+            mmgr::writeU64(f, (suint64)site->count);
+            mmgr::writeU64(f, (suint64)site->bytes);
+            mmgr::writeU32(f, (suint32)site->line);
+            mmgr::writeString(f, site->file);
+            mmgr::writeString(f, site->func);
+            suint32 depth = 0;
+#if PROFILE
+            for (profiler::TimingInfo* t = 
+              (profiler::TimingInfo*)site->profilerFingerprint; 
+              t && t->line != 0; t = t->up)
+                depth++;
+#endif
+            mmgr::writeU32(f, depth);
+#if PROFILE
+            mmgr::writeScopes(f, 
+              (profiler::TimingInfo*)site->profilerFingerprint);
+#endif
+        }
+        success = !ferror(f);
+        if (fclose(f) != 0)
+            success = 0;
+    }
+    if (success) {
+#ifdef _WINDOWS
+        success = MoveFileExA(temp, file, MOVEFILE_REPLACE_EXISTING);
+#else
+        success = (rename(temp, file) == 0);
+#endif
+    }
+    free(temp);
+    return success;
+}
+
+void mmgr_freeSnapshot(MmgrHeapSnapshot* s)
+{
+    if (!s)
+        return;
+    free(s->sites);
+    free(s);
+}
+
 void* operator new(size_t size)
 {
     return mmgr::allocator(mmgr::ALLOC_NEW, size);
@@ -488,6 +1766,56 @@ void operator delete[](void* addr)
     mmgr::deallocator(mmgr::ALLOC_NEW_ARRAY, addr);
 }
 
+#ifdef __cpp_sized_deallocation
+//Sized deallocation; the size is checked against the allocation's.
+void operator delete(void* addr, size_t size)
+{
+    mmgr::deallocator(mmgr::ALLOC_NEW, addr, size);
+}
+
+void operator delete[](void* addr, size_t size)
+{
+    mmgr::deallocator(mmgr::ALLOC_NEW_ARRAY, addr, size);
+}
+#endif
+
+#ifdef __cpp_aligned_new
+//Aligned allocation, for types aligned beyond what new normally gives.
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return mmgr::allocator(mmgr::ALLOC_NEW_ALIGNED, size, (size_t)alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return mmgr::allocator(mmgr::ALLOC_NEW_ARRAY_ALIGNED, size, 
+      (size_t)alignment);
+}
+
+void operator delete(void* addr, std::align_val_t alignment)
+{
+    mmgr::deallocator(mmgr::ALLOC_NEW_ALIGNED, addr, mmgr::unknownSize, 
+      (size_t)alignment);
+}
+
+void operator delete[](void* addr, std::align_val_t alignment)
+{
+    mmgr::deallocator(mmgr::ALLOC_NEW_ARRAY_ALIGNED, addr, 
+      mmgr::unknownSize, (size_t)alignment);
+}
+
+void operator delete(void* addr, size_t size, std::align_val_t alignment)
+{
+    mmgr::deallocator(mmgr::ALLOC_NEW_ALIGNED, addr, size, (size_t)alignment);
+}
+
+void operator delete[](void* addr, size_t size, std::align_val_t alignment)
+{
+    mmgr::deallocator(mmgr::ALLOC_NEW_ARRAY_ALIGNED, addr, size, 
+      (size_t)alignment);
+}
+#endif
+
 void* mmgr_malloc(size_t size, const char* file, const sint line, const char* func)
 {
     mmgr_setNames(0, file, line, func);
@@ -506,10 +1834,11 @@ void* mmgr_realloc(void* addr, size_t size, const char* file, const sint line, c
     mmgr_setNames(0, file, line, func);
     void* ret;
     try {
-        mmgr::AllocReference* ar = (mmgr::AllocReference*)
-          ((char*)addr - mmgr::checksize - sizeof(mmgr::AllocReference));
         ret = mmgr::allocator(mmgr::ALLOC_MALLOC, size);
-        memcpy(ret, addr, ar->size);
+        if (!addr)
+            return ret;
+        const size_t oldSize = mmgr::getAllocationSize(addr);
+        memcpy(ret, addr, oldSize < size ? oldSize : size);
 
         mmgr_setNames(1, file, line, func);
         mmgr::deallocator(mmgr::ALLOC_MALLOC, addr);
@@ -548,6 +1877,33 @@ char* mmgr_strdup(const char* str, const char* file, const sint line, const char
     }
 }
 
+void* mmgr_aligned_alloc(size_t alignment, size_t size, const char* file, const sint line, const char* func)
+{
+    mmgr_setNames(0, file, line, func);
+    if (!alignment || (alignment & (alignment - 1))) {
+        mmgr_unsetNames();
+        return 0;
+    }
+    try {
+        return mmgr::allocator(mmgr::ALLOC_MALLOC, size, alignment);
+    }
+    catch (const std::bad_alloc&) {
+        return 0;
+    }
+}
+
+sint mmgr_posix_memalign(void** addr, size_t alignment, size_t size, const char* file, const sint line, const char* func)
+{
+    if (!alignment || (alignment & (alignment - 1)) || 
+      alignment % sizeof(void*))
+        return EINVAL;
+    void* ret = mmgr_aligned_alloc(alignment, size, file, line, func);
+    if (!ret)
+        return ENOMEM;
+    *addr = ret;
+    return 0;
+}
+
 void mmgr_free(void* addr, const char* file, const sint line, const char* func)
 {
     mmgr_setNames(1, file, line, func);
@@ -555,4 +1911,436 @@ void mmgr_free(void* addr, const char* file, const sint line, const char* func)
     //mmgr_unsetNames(); Done automatically in deallocator
 }
 
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT && PROFILE
+TEST_BUDDY(mmgrSampling)
+{
+    //Sampled statistics should come out near the true ones, and both kinds
+    //of allocation must free and reallocate correctly.
+    const size_t oldSampleBytes = mmgr_getSampleBytes();
+    mmgr_setSampleBytes(4096);
+    const sint count = 20000;
+    char** kept = (char**)malloc(sizeof(char*) * count);
+    profiler::TimingInfo* t = 0;
+    {PROFILER("sampled allocations");
+        t = (profiler::TimingInfo*)profiler::getStackFingerprint();
+        for (sint i = 0; i < count; i++)
+            kept[i] = new char[64];
+    }
+    sint tracked = 0;
+    for (sint i = 0; i < count; i++) {
+        if (!mmgr::isUntracked(kept[i]))
+            tracked++;
+    }
+    mmgr_setSampleBytes(oldSampleBytes);
+
+    const real64 expected = 64.0 * count;
+    testAssert(tracked > 0 && tracked < count / 10, "%i of %i allocations "
+      "were tracked", tracked, count);
+    testAssert(fabs(t->result.allocations - expected) < expected * 0.2, 
+      "Estimated %i bytes allocated; expected about %i", 
+      (sint)t->result.allocations, (sint)expected);
+    testAssert(fabs((real64)t->result.allocationCount - count) < count * 0.2,
+      "Estimated %i allocations; expected about %i", 
+      (sint)t->result.allocationCount, count);
+
+    for (sint i = 0; i < count; i++)
+        delete[] kept[i];
+    free(kept);
+    testAssert(t->result.liveBytes == 0, "Scope has %i live bytes after its"
+      " allocations were freed", (sint)t->result.liveBytes);
+
+    //About two thirds of these are tracked.
+    mmgr_setSampleBytes(4096);
+    for (sint i = 0; i < 100; i++) {
+        char* block = (char*)mmgr_malloc(4096, __FILE__, __LINE__, 
+          __FUNCTION__);
+        block[4095] = 7;
+        block = (char*)mmgr_realloc(block, 8192, __FILE__, __LINE__, 
+          __FUNCTION__);
+        testAssert(block[4095] == 7, "Reallocation lost contents");
+        mmgr_free(block, __FILE__, __LINE__, __FUNCTION__);
+    }
+    mmgr_setSampleBytes(oldSampleBytes);
+}
+END_TEST_BUDDY()
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+TEST_BUDDY(mmgrHeapSnapshot)
+{
+    //Allocations made between two snapshots must show up in their diff, 
+    //totalled under the line that made them, and go again once freed.
+    const size_t oldSampleBytes = mmgr_getSampleBytes();
+    mmgr_setSampleBytes(0);
+    const sint count = 100;
+    void* kept[count];
+    MmgrHeapSnapshot* before = mmgr_takeSnapshot();
+    const sint line = __LINE__ + 2;
+    for (sint i = 0; i < count; i++)
+        kept[i] = mmgr_malloc(64, __FILE__, line, __FUNCTION__);
+    MmgrHeapSnapshot* during = mmgr_takeSnapshot();
+    for (sint i = 0; i < count; i++)
+        mmgr_free(kept[i], __FILE__, __LINE__, __FUNCTION__);
+    MmgrHeapSnapshot* after = mmgr_takeSnapshot();
+    mmgr_setSampleBytes(oldSampleBytes);
+    testAssert(before && during && after, "Could not take snapshots");
+
+    MmgrHeapSnapshot* growth = mmgr_diffSnapshots(before, during);
+    MmgrHeapSnapshot* shrinkage = mmgr_diffSnapshots(during, after);
+    testAssert(growth && shrinkage, "Could not diff snapshots");
+    const MmgrHeapSite* grown = 0;
+    for (size_t i = 0; i < growth->siteCount; i++) {
+        if (growth->sites[i].line == line)
+            grown = &growth->sites[i];
+    }
+    testAssert(grown && grown->count == count && grown->bytes == 64 * count,
+      "Diff does not hold the %i allocations made", count);
+    testAssert(growth->bytes >= 64 * count, "Diff grew by only %i bytes",
+      (sint)growth->bytes);
+    const MmgrHeapSite* shrunk = 0;
+    for (size_t i = 0; i < shrinkage->siteCount; i++) {
+        if (shrinkage->sites[i].line == line)
+            shrunk = &shrinkage->sites[i];
+    }
+    testAssert(shrunk && shrunk->count == -count, "Diff does not hold the "
+      "%i allocations freed", count);
+
+    const char* file = "mmgr_snapshot_test.bin";
+    testAssert(mmgr_writeSnapshot(file, growth), "Could not write snapshot");
+    FILE* f = fopen(file, "rb");
+    char magic[4] = { 0 };
+    if (f) {
+        fread(magic, 1, 4, f);
+        fclose(f);
+    }
+    remove(file);
+    testAssert(!memcmp(magic, "MMHS", 4), "Snapshot file has no header");
+
+    mmgr_freeSnapshot(before);
+    mmgr_freeSnapshot(during);
+    mmgr_freeSnapshot(after);
+    mmgr_freeSnapshot(growth);
+    mmgr_freeSnapshot(shrinkage);
+}
+END_TEST_BUDDY()
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+TEST_BUDDY(mmgrAlignedAllocation)
+{
+    //Aligned allocations must be aligned and usable whether or not they
+    //are tracked, and ordinary ones must get the minimum alignment.
+    const size_t oldSampleBytes = mmgr_getSampleBytes();
+    const size_t rates[] = { 0, 1024 * 1024 * 1024 };
+    for (sint k = 0; k < (sint)(sizeof(rates) / sizeof(rates[0])); k++) {
+        mmgr_setSampleBytes(rates[k]);
+        for (size_t alignment = 8; alignment <= 8192; alignment *= 2) {
+            for (size_t size = 1; size < 20000; size = size * 3 + 5) {
+                char* p = (char*)mmgr_aligned_alloc(alignment, size, 
+                  __FILE__, __LINE__, __FUNCTION__);
+                testAssert(p && ((voidptr)p & (alignment - 1)) == 0, "%i "
+                  "bytes allocated at %p, not aligned to %i", (sint)size, p,
+                  (sint)alignment);
+                memset(p, 0x5a, size);
+                testAssert(mmgr::getAllocationSize(p) >= size, "Aligned "
+                  "allocation of %i bytes has %i", (sint)size, 
+                  (sint)mmgr::getAllocationSize(p));
+                mmgr_free(p, __FILE__, __LINE__, __FUNCTION__);
+            }
+        }
+        for (size_t size = 1; size < 2000; size = size * 3 + 5) {
+            char* p = new char[size];
+            testAssert(((voidptr)p & (mmgr::MMGR_MIN_ALIGNMENT - 1)) == 0,
+              "%i bytes allocated at %p, not aligned to %i", (sint)size, p,
+              (sint)mmgr::MMGR_MIN_ALIGNMENT);
+            delete[] p;
+        }
+    }
+    mmgr_setSampleBytes(oldSampleBytes);
+
+    void* p = 0;
+    testAssert(mmgr_posix_memalign(&p, 24, 64, __FILE__, __LINE__, 
+      __FUNCTION__) == EINVAL && !p, "Alignment of 24 was not refused");
+    testAssert(mmgr_posix_memalign(&p, 64, 100, __FILE__, __LINE__, 
+      __FUNCTION__) == 0 && ((voidptr)p & 63) == 0, "posix_memalign() "
+      "failed");
+    mmgr_free(p, __FILE__, __LINE__, __FUNCTION__);
+
+#ifdef __cpp_aligned_new
+    struct alignas(128) Line { char bytes[128]; };
+    Line* lines = new Line[3];
+    testAssert(((voidptr)lines & 127) == 0, "Aligned new gave %p", lines);
+    delete[] lines;
+#endif
+}
+END_TEST_BUDDY()
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+TEST_BUDDY(mmgrUsageRecording)
+{
+    //Usage must follow allocations exactly when every one is tracked, and
+    //the recorder must write what it samples.
+    const size_t oldSampleBytes = mmgr_getSampleBytes();
+    mmgr_setSampleBytes(0);
+    const sint count = 100;
+    void* kept[count];
+    MmgrUsage before, during, after;
+    mmgr_getUsage(&before);
+    for (sint i = 0; i < count; i++)
+        kept[i] = mmgr_malloc(64, __FILE__, __LINE__, __FUNCTION__);
+    mmgr_getUsage(&during);
+    for (sint i = 0; i < count; i++)
+        mmgr_free(kept[i], __FILE__, __LINE__, __FUNCTION__);
+    mmgr_getUsage(&after);
+    mmgr_setSampleBytes(oldSampleBytes);
+
+    testAssert(during.liveBytes - before.liveBytes == 64 * count &&
+      during.liveCount - before.liveCount == count, "Usage grew by %i "
+      "bytes in %i allocations", (sint)(during.liveBytes - before.liveBytes),
+      (sint)(during.liveCount - before.liveCount));
+    testAssert(during.allocations - before.allocations == (suint64)count &&
+      during.sizeClasses[2] - before.sizeClasses[2] == count, "Usage did "
+      "not count the allocations made");
+    testAssert(after.liveBytes == before.liveBytes && 
+      after.liveCount == before.liveCount && after.allocatedBytes == 
+      during.allocatedBytes, "Usage did not count the allocations freed");
+
+    mmgr_startRecording(5, 1000, 0, MMGR_RECORDING_CSV);
+    timing::sleepThread(100);
+    const char* file = "mmgr_recording_test.csv";
+    testAssert(mmgr_writeRecording(file, MMGR_RECORDING_CSV), "Could not "
+      "write recording");
+    sint lines = 0;
+    FILE* f = fopen(file, "rt");
+    if (f) {
+        sint c;
+        while ((c = fgetc(f)) != EOF) {
+            if (c == '\n')
+                lines++;
+        }
+        fclose(f);
+    }
+    remove(file);
+    testAssert(lines >= 3, "Recording has only %i lines", lines);
+
+    file = "mmgr_recording_test.bin";
+    testAssert(mmgr_writeRecording(file, MMGR_RECORDING_BINARY), "Could not"
+      " write recording");
+    f = fopen(file, "rb");
+    char magic[4] = { 0 };
+    if (f) {
+        fread(magic, 1, 4, f);
+        fclose(f);
+    }
+    remove(file);
+    testAssert(!memcmp(magic, "MMTS", 4), "Recording file has no header");
+
+    mmgr_stopRecording();
+    testAssert(!mmgr_writeRecording(file, MMGR_RECORDING_BINARY), "Wrote "
+      "a recording after recording was stopped");
+}
+END_TEST_BUDDY()
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+TEST_BUDDY(mmgrThreadNames)
+{
+    //Threads naming allocations at once must each get their own names, 
+    //even when one names an allocation and is interrupted before making 
+    //it.
+    static volatile sint32 go;
+    static const sint allocations = 2000;
+    class NamingThread : public seashell::Thread
+    {
+    public:
+        sint line;
+        sint misnamed;
+
+        ~NamingThread()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            misnamed = 0;
+            while (!seashell::atomic::loadAcquire(&go))
+                seashell::atomic::cpuRelax();
+            for (sint i = 0; i < allocations; i++) {
+                mmgr_setNames(0, __FILE__, line, __FUNCTION__);
+                timing::sleepThread(0);
+                char* p = new char[16];
+                mmgr::AllocReference* ar = mmgr::findReference(p);
+                //An allocation made while sleeping may have used the name.
+                if (ar && ar->creation.line > 0 && ar->creation.line != line)
+                    misnamed++;
+                delete[] p;
+            }
+        }
+    };
+
+    const size_t oldSampleBytes = mmgr_getSampleBytes();
+    mmgr_setSampleBytes(0);
+    go = 0;
+    NamingThread* threads = new NamingThread[2];
+    for (sint i = 0; i < 2; i++) {
+        threads[i].line = 1000 * (i + 1);
+        threads[i].startThread();
+    }
+    seashell::atomic::storeRelease(&go, (sint32)1);
+    for (sint i = 0; i < 2; i++)
+        threads[i].stopThread();
+    mmgr_setSampleBytes(oldSampleBytes);
+    for (sint i = 0; i < 2; i++) {
+        testAssert(threads[i].misnamed == 0, "Thread %i had %i of %i "
+          "allocations named by another thread", i, threads[i].misnamed,
+          allocations);
+    }
+    delete[] threads;
+}
+END_TEST_BUDDY()
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT && MMGR_SIDE_TABLE
+TEST_BUDDY(mmgrSideTable)
+{
+    //Allocations of every size must be found in the tables, keep their 
+    //contents, and leave the tables when freed.
+    const sint count = 1000;
+    char** kept = (char**)malloc(sizeof(char*) * count);
+    for (sint i = 0; i < count; i++) {
+        const size_t size = (i % 5 == 0) ? 3 * 4096 + i : 1 + i % 100;
+        kept[i] = (char*)mmgr_malloc(size, __FILE__, __LINE__, __FUNCTION__);
+        memset(kept[i], i & 0xff, size);
+        testAssert(mmgr::findReference(kept[i]), "Allocation %i of %i "
+          "bytes is not in the tables", i, (sint)size);
+        testAssert(mmgr::getAllocationSize(kept[i]) >= size, "Allocation %i"
+          " has %i bytes; asked for %i", i, 
+          (sint)mmgr::getAllocationSize(kept[i]), (sint)size);
+#if MMGR_GUARD_BYTES
+        if (mmgr::getAllocationSize(kept[i]) >= MMGR_GUARD_BYTES) {
+            const size_t end = (size_t)(kept[i] + 
+              mmgr::getAllocationSize(kept[i]));
+            const size_t pageSize = mmgr::getPageSize();
+            testAssert((pageSize - end % pageSize) % pageSize < 
+              mmgr::MMGR_MIN_ALIGNMENT, "Guarded allocation %i does not end"
+              " at its guard page", i);
+        }
+#endif
+    }
+    for (sint i = 0; i < count; i++) {
+        const size_t size = (i % 5 == 0) ? 3 * 4096 + i : 1 + i % 100;
+        kept[i] = (char*)mmgr_realloc(kept[i], size + 16, __FILE__, 
+          __LINE__, __FUNCTION__);
+        testAssert((kept[i][0] & 0xff) == (i & 0xff) && 
+          (kept[i][size - 1] & 0xff) == (i & 0xff), "Reallocation %i lost "
+          "contents", i);
+    }
+    for (sint i = 0; i < count; i++) {
+        char* addr = kept[i];
+        mmgr_free(addr, __FILE__, __LINE__, __FUNCTION__);
+        testAssert(!mmgr::findReference(addr), "Freed allocation %i is "
+          "still in the tables", i);
+    }
+    free(kept);
+}
+END_TEST_BUDDY()
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_THOROUGH
+TEST_BUDDY(mmgrThreadedAllocBenchmark)
+{
+    //Threads allocating at once should not wait on each other, so the 
+    //number of allocations per second should grow with the threads, 
+    //whether or not they name their allocations.
+    static volatile sint32 go;
+    static const sint pairs = 200000;
+    class AllocThread : public seashell::Thread
+    {
+    public:
+        //Non-zero to call mmgr_setNames() before each allocation, as the
+        //new macro does.
+        char named;
+
+        ~AllocThread()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            while (!seashell::atomic::loadAcquire(&go))
+                seashell::atomic::cpuRelax();
+            for (sint i = 0; i < pairs; i++) {
+                if (named)
+                    mmgr_setNames(0, __FILE__, __LINE__, __FUNCTION__);
+                //Volatile so that the compiler cannot leave the pair out.
+                char* volatile p = new char[64];
+                delete[] p;
+            }
+        }
+    };
+
+    for (sint named = 0; named < 2; named++) {
+        real64 singleRate = 0;
+        for (sint threadCount = 1; threadCount <= 8; threadCount *= 2) {
+            seashell::Thread* threads[8];
+            for (sint i = 0; i < threadCount; i++) {
+                AllocThread* t = new AllocThread;
+                t->named = (char)named;
+                threads[i] = t;
+            }
+            const real64 rate = testbuddy::benchmarkThreads(threads, 
+              threadCount, &go, pairs);
+            if (threadCount == 1)
+                singleRate = rate;
+            printf("%s, %i threads: %.2fM new/delete pairs per second "
+              "(%.2fx one thread)\n", named ? "Named" : "Unnamed", 
+              threadCount, rate, rate / singleRate);
+        }
+    }
+}
+END_TEST_BUDDY()
+
+
+
+TEST_BUDDY(mmgrSamplingBenchmark)
+{
+    //Sampled allocation should cost little more than malloc().
+    const size_t oldSampleBytes = mmgr_getSampleBytes();
+    const size_t rates[] = { 0, 512 * 1024 };
+    const sint pairs = 1000000;
+    const real64 msPerTick = 1000.0 / timing::getTicksPerSecond();
+    for (sint k = 0; k < (sint)(sizeof(rates) / sizeof(rates[0])); k++) {
+        mmgr_setSampleBytes(rates[k]);
+        big_suint start = timing::getTicks();
+        for (sint i = 0; i < pairs; i++) {
+            //Volatile so that the compiler cannot leave the pair out.
+            char* volatile p = new char[64];
+            delete[] p;
+        }
+        const real64 ms = (timing::getTicks() - start) * msPerTick;
+        printf("Sampling every %i bytes: %.1f ns per new/delete pair\n",
+          (sint)rates[k], ms * 1000000.0 / pairs);
+    }
+    mmgr_setSampleBytes(oldSampleBytes);
+}
+END_TEST_BUDDY()
+#endif
+
 #endif//MMGR
@@ -13,6 +13,80 @@
 //Also note that if used in conjunction with the profiler,
 //each profiler section will automatically track allocations
 //and frees within its code section.
+//
+//Allocations are aligned to twice the size of a pointer.  Memory aligned
+//further comes from aligned_alloc() and posix_memalign() (_aligned_malloc()
+//on Windows), which MMGR tracks too, and from aligned new where the 
+//compiler has it.  Where the compiler has sized delete, the size deleted 
+//is checked against the size allocated.
+//
+//
+//Sampling:
+//Tracking every allocation is slow.  With MMGR_SAMPLE_BYTES (or 
+//mmgr_setSampleBytes()) set to n, only about one allocation per n bytes
+//allocated is tracked, picked at random with a chance that grows with its
+//size.  Other allocations are plain malloc()s, with no leak or corruption
+//checks.  The profiler's allocation statistics are scaled back up by each
+//tracked allocation's chance of being picked, and so are estimates.
+//
+//
+//Side table:
+//Each tracked allocation normally carries its AllocReference and 
+//16 pointers of checks on either side, which spreads small objects over 
+//many more cache lines than they would otherwise take.  With 
+//MMGR_SIDE_TABLE defined to 1, allocations are exactly their requested 
+//size and their AllocReferences are kept in hash tables keyed on address.
+//Small allocations then have no checks.  Instead, with MMGR_GUARD_BYTES
+//also set, allocations of at least that many bytes get pages of their own,
+//ending where a page that cannot be touched begins (less any padding that 
+//alignment needs), so that an overrun faults at the offending instruction
+//rather than being found at free time.  Each costs at least two pages, so
+//keep MMGR_GUARD_BYTES large.
+//
+//
+//Heap snapshots:
+//mmgr_takeSnapshot() totals the allocations outstanding at any moment by
+//allocation site and profiler scope, holding each of MMGR's locks only 
+//while it copies the allocations behind that lock, so that other threads
+//carry on allocating.  mmgr_diffSnapshots() of two snapshots taken some 
+//time apart shows where a long running program is growing.  Snapshots may
+//be printed as text, or written in a binary format:
+//  char[4]     "MMHS"
+//  suint32     version (1)
+//  suint64     time the snapshot was taken, in seconds since the epoch
+//  sint64      allocations
+//  sint64      bytes
+//  suint32     number of sites
+//  sites, most bytes first:
+//    sint64      allocations
+//    sint64      bytes
+//    suint32     line, or 0 where the site is unknown
+//    string      file, function (suint32 length, then characters)
+//    suint32     depth of the profiler scope, then for each scope from the
+//                outermost in: its line, file and function
+//All integers are little-endian.
+//
+//
+//Recording:
+//mmgr_startRecording() starts a thread that notes memory use (see 
+//MmgrUsage) at a fixed interval, keeping the most recent samples in a ring.
+//mmgr_writeRecording() writes them out whenever asked, and they are 
+//written once more when mmgr_stopRecording() is called or the program 
+//exits.  Use is kept per stripe of MMGR's tables, under the locks that 
+//allocating already takes, so recording costs allocations almost nothing.
+//CSV recordings have one line per sample, with the rates of allocation 
+//since the sample before.  Binary recordings are:
+//  char[4]     "MMTS"
+//  suint32     version (1)
+//  suint64     time recording started, in seconds since the epoch
+//  suint32     number of size classes, C
+//  suint32     number of samples
+//  samples, oldest first:
+//    suint64     ms since recording started
+//    sint64      live bytes, live allocations
+//    suint64     bytes allocated, allocations made
+//    sint64[C]   live allocations in each size class
+//All integers are little-endian.
 
 #ifndef MMGR_H_
 #define MMGR_H_
@@ -20,6 +94,7 @@
 
 //Files that report errors when used with MMGR if not included before it.
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <new>
 #ifdef _WINDOWS
@@ -37,16 +112,167 @@
 
 #include "disablemmgrmacros.h"
 
+//Mean number of bytes allocated per tracked allocation; 0 tracks every
+//allocation.
+#ifndef MMGR_SAMPLE_BYTES
+#define MMGR_SAMPLE_BYTES 0
+#endif
+
+//1 to keep AllocReferences in tables rather than next to allocations (see
+//Side table, above).
+#ifndef MMGR_SIDE_TABLE
+#define MMGR_SIDE_TABLE 0
+#endif
+
+//With MMGR_SIDE_TABLE, the size from which allocations are put on pages of
+//their own, ahead of a guard page; 0 for none.
+#ifndef MMGR_GUARD_BYTES
+#define MMGR_GUARD_BYTES 0
+#endif
+
 /**Sets names for the current line.
   */
 void mmgr_setNames(char isDelete, const char* file, const sint line, const char* func);
 
+/**Sets the mean number of bytes allocated per tracked allocation (see 
+  *Sampling, above).  0 tracks every allocation.  Allocations made before
+  *a change are freed correctly after it.
+  */
+void mmgr_setSampleBytes(size_t bytes);
+
+/** @return Returns the mean number of bytes allocated per tracked 
+  *allocation, or 0 if every allocation is tracked.
+  */
+size_t mmgr_getSampleBytes();
+
+/**Outstanding allocations made at one site, within one profiler scope.
+  */
+struct MmgrHeapSite
+{
+    //Where the allocations were made, as given to mmgr_setNames(); file and
+    //func are 0 and line 0 if unknown.
+    const char* file;
+    sint line;
+    const char* func;
+
+    //The profiler scope they were made in (see profiler::printStackTrace()),
+    //or 0.
+    void* profilerFingerprint;
+
+    //Number of allocations, and their bytes.  Estimates when sampling; in 
+    //diffs, the change, which may be negative.
+    sint64 count;
+    sint64 bytes;
+};
+
+/**Outstanding allocations at one time; see Heap snapshots, above.
+  */
+struct MmgrHeapSnapshot
+{
+    //Time the snapshot was taken, in seconds since the epoch.
+    sint64 time;
+
+    //Sites, most bytes first.
+    MmgrHeapSite* sites;
+    size_t siteCount;
+
+    //Totals over all sites.
+    sint64 count;
+    sint64 bytes;
+};
+
+/** @return Returns the allocations outstanding now, or 0 if memory ran 
+  *out.  Free with mmgr_freeSnapshot().  Snapshots are not themselves
+  *tracked.
+  */
+MmgrHeapSnapshot* mmgr_takeSnapshot();
+
+/** @return Returns the change from before to after, or 0 if memory ran 
+  *out.  Sites that did not change are left out.  Free with 
+  *mmgr_freeSnapshot().
+  */
+MmgrHeapSnapshot* mmgr_diffSnapshots(const MmgrHeapSnapshot* before, 
+  const MmgrHeapSnapshot* after);
+
+/**Prints a snapshot or diff as text.
+  * @param maxSites Most sites printed, or 0 for all of them.
+  */
+void mmgr_printSnapshot(FILE* f, const MmgrHeapSnapshot* s, size_t maxSites);
+
+/**Writes a snapshot or diff in the binary format described above.  The 
+  *file is replaced all at once.
+  * @return Returns non-zero on success.
+  */
+sint mmgr_writeSnapshot(const char* file, const MmgrHeapSnapshot* s);
+
+/**Frees a snapshot or diff.
+  */
+void mmgr_freeSnapshot(MmgrHeapSnapshot* s);
+
+//Number of allocation size classes: class i holds allocations of up to 
+//16 << i bytes, and the last holds all larger ones.
+const sint MMGR_SIZE_CLASSES = 14;
+
+/**Memory use at one moment.  Estimates when sampling.
+  */
+struct MmgrUsage
+{
+    //ms since recording started; 0 from mmgr_getUsage().
+    suint64 timeMs;
+
+    //Bytes of outstanding allocations, and their number.
+    sint64 liveBytes;
+    sint64 liveCount;
+
+    //Bytes of every allocation made so far, and their number.
+    suint64 allocatedBytes;
+    suint64 allocations;
+
+    //Outstanding allocations in each size class.
+    sint64 sizeClasses[MMGR_SIZE_CLASSES];
+};
+
+//Formats for mmgr_writeRecording().
+enum MmgrRecordingFormat
+{
+    MMGR_RECORDING_CSV,
+    MMGR_RECORDING_BINARY
+};
+
+/**Fills usage with memory use now.
+  */
+void mmgr_getUsage(MmgrUsage* usage);
+
+/**Starts recording memory use (see Recording, above).  Does nothing if a
+  *recording is already running; see mmgr_stopRecording().
+  * @param intervalMs Milliseconds between samples.
+  * @param samples Most samples kept; older ones are dropped.
+  * @param exitFile File that the recording is written to when the program
+  *exits, or 0.
+  * @param exitFormat Format that exitFile is written in.
+  */
+void mmgr_startRecording(suint intervalMs, suint samples, 
+  const char* exitFile, MmgrRecordingFormat exitFormat);
+
+/**Writes the samples recorded so far.  The file is replaced all at once.
+  * @return Returns non-zero on success.
+  */
+sint mmgr_writeRecording(const char* file, MmgrRecordingFormat format);
+
+/**Stops recording memory use, writing the exit file that 
+  *mmgr_startRecording() was given, if any.  Another recording may then be
+  *started.
+  */
+void mmgr_stopRecording();
+
 /**Custom functions, named appropriately.
   */
 void* mmgr_malloc(size_t size, const char* file, const sint line, const char* func);
 void* mmgr_realloc(void* addr, size_t size, const char* file, const sint line, const char* func);
 void* mmgr_calloc(size_t count, size_t size, const char* file, const sint line, const char* func);
 char* mmgr_strdup(const char* str, const char* file, const sint line, const char* func);
+void* mmgr_aligned_alloc(size_t alignment, size_t size, const char* file, const sint line, const char* func);
+sint mmgr_posix_memalign(void** addr, size_t alignment, size_t size, const char* file, const sint line, const char* func);
 void mmgr_free(void* addr, const char* file, const sint line, const char* func);
 
 /**For instances where you may want to say, overload operator new, it is important that you 
@@ -61,6 +287,10 @@ void mmgr_free(void* addr, const char* file, const sint line, const char* func);
 #define mmgrcalloc(cnt, sz) mmgr_calloc((cnt), (sz), __FILE__, __LINE__, __FUNCTION__)
 #define mmgrstrdup(t) mmgr_strdup(t, __FILE__, __LINE__, __FUNCTION__)
 #define mmgrfree(t) mmgr_free((t), __FILE__, __LINE__, __FUNCTION__)
+#define mmgraligned_alloc(a, sz) mmgr_aligned_alloc((a), (sz), __FILE__, __LINE__, __FUNCTION__)
+#define mmgrposix_memalign(p, a, sz) mmgr_posix_memalign((p), (a), (sz), __FILE__, __LINE__, __FUNCTION__)
+#define mmgraligned_malloc(sz, a) mmgr_aligned_alloc((a), (sz), __FILE__, __LINE__, __FUNCTION__)
+#define mmgraligned_free(t) mmgr_free((t), __FILE__, __LINE__, __FUNCTION__)
 
 #define new mmgrnew
 #define delete mmgrdelete
@@ -69,6 +299,12 @@ void mmgr_free(void* addr, const char* file, const sint line, const char* func);
 #define calloc mmgrcalloc
 #define strdup mmgrstrdup
 #define free mmgrfree
+#define aligned_alloc mmgraligned_alloc
+#define posix_memalign mmgrposix_memalign
+#ifdef _WINDOWS
+#define _aligned_malloc mmgraligned_malloc
+#define _aligned_free mmgraligned_free
+#endif
 
 #else //MMGR is off
 #define MEMUSAGE(t) 
@@ -79,6 +315,12 @@ void mmgr_free(void* addr, const char* file, const sint line, const char* func);
 #define mmgrcalloc calloc
 #define mmgrstrdup strdup
 #define mmgrfree free
+#define mmgraligned_alloc aligned_alloc
+#define mmgrposix_memalign posix_memalign
+#ifdef _WINDOWS
+#define mmgraligned_malloc _aligned_malloc
+#define mmgraligned_free _aligned_free
+#endif
 #endif//MMGR
 
 #endif//MMGR_H_
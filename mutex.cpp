@@ -5,38 +5,88 @@
 #endif
 
 #include <stdio.h>
+#if defined(_WINDOWS) && PROFILER_LOCK_CONTENTION
+#include <intrin.h>
+#endif
+
+#ifdef _LINUX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "seashell.h"
 
+#if PROFILER_LOCK_CONTENTION
+//Address of the code that called the current function.
+#ifdef _WINDOWS
+#define MUTEX_CALLER() _ReturnAddress()
+#else
+#define MUTEX_CALLER() __builtin_return_address(0)
+#endif
+#endif
+
 namespace seashell
 {
 
 MutexLocker::MutexLocker(Mutex& lock)
-  : lock_(&lock)
+  : lock_(&lock), spinLock_(0), rwLock_(0)
 {
     lock_->mutexLock();
 }
 
 
 
+MutexLocker::MutexLocker(SpinMutex& lock)
+  : lock_(0), spinLock_(&lock), rwLock_(0)
+{
+    spinLock_->mutexLock();
+}
+
+
+
+MutexLocker::MutexLocker(RWMutex& lock)
+  : lock_(0), spinLock_(0), rwLock_(&lock)
+{
+    rwLock_->mutexLock();
+}
+
+
+
 MutexLocker::~MutexLocker()
 {
-    lock_->mutexUnlock();
+    if (spinLock_)
+        spinLock_->mutexUnlock();
+    else if (rwLock_)
+        rwLock_->mutexUnlock();
+    else
+        lock_->mutexUnlock();
 }
 
 
 
 SoftMutexLocker::SoftMutexLocker(Mutex& lock)
-  : lock_(&lock)
+  : lock_(&lock), rwLock_(0)
 {
     lock_->mutexSoftLock();
 }
 
 
 
+SoftMutexLocker::SoftMutexLocker(RWMutex& lock)
+  : lock_(0), rwLock_(&lock)
+{
+    rwLock_->mutexSoftLock();
+}
+
+
+
 SoftMutexLocker::~SoftMutexLocker()
 {
-    lock_->mutexSoftUnlock();
+    if (rwLock_)
+        rwLock_->mutexSoftUnlock();
+    else
+        lock_->mutexSoftUnlock();
 }
 
 
@@ -49,6 +99,11 @@ Mutex::Mutex()
 #elif defined(_LINUX)
     pthread_mutex_init(&mutex_, 0);
 #endif //operating systems
+
+#if PROFILER_LOCK_CONTENTION
+    lockSite_ = profiler::getLockSite(MUTEX_CALLER());
+    lockedAt_ = 0;
+#endif
 }
 
 
@@ -131,15 +186,26 @@ void Mutex::mutexUnlock_()
 
 void Mutex::mutexLock()
 {
+#if PROFILER_LOCK_CONTENTION
+    //Uncontended locks are counted by mutexTryLock(); the rest are timed.
+    if (mutexTryLock())
+        return;
+    const big_suint waitStart = timing::getTicks();
+#endif
     mutexWantsHardlock_ = 1;
     while (1) {
         mutexLock_();
         if (mutexSoftLocks_ == 0) {
             mutexWantsHardlock_ = 0;
-            return;
+            break;
         }
         mutexUnlock_();
     }
+
+#if PROFILER_LOCK_CONTENTION
+    lockedAt_ = timing::getTicks();
+    profiler::recordLock(lockSite_, 1, lockedAt_ - waitStart);
+#endif
 }
 
 
@@ -153,6 +219,11 @@ sint Mutex::mutexTryLock()
         mutexUnlock_();
         return 0;
     }
+
+#if PROFILER_LOCK_CONTENTION
+    lockedAt_ = timing::getTicks();
+    profiler::recordLock(lockSite_, 0, 0);
+#endif
     return 1;
 }
 
@@ -160,6 +231,9 @@ sint Mutex::mutexTryLock()
 
 void Mutex::mutexUnlock()
 {
+#if PROFILER_LOCK_CONTENTION
+    profiler::recordLockHold(lockSite_, timing::getTicks() - lockedAt_);
+#endif
     mutexUnlock_();
 }
 
@@ -167,11 +241,25 @@ void Mutex::mutexUnlock()
 
 void Mutex::mutexSoftLock()
 {
+#if PROFILER_LOCK_CONTENTION
+    //As mutexLock(): only waits are timed.
+    if (!mutexWantsHardlock_ && mutexTryLock_()) {
+        mutexSoftLocks_++;
+        mutexUnlock_();
+        profiler::recordLock(lockSite_, 0, 0);
+        return;
+    }
+    const big_suint waitStart = timing::getTicks();
+#endif
     while (mutexWantsHardlock_)
         timing::sleepThread(0);
     mutexLock_();
     mutexSoftLocks_++;
     mutexUnlock_();
+
+#if PROFILER_LOCK_CONTENTION
+    profiler::recordLock(lockSite_, 1, timing::getTicks() - waitStart);
+#endif
 }
 
 
@@ -188,6 +276,255 @@ void Mutex::mutexSoftUnlock()
 
 
 
+RWMutex::RWMutex()
+  : mutexLocks_(0)
+{
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    InitializeSRWLock(&mutex_);
+#else
+    InitializeCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+    //glibc prefers readers unless told otherwise.
+    pthread_rwlockattr_setkind_np(&attributes, 
+      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&mutex_, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+#endif //operating systems
+
+#if PROFILER_LOCK_CONTENTION
+    lockSite_ = profiler::getLockSite(MUTEX_CALLER());
+    lockedAt_ = 0;
+#endif
+}
+
+
+
+RWMutex::~RWMutex()
+{
+#ifdef _WINDOWS
+#ifndef SRWLOCK_INIT
+    DeleteCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    pthread_rwlock_destroy(&mutex_);
+#endif //operating systems
+
+    eassert(mutexLocks_ == 0, Exception, "Mutex destruction event when mutex "
+      "is still owned by a thread!");
+}
+
+
+
+char RWMutex::mutexIsLocked()
+{
+    if (mutexLocks_ > 0)
+        return 1;
+    //Soft locks are not counted, so that soft lockers share no writes; a
+    //hard lock that cannot be had finds them.  The lock is taken directly,
+    //so that the probe is not counted by the profiler.
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    if (!TryAcquireSRWLockExclusive(&mutex_))
+        return 1;
+    ReleaseSRWLockExclusive(&mutex_);
+#else
+    if (!TryEnterCriticalSection(&mutex_))
+        return 1;
+    LeaveCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    if (pthread_rwlock_trywrlock(&mutex_) != 0)
+        return 1;
+    pthread_rwlock_unlock(&mutex_);
+#endif //operating systems
+    return 0;
+}
+
+
+
+void RWMutex::mutexLock()
+{
+#if PROFILER_LOCK_CONTENTION
+    //Uncontended locks are counted by mutexTryLock(); the rest are timed.
+    if (mutexTryLock())
+        return;
+    const big_suint waitStart = timing::getTicks();
+#endif
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    AcquireSRWLockExclusive(&mutex_);
+#else
+    EnterCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    pthread_rwlock_wrlock(&mutex_);
+#endif //operating systems
+
+    eassert(mutexLocks_ >= 0, Exception, "Mutex lock count is negative.");
+    eassert(mutexLocks_ == 0, Exception, "Mutex already locked.");
+    mutexLocks_++;
+
+#if PROFILER_LOCK_CONTENTION
+    lockedAt_ = timing::getTicks();
+    profiler::recordLock(lockSite_, 1, lockedAt_ - waitStart);
+#endif
+}
+
+
+
+sint RWMutex::mutexTryLock()
+{
+    sint success = 0;
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    if (TryAcquireSRWLockExclusive(&mutex_))
+        success = 1;
+#else
+    if (TryEnterCriticalSection(&mutex_))
+        success = 1;
+#endif
+#elif defined(_LINUX)
+    if (pthread_rwlock_trywrlock(&mutex_) == 0)
+        success = 1;
+#endif //operating systems
+
+    if (success) {
+        eassert(mutexLocks_ >= 0, Exception, "Mutex lock count is negative.");
+        eassert(mutexLocks_ == 0, Exception, "Mutex already locked.");
+        mutexLocks_++;
+
+#if PROFILER_LOCK_CONTENTION
+        lockedAt_ = timing::getTicks();
+        profiler::recordLock(lockSite_, 0, 0);
+#endif
+    }
+
+    return success;
+}
+
+
+
+void RWMutex::mutexUnlock()
+{
+    eassert(mutexLocks_ >= 1, Exception, "Mutex unlock requested when mutex "
+      "is not locked.");
+    eassert(mutexLocks_ == 1, Exception, "Mutex illegally possesses multiple locks.");
+    mutexLocks_--;
+
+#if PROFILER_LOCK_CONTENTION
+    profiler::recordLockHold(lockSite_, timing::getTicks() - lockedAt_);
+#endif
+
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    ReleaseSRWLockExclusive(&mutex_);
+#else
+    LeaveCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    pthread_rwlock_unlock(&mutex_);
+#endif //operating systems
+}
+
+
+
+void RWMutex::mutexSoftLock()
+{
+#if PROFILER_LOCK_CONTENTION
+    //As mutexLock(): only waits are timed.
+    sint acquired = 0;
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    acquired = TryAcquireSRWLockShared(&mutex_);
+#else
+    acquired = TryEnterCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    acquired = (pthread_rwlock_tryrdlock(&mutex_) == 0);
+#endif //operating systems
+    if (acquired) {
+        profiler::recordLock(lockSite_, 0, 0);
+        return;
+    }
+    const big_suint waitStart = timing::getTicks();
+#endif
+
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    AcquireSRWLockShared(&mutex_);
+#else
+    EnterCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    pthread_rwlock_rdlock(&mutex_);
+#endif //operating systems
+
+#if PROFILER_LOCK_CONTENTION
+    profiler::recordLock(lockSite_, 1, timing::getTicks() - waitStart);
+#endif
+}
+
+
+
+void RWMutex::mutexSoftUnlock()
+{
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    ReleaseSRWLockShared(&mutex_);
+#else
+    LeaveCriticalSection(&mutex_);
+#endif
+#elif defined(_LINUX)
+    pthread_rwlock_unlock(&mutex_);
+#endif //operating systems
+}
+
+
+
+//Most pauses between two attempts of a contended SpinMutex lock before the
+//thread parks.  Pauses start at one and double each attempt.
+static const sint SPIN_MUTEX_MAX_PAUSES = 64;
+
+
+
+void SpinMutex::lockContended_()
+{
+    for (sint pauses = 1; pauses <= SPIN_MUTEX_MAX_PAUSES; pauses <<= 1) {
+        for (sint i = 0; i < pauses; i++)
+            atomic::cpuRelax();
+        if (state_ == 0 && atomic::compareAndSwap(&state_, 0, 1) == 0)
+            return;
+    }
+
+    //Park.  Whoever gets the lock from here on leaves it at 2, since other
+    //threads may still be parked, so that its unlock wakes one of them.
+    while (atomic::exchange(&state_, 2) != 0) {
+#ifdef _LINUX
+        //Returns at once if the state is no longer 2.
+        syscall(SYS_futex, &state_, FUTEX_WAIT_PRIVATE, 2, 0, 0, 0);
+#else
+        timing::sleepThread(0);
+#endif
+    }
+}
+
+
+
+void SpinMutex::wakeWaiter_()
+{
+#ifdef _LINUX
+    syscall(SYS_futex, &state_, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+#endif
+}
+
+
+
 #if TESTING >= TESTLEVEL_IMPORTANT
 TEST_BUDDY(mutexLocking)
 {
@@ -236,6 +573,282 @@ TEST_BUDDY(mutexLocking)
     testAssert(i == 200, "Expected i == 400, i = %i", i);
 }
 END_TEST_BUDDY()
+
+
+
+TEST_BUDDY(mutexSoftLocking)
+{
+    //Soft locks must be held by several threads at once, and keep out hard
+    //locks while they are; first on a Mutex, then on an RWMutex.
+    static Mutex m;
+    static RWMutex rw;
+    static volatile sint32 entered;
+    class SoftLocker : public seashell::Thread
+    {
+    public:
+        //Whether to soft lock rw rather than m.
+        bool useRw;
+
+        ~SoftLocker()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            if (useRw) {
+                SoftLockMutex(rw);
+                atomic::storeRelease(&entered, (sint32)1);
+            }
+            else {
+                SoftLockMutex(m);
+                atomic::storeRelease(&entered, (sint32)1);
+            }
+        }
+    };
+
+#if !defined(_WINDOWS) || defined(SRWLOCK_INIT)
+    const sint passes = 2;
+#else
+    //RWMutex soft locks are hard locks here.
+    const sint passes = 1;
+#endif
+    for (sint pass = 0; pass < passes; pass++) {
+        entered = 0;
+        {
+            if (pass == 0)
+                m.mutexSoftLock();
+            else
+                rw.mutexSoftLock();
+            SoftLocker s;
+            s.useRw = pass != 0;
+            s.startThread();
+            for (sint i = 0; i < 1000 && !atomic::loadAcquire(&entered); i++)
+                timing::sleepThread(1);
+            testAssert(entered, "Second soft lock waited for the first "
+              "(pass %i)", pass);
+            if (pass == 0) {
+                testAssert(m.mutexIsLocked(), "Did not report soft lock");
+                testAssert(!m.mutexTryLock(), "Hard locked while soft "
+                  "locked");
+                m.mutexSoftUnlock();
+            }
+            else {
+                testAssert(rw.mutexIsLocked(), "Did not report soft lock");
+                testAssert(!rw.mutexTryLock(), "Hard locked while soft "
+                  "locked");
+                rw.mutexSoftUnlock();
+            }
+        }
+        testAssert(!(pass == 0 ? m.mutexIsLocked() : rw.mutexIsLocked()), 
+          "Reported a lock after all were released (pass %i)", pass);
+    }
+}
+END_TEST_BUDDY()
+
+
+
+TEST_BUDDY(spinMutexLocking)
+{
+    static SpinMutex m;
+    static volatile sint counts[2];
+    static const sint increments = 100000;
+    class Incrementer : public seashell::Thread
+    {
+    public:
+        ~Incrementer()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            for (sint i = 0; i < increments; i++) {
+                LockMutex(m);
+                //Two separate increments, so that a lost update shows.
+                counts[0]++;
+                counts[1] = counts[1] + 1;
+            }
+        }
+    };
+
+    testAssert(sizeof(SpinMutex) == 4, "SpinMutex is %i bytes", 
+      (sint)sizeof(SpinMutex));
+
+    testAssert(m.mutexTryLock(), "Could not lock a free mutex");
+    testAssert(m.mutexIsLocked(), "Did not report lock");
+    testAssert(!m.mutexTryLock(), "Locked a locked mutex");
+    m.mutexUnlock();
+    testAssert(!m.mutexIsLocked(), "Reported a lock after unlocking");
+
+    const sint threadCount = 4;
+    {
+        //Hold the lock while they start, so that some of them park.
+        m.mutexLock();
+        Incrementer threads[threadCount];
+        for (sint i = 0; i < threadCount; i++)
+            threads[i].startThread();
+        timing::sleepThread(10);
+        m.mutexUnlock();
+    }
+    testAssert(counts[0] == threadCount * increments 
+      && counts[1] == counts[0], "Expected %i increments, got %i and %i", 
+      threadCount * increments, counts[0], counts[1]);
+    testAssert(!m.mutexIsLocked(), "Reported a lock after all were released");
+}
+END_TEST_BUDDY()
 #endif //TESTING
 
+
+
+#if TESTING >= TESTLEVEL_THOROUGH
+TEST_BUDDY(mutexContentionBenchmark)
+{
+    //Readers of an RWMutex should not wait on each other, so read-mostly 
+    //work should get faster with more threads, and writers should still 
+    //get their turn.  A Mutex should keep the edge where most locks are 
+    //hard.
+    static Mutex m;
+    static RWMutex rw;
+    static volatile sint32 go;
+    static volatile sint values[8];
+    static const sint operations = 200000;
+    class LockingThread : public seashell::Thread
+    {
+    public:
+        //Percentage of operations that write.
+        sint writePercent;
+
+        //Whether to lock rw rather than m.
+        bool useRw;
+
+        ~LockingThread()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            while (!atomic::loadAcquire(&go))
+                atomic::cpuRelax();
+            for (sint i = 0; i < operations; i++) {
+                if (i % 100 < writePercent) {
+                    if (useRw) {
+                        LockMutex(rw);
+                        write_();
+                    }
+                    else {
+                        LockMutex(m);
+                        write_();
+                    }
+                }
+                else if (useRw) {
+                    SoftLockMutex(rw);
+                    read_();
+                }
+                else {
+                    SoftLockMutex(m);
+                    read_();
+                }
+            }
+        }
+
+    private:
+        void write_()
+        {
+            for (sint k = 0; k < 8; k++)
+                values[k]++;
+        }
+
+        void read_()
+        {
+            sint sum = 0;
+            for (sint k = 0; k < 8; k++)
+                sum += values[k];
+            testAssert(sum == values[0] * 8, "Read a half-written value");
+        }
+    };
+
+    const sint writePercents[] = { 0, 1, 10, 50, 100 };
+    for (sint useRw = 0; useRw < 2; useRw++) {
+        for (sint w = 0; w < (sint)(sizeof(writePercents) / sizeof(sint)); 
+          w++) {
+            for (sint threadCount = 1; threadCount <= 8; threadCount *= 2) {
+                seashell::Thread* threads[8];
+                for (sint i = 0; i < threadCount; i++) {
+                    LockingThread* t = new LockingThread;
+                    t->writePercent = writePercents[w];
+                    t->useRw = useRw != 0;
+                    threads[i] = t;
+                }
+                const real64 rate = testbuddy::benchmarkThreads(threads, 
+                  threadCount, &go, operations);
+                printf("%s, %3i%% writes, %i threads: %.2fM locks per "
+                  "second\n", useRw ? "RWMutex" : "Mutex", writePercents[w],
+                  threadCount, rate);
+            }
+        }
+    }
+}
+END_TEST_BUDDY()
+
+
+
+TEST_BUDDY(spinMutexBenchmark)
+{
+    //Critical sections of a few dozen nanoseconds, as in RecycledPool, 
+    //behind a Mutex and behind a SpinMutex.
+    static Mutex mutex;
+    static SpinMutex spinMutex;
+    static volatile sint32 go;
+    static volatile sint values[8];
+    static const sint operations = 200000;
+    class LockingThread : public seashell::Thread
+    {
+    public:
+        //Whether to lock spinMutex rather than mutex.
+        bool spin;
+
+        ~LockingThread()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            while (!atomic::loadAcquire(&go))
+                atomic::cpuRelax();
+            for (sint i = 0; i < operations; i++) {
+                if (spin) {
+                    LockMutex(spinMutex);
+                    for (sint k = 0; k < 8; k++)
+                        values[k]++;
+                }
+                else {
+                    LockMutex(mutex);
+                    for (sint k = 0; k < 8; k++)
+                        values[k]++;
+                }
+            }
+        }
+    };
+
+    for (sint spin = 0; spin < 2; spin++) {
+        for (sint threadCount = 1; threadCount <= 8; threadCount *= 2) {
+            seashell::Thread* threads[8];
+            for (sint i = 0; i < threadCount; i++) {
+                LockingThread* t = new LockingThread;
+                t->spin = spin != 0;
+                threads[i] = t;
+            }
+            printf("%s, %i threads: %.2fM locks per second\n",
+              spin ? "SpinMutex" : "Mutex", threadCount, 
+              testbuddy::benchmarkThreads(threads, threadCount, &go, 
+              operations));
+        }
+    }
+}
+END_TEST_BUDDY()
+#endif
+
 } //seashell
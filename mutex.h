@@ -21,11 +21,16 @@ namespace seashell
 //This class also features soft locks, which are non-exclusive.  Soft locks
 //imply that a function reads the data, and will be corrupted if the data is
 //changed, but that the function itself will not change the data.  The macro
-//SoftLockMutex() will soft lock the mutex.
+//SoftLockMutex() will soft lock the mutex.  Every soft lock and unlock
+//takes the mutex briefly to count itself, so use an RWMutex for data that
+//many threads read at once.
 //
 //There is no way to graduate a soft lock into a hard lock.  The reason for 
 //this comes about when multiple soft locks want to graduate to a hard lock -
 //a deadlock results.
+//
+//With PROFILER_LOCK_CONTENTION (see profiler.h), locks and the time spent 
+//waiting for them are counted by the profiler.
 class Mutex
 {
 public:
@@ -87,6 +92,149 @@ private:
 #elif defined(_LINUX)
     pthread_mutex_t mutex_;
 #endif //Operating systems
+
+#if PROFILER_LOCK_CONTENTION
+    //Where this Mutex was constructed.
+    profiler::LockSite* lockSite_;
+
+    //Tick count when the current hard lock was taken.
+    big_suint lockedAt_;
+#endif
+};
+
+
+
+//Reader/writer mutex, with the same interface as Mutex, for data that is 
+//read far more often than it is written.  Soft locks are the read locks of
+//a reader/writer lock (pthread_rwlock_t, or a slim reader/writer lock on 
+//Windows), so soft lockers never wait on each other.  Writers are 
+//preferred: once a hard lock is waiting, new soft locks wait behind it, so
+//that a stream of readers cannot starve writers.  A thread that already 
+//holds a soft lock must therefore not take another.  Where Windows has no
+//slim reader/writer locks, soft locks are hard locks.
+//
+//Hard locks cost more than a Mutex's, more so under contention, so keep to
+//Mutex where most locks are hard.
+class RWMutex
+{
+public:
+    /**Creates and initializes a locking mechanism for this object.
+      */
+    RWMutex();
+
+    /**Destroys the RWMutex object.  Invalidates the locking mechanism.
+      */
+    virtual ~RWMutex();
+
+    /** @return Returns non-zero if the mutex is locked in any way. */
+    char mutexIsLocked();
+
+    /**Locks the mutex.  Locks do not allow stacking.
+      *This function blocks until the mutex is acquired.
+      */
+    void mutexLock();
+
+    /**Locks the mutex if no other lock is held on it.
+      * @return Returns non-zero if the calling thread now has ownership.
+      */
+    sint mutexTryLock();
+
+    /**Unlocks the mutex.
+      */
+    void mutexUnlock();
+
+    /**Soft locks the mutex.
+      */
+    void mutexSoftLock();
+
+    /**Unlocks a soft lock on the mutex.
+      */
+    void mutexSoftUnlock();
+
+private:
+    //Is the mutex hard locked?
+    sint mutexLocks_;
+
+#ifdef _WINDOWS
+#ifdef SRWLOCK_INIT
+    SRWLOCK mutex_;
+#else
+    CRITICAL_SECTION mutex_;
+#endif
+#elif defined(_LINUX)
+    pthread_rwlock_t mutex_;
+#endif //Operating systems
+
+#if PROFILER_LOCK_CONTENTION
+    //Where this RWMutex was constructed.
+    profiler::LockSite* lockSite_;
+
+    //Tick count when the current hard lock was taken.
+    big_suint lockedAt_;
+#endif
+};
+
+
+
+//Lightweight mutex in a single 32-bit word, for short critical sections and
+//for embedding one lock per object.  An uncontended lock or unlock is one 
+//atomic operation.  A contended lock spins for a short while, pausing 
+//between attempts and doubling the pause each time, before parking the 
+//thread on a futex (Linux) or yielding it (elsewhere).
+//
+//There are no soft locks and no debug lock counts, and the lock is not 
+//fair.  LockMutex() works on a SpinMutex as it does on a Mutex.
+class SpinMutex
+{
+public:
+    /**Creates an unlocked mutex.
+      */
+    SpinMutex()
+      : state_(0)
+    {
+    }
+
+    /** @return Returns non-zero if the mutex is locked. */
+    char mutexIsLocked()
+    {
+        return state_ != 0;
+    }
+
+    /**Locks the mutex.  Locks do not allow stacking.
+      *This function blocks until the mutex is acquired.
+      */
+    void mutexLock()
+    {
+        if (atomic::compareAndSwap(&state_, 0, 1) != 0)
+            lockContended_();
+    }
+
+    /**Locks the mutex if it is free.
+      * @return Returns non-zero if the calling thread now has ownership.
+      */
+    sint mutexTryLock()
+    {
+        return atomic::compareAndSwap(&state_, 0, 1) == 0;
+    }
+
+    /**Unlocks the mutex.
+      */
+    void mutexUnlock()
+    {
+        if (atomic::exchange(&state_, 0) == 2)
+            wakeWaiter_();
+    }
+
+private:
+    /**Spins, then parks, until the mutex is acquired. */
+    void lockContended_();
+
+    /**Wakes a thread parked in lockContended_(). */
+    void wakeWaiter_();
+
+    //0 when unlocked, 1 when locked, and 2 when locked with threads that
+    //may be parked on it.
+    volatile sint32 state_;
 };
 
 
@@ -104,12 +252,22 @@ public:
       */
     MutexLocker(Mutex& lock);
 
+    /**Locks the specified spin mutex.
+      */
+    MutexLocker(SpinMutex& lock);
+
+    /**Locks the specified reader/writer mutex.
+      */
+    MutexLocker(RWMutex& lock);
+
     /**Releases the lock. 
       */
     ~MutexLocker();
 
 private:
     Mutex* lock_;
+    SpinMutex* spinLock_;
+    RWMutex* rwLock_;
 };
 
 class SoftMutexLocker
@@ -119,12 +277,17 @@ public:
       */
     SoftMutexLocker(Mutex& lock);
 
+    /**Soft locks the specified reader/writer mutex.
+      */
+    SoftMutexLocker(RWMutex& lock);
+
     /**Releases the lock. 
       */
     ~SoftMutexLocker();
 
 private:
     Mutex* lock_;
+    RWMutex* rwLock_;
 };
 
 } //seashell
@@ -7,21 +7,95 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <vector>
+#ifdef _LINUX
+#include <signal.h>
+#include <errno.h>
+#include <semaphore.h>
+#endif
 
 #include "seashell.h"
 #include "disablemmgrmacros.h"
 #include "threadprivate.h"
 #include "profiler_timinginfo.h"
+#include "profiler_snapshot.h"
+#if PROFILER_HARDWARE_COUNTERS
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 #if PROFILE
 
 //Should the estimated runtime of profilers be subtracted from reported 
 //execution times?
 #define PROFILER_PROCESS_OVERHEAD 0
+#if PROFILER_HARDWARE_COUNTERS
+//Every Bomb then reads its counters with a system call on entry and on exit,
+//so calibrating with the full loop count would stall the first PROFILER() 
+//for half a minute.  Fewer loops still time that overhead well.
+const int PROFILER_OVERHEAD_LOOPS = 20000;
+#else
 const int PROFILER_OVERHEAD_LOOPS = 2000000;
+#endif
+
+//Number of children a TimingInfo may have before its children are indexed in
+//a hash table rather than found by walking the sibling list.
+const suint PROFILER_CHILD_TABLE_MIN = 8;
+
+//Sizes of the chunks that a ProfilerArena allocates.  Chunks start small,
+//so that threads with few scopes stay cheap, and double up to the maximum.
+const suint PROFILER_ARENA_FIRST_CHUNK = 4 * 1024;
+const suint PROFILER_ARENA_MAX_CHUNK = 64 * 1024;
+
+//Alignment of every ProfilerArena allocation.
+const suint PROFILER_ARENA_ALIGN = 16;
+
+//Number of finished threads whose trees may wait to be merged into the 
+//master.  The thread that finishes after that merges them all.
+const sint PROFILER_PENDING_MAX = 64;
+
+//Most threads used to merge finished threads' trees.
+const sint PROFILER_MERGE_THREADS = 8;
+
+//Latency histogram buckets per power of two are 1 << this, so that 
+//latencies are kept to within 1/16th.
+const suint PROFILER_HISTOGRAM_SUB_BITS = 4;
+
+//Latencies of 1 << this many ticks and up share the last histogram bucket.
+const suint PROFILER_HISTOGRAM_MAX_BITS = 48;
+
+//Number of buckets in a latency histogram.
+const suint PROFILER_HISTOGRAM_BUCKETS = 
+  (PROFILER_HISTOGRAM_MAX_BITS - PROFILER_HISTOGRAM_SUB_BITS + 1) << 
+  PROFILER_HISTOGRAM_SUB_BITS;
+
+//Number of scopes listed under each heading of the allocation report.
+const suint32 PROFILER_TOP_ALLOCATORS = 20;
+
+//Number of Mutex creation sites listed in the lock report.
+const suint32 PROFILER_TOP_LOCK_SITES = 20;
+
+//Number of hash buckets that Mutex creation sites are kept in.  A power of
+//two.
+const suint32 PROFILER_LOCK_SITE_BUCKETS = 256;
+
+//Number of sampler slots allocated at a time.  One slot is used per thread
+//that has a ProfilerManager.
+const sint PROFILER_SAMPLER_BLOCK_SLOTS = 64;
 
-#define TIMING_METHOD_SAMPLING 1
+//Number of events kept per thread by the event trace.  A power of two.
+const suint32 PROFILER_TRACE_EVENTS = 1 << 16;
+
+//How often the snapshot thread checks whether a snapshot is due, in ms.
+const suint PROFILER_SNAPSHOT_POLL_MS = 50;
+
+//Signal that requests a snapshot once startSnapshots() has been called.
+//Define as 0 to leave signal handling to the application.
+#if defined(_LINUX) && !defined(PROFILER_SNAPSHOT_SIGNAL)
+#define PROFILER_SNAPSHOT_SIGNAL SIGUSR1
+#endif
 
 //Sampling method 1: System times (Not thread execution times)
 //Sampling method 2: Thread Execution times - Double-pass timer flag (Once on 
@@ -29,15 +103,36 @@ const int PROFILER_OVERHEAD_LOOPS = 2000000;
 //not work for any thread except the caller.
 #define METHOD_SAMPLING_METHOD 1
 
-#define PROFILER_TIMING_METHOD TIMING_METHOD_SAMPLING
-
 namespace profiler
 {
     //Output file
     static char output[] = "profile.txt";
 
+    //Collapsed stack output file
+    static char collapsedOutput[] = "profile.folded";
+
+#if MMGR
+    //Allocation report output file
+    static char allocatorsOutput[] = "profile.allocators.txt";
+#endif
+
+#if PROFILER_LOCK_CONTENTION
+    //Lock report output file
+    static char locksOutput[] = "profile.locks.txt";
+#endif
+
+#if PROFILER_EVENT_TRACE
+    //Event trace output file
+    static char traceOutput[] = "profile.trace.json";
+
+    //Tick count that event trace times are relative to.
+    big_suint traceBaseTicks = 0;
+#endif
+
     //Top level timing node name
     static char topLevelName[] = "Application";
+
+    volatile sint32 processEnabled = PROFILER_START_ENABLED;
     
     //Master ProfilerManager.
     class ProfilerManager;
@@ -56,6 +151,8 @@ namespace profiler
         ~ManagerCapsule()
         {
             //kill sampling thread
+            //Cached managers are about to be deleted.
+            alive = 0;
         }
     }; 
     char ManagerCapsule::alive = 1;
@@ -67,26 +164,186 @@ namespace profiler
         //return 0;
     }
 
+    //The calling thread's ProfilerManager, as last returned by 
+    //profileManagers().get(), so that Bombs rarely need to go through 
+    //ThreadPrivate.  0 until then.
+    static SEASHELL_THREAD_LOCAL ProfilerManager* threadManager = 0;
+
+
+
+    /** @return Returns the calling thread's ProfilerManager, creating it if
+      *need be, or 0 if managers are being destroyed.
+      */
+    inline ProfilerManager* getThreadManager()
+    {
+        ProfilerManager* pm = threadManager;
+        if (!ManagerCapsule::alive)
+            return 0;
+        if (!pm) {
+            pm = profileManagers().get();
+            threadManager = pm;
+        }
+        return pm;
+    }
+
     //Thread termination function
     void terminateThread()
     {
+        threadManager = 0;
         profileManagers().destroy();
     }
 
+    //Bump-pointer allocator for a ProfilerManager's TimingInfos, names, and
+    //child tables.  Nothing is freed individually; everything goes at once
+    //when the arena is released.  Allocations are zeroed, and consecutive
+    //allocations are contiguous, so a tree built in one arena is walked 
+    //mostly in order.
+    class ProfilerArena
+    {
+    public:
+        ProfilerArena()
+          : chunks_(0), next_(0), end_(0), chunkSize_(0)
+        {
+        }
+
+
+
+        /** @return Returns size bytes of zeroed memory.
+          */
+        void* allocate(suint size)
+        {
+            size = (size + PROFILER_ARENA_ALIGN - 1) & 
+              ~(PROFILER_ARENA_ALIGN - 1);
+            if ((suint)(end_ - next_) < size)
+                grow_(size);
+            void* ret = next_;
+            next_ += size;
+            return ret;
+        }
+
+
+
+        /** @return Returns a copy of s.
+          */
+        char* copyString(const char* s)
+        {
+            const suint length = (suint)strlen(s) + 1;
+            char* ret = (char*)allocate(length);
+            memcpy(ret, s, length);
+            return ret;
+        }
+
+
+
+        /**Takes ownership of all of other's memory, which stays where it is.
+          *Other is left empty.
+          */
+        void adopt(ProfilerArena& other)
+        {
+            if (!other.chunks_)
+                return;
+
+            Chunk* last = other.chunks_;
+            while (last->next)
+                last = last->next;
+            if (chunks_) {
+                //Keep allocating from our current chunk, which is first.
+                last->next = chunks_->next;
+                chunks_->next = other.chunks_;
+            }
+            else {
+                last->next = 0;
+                chunks_ = other.chunks_;
+                next_ = other.next_;
+                end_ = other.end_;
+                chunkSize_ = other.chunkSize_;
+            }
+            other.chunks_ = 0;
+            other.next_ = other.end_ = 0;
+            other.chunkSize_ = 0;
+        }
+
+
+
+        /**Frees everything that was allocated from this arena.
+          */
+        void release()
+        {
+            while (chunks_) {
+                Chunk* next = chunks_->next;
+                free(chunks_);
+                chunks_ = next;
+            }
+            next_ = end_ = 0;
+            chunkSize_ = 0;
+        }
+
+    private:
+        struct Chunk
+        {
+            Chunk* next;
+        };
+
+        //Size of a Chunk header, keeping allocations aligned.
+        static suint headerSize_()
+        {
+            return (sizeof(Chunk) + PROFILER_ARENA_ALIGN - 1) & 
+              ~(PROFILER_ARENA_ALIGN - 1);
+        }
+
+
+
+        /**Starts a new chunk with room for at least size bytes.
+          */
+        void grow_(suint size)
+        {
+            if (chunkSize_ == 0)
+                chunkSize_ = PROFILER_ARENA_FIRST_CHUNK;
+            else if (chunkSize_ < PROFILER_ARENA_MAX_CHUNK)
+                chunkSize_ <<= 1;
+            suint bytes = chunkSize_;
+            if (bytes < size)
+                bytes = size;
+
+            //Zeroing the chunk now also faults its pages in, in one go,
+            //rather than one at a time as new scopes are first entered.
+            Chunk* chunk = (Chunk*)malloc(headerSize_() + bytes);
+            memset(chunk, 0, headerSize_() + bytes);
+            chunk->next = chunks_;
+            chunks_ = chunk;
+            next_ = (char*)chunk + headerSize_();
+            end_ = next_ + bytes;
+        }
+
+        //All chunks; the first is the one being allocated from.
+        Chunk* chunks_;
+
+        //Free space in the first chunk.
+        char* next_;
+        char* end_;
+
+        //Size of the last chunk allocated.
+        suint chunkSize_;
+    };
+
+
+
     //Result printing function
-    void printProfilerResults(TimingInfo* current);
+    void printProfilerResults(TimingInfo* current, ProfilerArena& arena);
 
 
 
-    /**Crops a TimingInfo's name.
+    /**Crops a TimingInfo's name.  Names are shared between TimingInfos, so a
+      *cropped name is a new copy.
       */
-    void cropProfilerName(TimingInfo* record)
+    void cropProfilerName(ProfilerArena& arena, TimingInfo* record)
     {
         sint similar = 0;
         TimingInfo* up = record->up;
         if (up && up->name) {
             sint upNameLength = (sint)strlen(up->name);
             if (strncmp(up->name, record->name, upNameLength) == 0) {
+                record->name = arena.copyString(record->name);
                 record->name[0] = '*';
                 record->name[1] = '*';
                 sint i;
@@ -99,6 +356,7 @@ namespace profiler
                 for (sint i = upNameLength - 1; i > 0; i--)
                     if (up->name[i] == ':' && up->name[i - 1] == ':') {
                         if (strncmp(up->name, record->name, i) == 0) {
+                            record->name = arena.copyString(record->name);
                             record->name[0] = '*';
                             record->name[1] = ':';
                             sint j;
@@ -116,820 +374,3059 @@ namespace profiler
 
 
 
-    //The primary profiler manager class.  Each instance represents a separate
-    //thraed.  On deletion, they are all merged into a single manager which 
-    //represents the entirety of the application.
-    class ProfilerManager
+    /**Hashes a fingerprint into a child table slot.  Fingerprints are the
+      *addresses of static markers, so the low bits carry little information.
+      */
+    inline suint hashFingerprint(void* fingerprint, suint mask)
     {
-    public:
-        /**Initialize the ProfilerManager and its stack of TimingInfos.
-          */
-        ProfilerManager()
-        {
-            eassert(master, Exception, "Profilers are being created before "
-              "static initialization has finished.");
+        return (suint)((((voidptr)fingerprint >> 2) * 2654435761u) >> 4) & mask;
+    }
 
-#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
-#if METHOD_SAMPLING_METHOD == 1
-#else
-            lastSampleTime = timing::getThreadExecutionMs();
-            time = 0;
-#endif
-#endif
 
-            current_ = (TimingInfo*)malloc(sizeof(TimingInfo));
-            memset(current_, 0, sizeof(TimingInfo));
 
-            numProfilerManager++;
-        }
+    /**Inserts child into node's child table.  The table must have a free
+      *slot.
+      */
+    void insertChildTable(TimingInfo* node, TimingInfo* child)
+    {
+        const suint mask = node->childTableSize - 1;
+        suint i = hashFingerprint(child->fingerprint, mask);
+        while (node->childTable[i])
+            i = (i + 1) & mask;
+        node->childTable[i] = child;
+    }
 
 
 
-        /**Initialize the master ProfilerManager.
-          */
-        ProfilerManager(char isMaster)
-        {
-            current_ = (TimingInfo*)malloc(sizeof(TimingInfo));
-            memset(current_, 0, sizeof(TimingInfo));
-            //Timing set in initialize()
+    /**(Re)builds node's child table from its down list, sized so that the
+      *table is at most half full.  A replaced table is left in the arena; 
+      *tables double, so at most half of the arena's table space is waste.
+      */
+    void buildChildTable(ProfilerArena& arena, TimingInfo* node)
+    {
+        suint size = PROFILER_CHILD_TABLE_MIN * 2;
+        while (size < node->childCount * 2)
+            size <<= 1;
+        node->childTableSize = size;
+        node->childTable = (TimingInfo**)arena.allocate(
+          sizeof(TimingInfo*) * size);
+
+        for (TimingInfo* t = node->down; t; t = t->next)
+            insertChildTable(node, t);
+    }
+
+
+
+    /** @return Returns the child of node with the given fingerprint, or 0 if
+      *there is no such child.
+      */
+    inline TimingInfo* findChild(TimingInfo* node, void* fingerprint)
+    {
+        TimingInfo* t = node->lastChild;
+        if (t && t->fingerprint == fingerprint)
+            return t;
+
+        if (node->childTable) {
+            const suint mask = node->childTableSize - 1;
+            suint i = hashFingerprint(fingerprint, mask);
+            while ((t = node->childTable[i]) != 0) {
+                if (t->fingerprint == fingerprint)
+                    break;
+                i = (i + 1) & mask;
+            }
+        }
+        else {
+            t = node->down;
+            while (t && t->fingerprint != fingerprint)
+                t = t->next;
         }
 
+        if (t)
+            node->lastChild = t;
+        return t;
+    }
 
 
-        /**Since static initialization does not have the profileManagers class
-          *initialized before the master, the first non-master profiler must 
-          *call this function.
-          */
-        void initialize();
 
+    /**Links child in as the first of node's children, and indexes it.
+      * @param arena Arena of node's ProfilerManager.
+      */
+    void addChild(ProfilerArena& arena, TimingInfo* node, TimingInfo* child)
+    {
+        child->up = node;
+        child->next = node->down;
+        //Snapshots walk the down list while this thread runs.
+        seashell::atomic::storeRelease(&node->down, child);
+        node->childCount++;
+
+        if (node->childTable) {
+            if (node->childCount * 2 > node->childTableSize)
+                buildChildTable(arena, node);
+            else
+                insertChildTable(node, child);
+        }
+        else if (node->childCount > PROFILER_CHILD_TABLE_MIN) {
+            buildChildTable(arena, node);
+        }
+    }
 
 
-        /**Merge the ProfilerManager into the master tree.  If we are the
-          *final ProfilerManager, print out the final tree.
-          */
-        ~ProfilerManager();
 
+    /**Must be called after children are removed from node's down list by
+      *anything other than addChild().  Drops the index; it is rebuilt from
+      *the down list as needed.
+      * @param arena Arena of node's ProfilerManager.
+      */
+    void resetChildIndex(ProfilerArena& arena, TimingInfo* node)
+    {
+        node->childTable = 0;
+        node->childTableSize = 0;
+        node->lastChild = 0;
+
+        node->childCount = 0;
+        for (TimingInfo* t = node->down; t; t = t->next)
+            node->childCount++;
+        if (node->childCount > PROFILER_CHILD_TABLE_MIN)
+            buildChildTable(arena, node);
+    }
 
 
-        /** @return Returns the current TimingInfo, which is also unique to 
-          *the current stack trace.
-          */
-        TimingInfo* getCurrent()
-        {
-            return current_;
-        }
 
+#if PROFILER_EVENT_TRACE
+    //A Bomb's lifetime, as recorded by the event trace.
+    struct TraceEvent
+    {
+        //Name of the Bomb's TimingInfo.  Names outlive their TimingInfos.
+        const char* name;
 
+        //Tick counts at the Bomb's construction and destruction.
+        big_suint start;
+        big_suint end;
 
-#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
-        /**Increments the current profile's running time.
-          */
-        void incrementCurrent(void* param)
-        {
-            //This is implemented in parallel to other functions that update
-            //the current profiler.  As such, grab the currently valid tag,
-            //and update that (Note that without temporary, += requires two 
-            //operations and can thus overwrite valid values).
-#if METHOD_SAMPLING_METHOD == 1
-            TimingInfo* current = current_;
-            current->result.runtime += *(big_suint*)param;
-#else
-            time = 1;
+        //Numeric id of the thread that ran the Bomb.
+        sint thread;
+    };
 #endif
-        }
-        big_suint lastSampleTime;
+
+
+
+    //Every thread's current TimingInfo is published in a SamplerSlot, which
+    //the Sampler reads without taking any lock.  Slots are claimed with a
+    //compare-and-swap and their blocks are never freed, so registering or
+    //tearing down a thread never stalls the Sampler (nor vice versa).
+    struct SamplerSlot
+    {
+        //Non-zero while a ProfilerManager owns this slot.
+        volatile sint32 inUse;
+
+        //Non-zero unless profiling is off for the owning thread, in which
+        //case the Sampler passes over the slot.
+        volatile sint32 enabled;
+
+        //The owning thread's current TimingInfo.  0 when the thread is being
+        //torn down.
+        TimingInfo* volatile current;
+
+        //The owning thread's top level TimingInfo, which snapshots copy
+        //while holding the master's mutex.  0 once the thread's tree is
+        //being merged into the master.
+        TimingInfo* volatile root;
+
+#if PROFILER_EVENT_TRACE
+        //Ring buffer of the owning thread's most recent events.  Allocated 
+        //by the slot's first owner and kept, along with its events, for
+        //later owners.
+        TraceEvent* volatile events;
+
+        //Number of events ever written to events.  Only the owner writes.
+        volatile suint32 eventCount;
+
+        //Set once events has been filled.
+        volatile sint32 eventsFull;
 #endif
-        //Macro used to add execution time to current profiler
-        
-#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING && \
-  METHOD_SAMPLING_METHOD == 2
-    #define Sample_Exec_Time \
-      if (time) { \
-        time = 0; \
-        big_suint temp = timing::getThreadExecutionMs(); \
-        current_->result.runtime += temp - lastSampleTime; \
-        lastSampleTime = temp; \
-      }
-#else
-    #define Sample_Exec_Time 
+
+#if METHOD_SAMPLING_METHOD == 2
+        //Flag; if 1, the owner adds execution time to its active profile.
+        volatile sint32 sampleDue;
 #endif
-        
+    };
 
+    struct SamplerBlock
+    {
+        SamplerSlot slots[PROFILER_SAMPLER_BLOCK_SLOTS];
+        SamplerBlock* volatile next;
+    };
 
+    //First block of slots; further blocks are chained on as needed.
+    SamplerBlock samplerSlots;
 
-        /**Based on a fingerprint, return the applicable TimingInfo*.
-          */
-        TimingInfo* locateFingerprint(void* fingerprint)
-        {
-            if (!masterInitialized) {
-                masterInitialized = 1;
-                master->initialize();
-            }
-            
-            Sample_Exec_Time
+    //Incremented by the Sampler before and after each pass; odd while the 
+    //Sampler may be adding time to a TimingInfo.
+    volatile sint32 samplerPass = 0;
 
-            TimingInfo* t = current_->down;
-            while (t) {
-                if (t->fingerprint == fingerprint) {
-                    current_ = t;
-                    return current_;
+
+
+    /** @return Returns a SamplerSlot owned by the caller.
+      */
+    SamplerSlot* claimSamplerSlot()
+    {
+        SamplerBlock* block = &samplerSlots;
+        while (1) {
+            for (sint i = 0; i < PROFILER_SAMPLER_BLOCK_SLOTS; i++) {
+                SamplerSlot* slot = &block->slots[i];
+                if (slot->inUse == 0 && 
+                  seashell::atomic::compareAndSwap(&slot->inUse, 0, 1) == 0) {
+                    return slot;
                 }
-                t = t->next;
             }
 
-            t = (TimingInfo*)malloc(sizeof(TimingInfo));
-            memset(t, 0, sizeof(TimingInfo));
-            t->fingerprint = fingerprint;
-            t->up = current_;
-            t->next = current_->down;
-            current_->down = t;
-            current_ = t;
-            return current_;
+            SamplerBlock* next = seashell::atomic::loadAcquire(&block->next);
+            if (!next) {
+                SamplerBlock* fresh = (SamplerBlock*)malloc(
+                  sizeof(SamplerBlock));
+                memset(fresh, 0, sizeof(SamplerBlock));
+                next = seashell::atomic::compareAndSwapPointer(&block->next,
+                  (SamplerBlock*)0, fresh);
+                if (next)
+                    free(fresh); //Another thread chained a block first.
+                else
+                    next = fresh;
+            }
+            block = next;
         }
+    }
 
 
 
-        /**When a profile has finished, calling this function will set the 
-          *current profile to its parent.
-          */
-        void invalidateFingerprint()
-        {
-            Sample_Exec_Time
-
-            current_ = current_->up;
-            eassert(current_, Exception, "The Profiler has for some reason "
-              "allowed its current node to become null.");
+    /**Returns a slot.  Once this returns, the Sampler is guaranteed not to
+      *touch the TimingInfo that the slot last published.
+      */
+    void releaseSamplerSlot(SamplerSlot* slot)
+    {
+        slot->current = 0;
+        seashell::atomic::memoryBarrier();
+
+        //A pass that started before current was cleared may still be adding
+        //to the old TimingInfo.  Passes are a quick walk over the slots, so
+        //waiting one out is cheap; the Sampler itself never waits on us.
+        const sint32 pass = seashell::atomic::loadAcquire(&samplerPass);
+        if (pass & 1) {
+            while (seashell::atomic::loadAcquire(&samplerPass) == pass)
+                seashell::atomic::cpuRelax();
         }
-#undef Sample_Exec_Time
 
-#if MMGR
-    public:
-        /**DO NOT use mmgr's new operator!!
-          */
-        void* operator new(size_t size)
-        {
-            return malloc(size);
-        }
+        seashell::atomic::storeRelease(&slot->inUse, (sint32)0);
+    }
 
-        /**DO NOT use mmgr's delete operator!
-          */
-        void operator delete(void* v)
-        {
-            free(v);
-        }
-#endif
 
-    private:
-        /**Merge another manager's tree with this tree.  Keeps the other tree
-          *valid.
-          */
-        void mergeWithAndSteal_(TimingInfo* mine, TimingInfo* other)
-        {
-            mine->result.calls += other->result.calls;
-            mine->result.nestedcalls += other->result.nestedcalls;
-            mine->result.runtime += other->result.runtime;
-#if MMGR
-            mine->result.allocations += other->result.allocations;
-            mine->result.deallocations += other->result.deallocations;
-#endif
 
-            TimingInfo* last = 0;
-            TimingInfo* child = other->down;
-            while (child) {
-                TimingInfo* myChild = mine->down;
-                while (myChild && myChild->fingerprint != child->fingerprint) {
-                    myChild = myChild->next;
+#if PROFILER_HARDWARE_COUNTERS
+    //Events counted by the hardware counter columns, in the order of
+    //TimingInfo::result.counters.
+    struct CounterSet
+    {
+        //perf_event_open type and config of each counter.
+        suint32 type;
+        suint64 configs[PROFILER_NUM_COUNTERS];
+
+        //Column titles, as in profreport.
+        const char* titles[PROFILER_NUM_COUNTERS];
+
+        //Snapshot field of each counter.
+        suint32 fields[PROFILER_NUM_COUNTERS];
+    };
+
+    static const CounterSet hardwareCounters = {
+        PERF_TYPE_HARDWARE,
+        { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+          PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES },
+        { "|  Cycles", "|  Instrs", "|LLC Miss", "| Br Miss" },
+        { snapshot::FIELD_CYCLES, snapshot::FIELD_INSTRUCTIONS,
+          snapshot::FIELD_CACHE_MISSES, snapshot::FIELD_BRANCH_MISSES }
+    };
+
+    //Used where the hardware counters cannot be opened.
+    static const CounterSet softwareCounters = {
+        PERF_TYPE_SOFTWARE,
+        { PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS,
+          PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS },
+        { "| Task ns", "|PgFaults", "|Ctx Swch", "|Migrates" },
+        { snapshot::FIELD_TASK_CLOCK_NS, snapshot::FIELD_PAGE_FAULTS,
+          snapshot::FIELD_CONTEXT_SWITCHES, snapshot::FIELD_CPU_MIGRATIONS }
+    };
+
+    //Counters that every thread opens.  Chosen once, by the master; 0 if 
+    //no counters could be opened.
+    const CounterSet* counterSet = 0;
+
+
+
+    /**Opens set's counters for the calling thread, as one group, so that
+      *they are all read at once.
+      * @param fds Receives the counters' descriptors.  fds[0] leads the 
+      *group.
+      * @return Returns non-zero on success.  On failure, every descriptor is
+      *-1.
+      */
+    sint openCounters(const CounterSet* set, sint* fds)
+    {
+        for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+            fds[i] = -1;
+        if (!set)
+            return 0;
+
+        for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = set->type;
+            attr.config = set->configs[i];
+            //The kernel multiplexes groups when there are more counters 
+            //than registers; the times let reads scale for that.
+            attr.read_format = PERF_FORMAT_GROUP | 
+              PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            //Allowed without privileges at perf_event_paranoid 2.
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = (sint)syscall(__NR_perf_event_open, &attr, 0, -1, 
+              i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0) {
+                for (sint j = 0; j < i; j++) {
+                    close(fds[j]);
+                    fds[j] = -1;
+                }
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+
+
+    /**Closes counters opened by openCounters().
+      */
+    void closeCounters(sint* fds)
+    {
+        for (sint i = PROFILER_NUM_COUNTERS - 1; i >= 0; i--) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+
+
+
+    /** @return Returns the set of counters that can be opened on this
+      *system, or 0 if none can.
+      */
+    const CounterSet* chooseCounterSet()
+    {
+        sint fds[PROFILER_NUM_COUNTERS];
+        if (openCounters(&hardwareCounters, fds)) {
+            closeCounters(fds);
+            return &hardwareCounters;
+        }
+        if (openCounters(&softwareCounters, fds)) {
+            closeCounters(fds);
+            return &softwareCounters;
+        }
+        return 0;
+    }
+#endif
+
+
+
+#if PROFILER_LATENCY_HISTOGRAMS
+    //Durations of a scope's calls, in ticks.  Below 1 << SUB_BITS, each 
+    //bucket is one tick.  Above, each power of two is split into 
+    //1 << SUB_BITS buckets, as in HdrHistogram.
+    struct LatencyHistogram
+    {
+        big_suint counts[PROFILER_HISTOGRAM_BUCKETS];
+
+        //Longest duration seen.
+        big_suint max;
+    };
+
+
+
+    /** @return Returns the index of the highest set bit in value, which 
+      *must not be 0.
+      */
+    inline suint getHighestBit(big_suint value)
+    {
+#ifdef _WINDOWS
+        unsigned long bit;
+#ifdef bit64
+        _BitScanReverse64(&bit, value);
+#else
+        if (value >> 32) {
+            _BitScanReverse(&bit, (unsigned long)(value >> 32));
+            bit += 32;
+        }
+        else
+            _BitScanReverse(&bit, (unsigned long)value);
+#endif
+        return (suint)bit;
+#else
+        return (suint)(63 - __builtin_clzll(value));
+#endif
+    }
+
+
+
+    /** @return Returns the histogram bucket that counts a duration.
+      */
+    inline suint getHistogramBucket(big_suint ticks)
+    {
+        const suint subBuckets = 1 << PROFILER_HISTOGRAM_SUB_BITS;
+        if (ticks < subBuckets)
+            return (suint)ticks;
+        const suint bit = getHighestBit(ticks);
+        if (bit >= PROFILER_HISTOGRAM_MAX_BITS)
+            return PROFILER_HISTOGRAM_BUCKETS - 1;
+        const suint shift = bit - PROFILER_HISTOGRAM_SUB_BITS;
+        return ((shift + 1) << PROFILER_HISTOGRAM_SUB_BITS) + 
+          (suint)((ticks >> shift) & (subBuckets - 1));
+    }
+
+
+
+    /** @return Returns the longest duration counted by a histogram bucket.
+      */
+    inline big_suint getHistogramBucketMax(suint bucket)
+    {
+        const suint subBuckets = 1 << PROFILER_HISTOGRAM_SUB_BITS;
+        if (bucket < subBuckets)
+            return bucket;
+        const suint shift = (bucket >> PROFILER_HISTOGRAM_SUB_BITS) - 1;
+        const big_suint low = (big_suint)(subBuckets + 
+          (bucket & (subBuckets - 1))) << shift;
+        return low + ((big_suint)1 << shift) - 1;
+    }
+
+
+
+    /** @return Returns the duration, in ticks, that fraction of the calls
+      *counted by h took no longer than.  Accurate to the histogram's 
+      *precision, and never more than the longest call.
+      */
+    big_suint getHistogramPercentile(const LatencyHistogram* h, 
+      real64 fraction)
+    {
+        big_suint total = 0;
+        for (suint i = 0; i < PROFILER_HISTOGRAM_BUCKETS; i++)
+            total += h->counts[i];
+        big_suint target = (big_suint)(fraction * total + 0.999999);
+        if (target == 0)
+            target = 1;
+
+        big_suint seen = 0;
+        for (suint i = 0; i < PROFILER_HISTOGRAM_BUCKETS; i++) {
+            seen += h->counts[i];
+            if (seen >= target) {
+                const big_suint ret = getHistogramBucketMax(i);
+                return ret < h->max ? ret : h->max;
+            }
+        }
+        return h->max;
+    }
+#endif
+
+
+
+    //A display name, interned by the fingerprint of the Bomb that it names.
+    struct NameEntry
+    {
+        void* fingerprint;
+        char* name;
+    };
+
+
+
+    //The primary profiler manager class.  Each instance represents a separate
+    //thraed.  On deletion, they are all merged into a single manager which 
+    //represents the entirety of the application.
+    class ProfilerManager
+    {
+    public:
+        /**Initialize the ProfilerManager and its stack of TimingInfos.
+          */
+        ProfilerManager()
+        {
+            eassert(master, Exception, "Profilers are being created before "
+              "static initialization has finished.");
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
+#if METHOD_SAMPLING_METHOD == 1
+#else
+            lastSampleTime = timing::getThreadExecutionMs();
+#endif
+#endif
+
+            threadEnabled_ = 1;
+            names_ = 0;
+            namesSize_ = nameCount_ = 0;
+            current_ = (TimingInfo*)arena_.allocate(sizeof(TimingInfo));
+
+            slot_ = claimSamplerSlot();
+            seashell::atomic::storeRelease(&slot_->enabled, (sint32)1);
+            seashell::atomic::storeRelease(&slot_->current, current_);
+            seashell::atomic::storeRelease(&slot_->root, current_);
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            bomb_ = 0;
+#endif
+            detached_ = 0;
+            nextPending_ = pending_ = 0;
+            pendingCount_ = 0;
+
+#if PROFILER_EVENT_TRACE
+            threadNumber_ = seashell::thread::getCurrentThreadNumericId();
+            if (!slot_->events) {
+                TraceEvent* events = (TraceEvent*)malloc(
+                  sizeof(TraceEvent) * PROFILER_TRACE_EVENTS);
+                seashell::atomic::storeRelease(&slot_->events, events);
+            }
+#endif
+
+#if PROFILER_HARDWARE_COUNTERS
+            openCounters(counterSet, counterFds_);
+#endif
+
+            numProfilerManager++;
+        }
+
+
+
+        /**Initialize the master ProfilerManager.
+          */
+        ProfilerManager(char isMaster)
+        {
+            names_ = 0;
+            namesSize_ = nameCount_ = 0;
+            current_ = (TimingInfo*)arena_.allocate(sizeof(TimingInfo));
+            //The master is never sampled.
+            slot_ = 0;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            bomb_ = 0;
+#endif
+            detached_ = 0;
+            nextPending_ = pending_ = 0;
+            pendingCount_ = 0;
+#if PROFILER_EVENT_TRACE
+            traceBaseTicks = timing::getTicks();
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+            counterSet = chooseCounterSet();
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+                counterFds_[i] = -1;
+#endif
+            //Timing set in initialize()
+        }
+
+
+
+        /**Initialize a ProfilerManager that only gathers a snapshot, 
+          *starting from a copy of tree.
+          */
+        ProfilerManager(TimingInfo* tree)
+        {
+            names_ = 0;
+            namesSize_ = nameCount_ = 0;
+            current_ = copyTree_(tree, 0);
+            slot_ = 0;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            bomb_ = 0;
+#endif
+            detached_ = 1;
+            nextPending_ = pending_ = 0;
+            pendingCount_ = 0;
+#if PROFILER_HARDWARE_COUNTERS
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+                counterFds_[i] = -1;
+#endif
+        }
+
+
+
+        /**Initialize a ProfilerManager that takes over a finished thread's
+          *tree, names, and arena, so that they may be merged into the master
+          *later.  Finished is left empty.
+          */
+        ProfilerManager(ProfilerManager* finished)
+        {
+            arena_.adopt(finished->arena_);
+            names_ = finished->names_;
+            namesSize_ = finished->namesSize_;
+            nameCount_ = finished->nameCount_;
+            finished->names_ = 0;
+            finished->namesSize_ = finished->nameCount_ = 0;
+            current_ = finished->current_;
+            finished->current_ = 0;
+            slot_ = 0;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            bomb_ = 0;
+#endif
+            detached_ = 1;
+            nextPending_ = pending_ = 0;
+            pendingCount_ = 0;
+#if PROFILER_HARDWARE_COUNTERS
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+                counterFds_[i] = -1;
+#endif
+        }
+
+
+
+        /**Since static initialization does not have the profileManagers class
+          *initialized before the master, the first non-master profiler must 
+          *call this function.
+          */
+        void initialize();
+
+
+
+        /**Merge the ProfilerManager into the master tree.  If we are the
+          *final ProfilerManager, print out the final tree.
+          */
+        ~ProfilerManager();
+
+
+
+        /**Writes a snapshot of the master tree and every live thread's tree
+          *to file.  The caller must hold the master's mutex.
+          * @return Returns non-zero on success.
+          */
+        sint writeSnapshot_(const char* file);
+
+
+
+        /**Merges the trees of every finished thread into the master tree.
+          *Called on the master, by the holder of its mutex.
+          */
+        void mergePending_();
+
+
+
+        /**Readies a detached tree to be merged: folds recursion and sums
+          *child timings into their parents.
+          */
+        void prepareDetached_();
+
+
+
+        /**Merges a detached manager's tree into this detached manager's 
+          *tree, and deletes other.
+          */
+        void absorbDetached_(ProfilerManager* other);
+
+
+
+        /** @return Returns non-zero if profiling is on for this thread.
+          */
+        char isThreadEnabled()
+        {
+            return threadEnabled_;
+        }
+
+
+
+        /**Turns profiling on or off for this thread.
+          */
+        void setThreadEnabled(char enabled)
+        {
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING && \
+  METHOD_SAMPLING_METHOD == 2
+            //Time spent disabled is not charged to anything.
+            if (enabled && !threadEnabled_)
+                lastSampleTime = timing::getThreadExecutionMs();
+#endif
+            threadEnabled_ = enabled;
+            if (slot_) {
+                seashell::atomic::storeRelease(&slot_->enabled, 
+                  (sint32)(enabled != 0));
+            }
+        }
+
+
+
+        /** @return Returns the current TimingInfo, which is also unique to 
+          *the current stack trace.
+          */
+        TimingInfo* getCurrent()
+        {
+            return current_;
+        }
+
+
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING && \
+  METHOD_SAMPLING_METHOD == 2
+        big_suint lastSampleTime;
+#endif
+        //Macro used to add execution time to current profiler
+        
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING && \
+  METHOD_SAMPLING_METHOD == 2
+    #define Sample_Exec_Time \
+      if (slot_->sampleDue) { \
+        slot_->sampleDue = 0; \
+        big_suint temp = timing::getThreadExecutionMs(); \
+        current_->result.runtime += temp - lastSampleTime; \
+        lastSampleTime = temp; \
+      }
+#else
+    #define Sample_Exec_Time 
+#endif
+        
+
+
+
+        /**Based on a fingerprint, return the applicable TimingInfo*.
+          */
+        TimingInfo* locateFingerprint(void* fingerprint)
+        {
+            if (!masterInitialized) {
+                masterInitialized = 1;
+                master->initialize();
+            }
+            
+            Sample_Exec_Time
+
+            TimingInfo* t = findChild(current_, fingerprint);
+            if (!t) {
+                t = (TimingInfo*)arena_.allocate(sizeof(TimingInfo));
+                t->fingerprint = fingerprint;
+                addChild(arena_, current_, t);
+            }
+            current_ = t;
+            seashell::atomic::storeRelease(&slot_->current, current_);
+            return current_;
+        }
+
+
+
+        /** @return Returns the display name of a Bomb, which is built only
+          *once per fingerprint.
+          * @param function Function containing the Bomb.
+          * @param name Name given to the Bomb, or 0.
+          */
+        char* getDisplayName(void* fingerprint, const char* function, 
+          const char* name)
+        {
+            char* ret = findName_(fingerprint);
+            if (!ret) {
+                if (!name)
+                    ret = arena_.copyString(function);
+                else {
+                    sint nameLength = (sint)strlen(function) + 
+                      (sint)strlen(name) + 4;
+                    ret = (char*)arena_.allocate(nameLength);
+                    StringCchCopy(ret, nameLength, function);
+                    StringCchCat(ret, nameLength, " \"");
+                    StringCchCat(ret, nameLength, name);
+                    StringCchCat(ret, nameLength, "\"");
+                }
+                addName_(fingerprint, ret);
+            }
+            return ret;
+        }
+
+
+
+        /**When a profile has finished, calling this function will set the 
+          *current profile to its parent.
+          */
+        void invalidateFingerprint()
+        {
+            Sample_Exec_Time
+
+            current_ = current_->up;
+            eassert(current_, Exception, "The Profiler has for some reason "
+              "allowed its current node to become null.");
+            seashell::atomic::storeRelease(&slot_->current, current_);
+        }
+#undef Sample_Exec_Time
+
+
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        /**Makes bomb the innermost Bomb on this thread.
+          * @return Returns the Bomb that was innermost before.
+          */
+        Bomb* enterBomb(Bomb* bomb)
+        {
+            Bomb* parent = bomb_;
+            bomb_ = bomb;
+            return parent;
+        }
+
+
+
+        /**Restores parent as the innermost Bomb on this thread.
+          */
+        void leaveBomb(Bomb* parent)
+        {
+            bomb_ = parent;
+        }
+#endif
+
+#if PROFILER_LATENCY_HISTOGRAMS
+        /**Counts a call of t in t's histogram.
+          */
+        void recordLatency(TimingInfo* t, big_suint ticks)
+        {
+            LatencyHistogram* h = t->result.histogram;
+            if (!h) {
+                h = (LatencyHistogram*)arena_.allocate(
+                  sizeof(LatencyHistogram));
+                //Snapshots copy live histograms.
+                seashell::atomic::storeRelease(&t->result.histogram, h);
+            }
+            h->counts[getHistogramBucket(ticks)]++;
+            if (ticks > h->max)
+                h->max = ticks;
+        }
+#endif
+
+#if PROFILER_HARDWARE_COUNTERS
+        /**Reads this thread's counters, or zeroes if it has none.  If the
+          *group was only counting for part of the time it was enabled, the
+          *counts are scaled up to estimate the whole.
+          */
+        void readCounters(big_suint* values)
+        {
+            if (counterFds_[0] >= 0) {
+                //Number of counters, time enabled, time running, counts.
+                suint64 data[3 + PROFILER_NUM_COUNTERS];
+                if (read(counterFds_[0], data, sizeof(data)) == 
+                  (ssize_t)sizeof(data)) {
+                    const suint64 enabled = data[1];
+                    const suint64 running = data[2];
+                    for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++) {
+                        if (running == 0)
+                            values[i] = 0;
+                        else if (running < enabled) {
+                            values[i] = (big_suint)((real64)data[3 + i] * 
+                              enabled / running);
+                        }
+                        else
+                            values[i] = data[3 + i];
+                    }
+                    return;
+                }
+            }
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+                values[i] = 0;
+        }
+#endif
+
+#if PROFILER_EVENT_TRACE
+        /**Records a Bomb's lifetime in this thread's event trace.
+          */
+        void traceEvent(const char* name, big_suint start, big_suint end)
+        {
+            const suint32 count = slot_->eventCount;
+            TraceEvent* e = 
+              &slot_->events[count & (PROFILER_TRACE_EVENTS - 1)];
+            e->name = name;
+            e->start = start;
+            e->end = end;
+            e->thread = threadNumber_;
+            if (count + 1 == PROFILER_TRACE_EVENTS)
+                slot_->eventsFull = 1;
+            seashell::atomic::storeRelease(&slot_->eventCount, count + 1);
+        }
+#endif
+
+#if MMGR
+    public:
+        /**DO NOT use mmgr's new operator!!
+          */
+        void* operator new(size_t size)
+        {
+            return malloc(size);
+        }
+
+        /**DO NOT use mmgr's delete operator!
+          */
+        void operator delete(void* v)
+        {
+            free(v);
+        }
+#endif
+
+    private:
+        /**Merge another tree with this manager's tree.
+          * @param steal Non-zero if other's nodes are in this manager's 
+          *arena, so children that mine lacks may be moved rather than 
+          *copied.  Otherwise, other's tree is left as it was.
+          */
+        void mergeWith_(TimingInfo* mine, TimingInfo* other, char steal)
+        {
+            mine->result.calls += other->result.calls;
+            mine->result.nestedcalls += other->result.nestedcalls;
+            mine->result.runtime += other->result.runtime;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            mine->result.inclusive += other->result.inclusive;
+            mine->result.exclusive += other->result.exclusive;
+#endif
+#if MMGR
+            mine->result.allocations += other->result.allocations;
+            mine->result.deallocations += other->result.deallocations;
+            mergeAllocationStats_(mine, other);
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+                mine->result.counters[i] += other->result.counters[i];
+#endif
+#if PROFILER_LATENCY_HISTOGRAMS
+            mergeHistogram_(mine, other, steal);
+#endif
+#if PROFILER_LOCK_CONTENTION
+            mine->result.locks += other->result.locks;
+            mine->result.contendedLocks += other->result.contendedLocks;
+            mine->result.lockWaitTicks += other->result.lockWaitTicks;
+            if (other->result.lockMaxHoldTicks > 
+              mine->result.lockMaxHoldTicks)
+                mine->result.lockMaxHoldTicks = 
+                  other->result.lockMaxHoldTicks;
+#endif
+
+            TimingInfo* child = other->down;
+            if (steal)
+                other->down = 0;
+            while (child) {
+                TimingInfo* next = child->next;
+
+                TimingInfo* myChild = findChild(mine, child->fingerprint);
+                if (myChild) { //match
+                    mergeWith_(myChild, child, steal);
+                }
+                else if (steal) {
+                    child->next = 0;
+                    addChild(arena_, mine, child);
+                }
+                else { //we must add it!
+                    addChild(arena_, mine, copyTree_(child, mine));
+                }
+                child = next;
+            }
+            if (steal)
+                resetChildIndex(arena_, other);
+        }
+
+
+
+#if MMGR
+        /**Adds other's allocation statistics to mine's, and has frees of 
+          *other's allocations counted against mine from now on.
+          */
+        void mergeAllocationStats_(TimingInfo* mine, TimingInfo* other)
+        {
+            mine->result.allocationCount += other->result.allocationCount;
+            for (sint i = 0; i < ALLOCATION_SIZE_CLASSES; i++)
+                mine->result.sizeClasses[i] += other->result.sizeClasses[i];
+
+            //A free that looked up other just before this store still 
+            //lands on other; it is picked up by the loop below, unless it
+            //is later still.  The error is at most a few allocations.
+            seashell::atomic::storeRelease(&other->mergedInto, mine);
+            seashell::atomic::memoryBarrier();
+            sint64 live;
+            while ((live = other->result.liveBytes) != 0) {
+                seashell::atomic::add64(&other->result.liveBytes, -live);
+                seashell::atomic::add64(&mine->result.liveBytes, live);
+            }
+
+            //Trees are merged once their threads are done, so peaks from 
+            //different threads are not added together.
+            if (other->result.peakBytes > mine->result.peakBytes)
+                mine->result.peakBytes = other->result.peakBytes;
+            if (mine->result.liveBytes > mine->result.peakBytes)
+                mine->result.peakBytes = mine->result.liveBytes;
+        }
+#endif
+
+
+
+#if PROFILER_LATENCY_HISTOGRAMS
+        /**Adds other's histogram to mine's.  Arguments as mergeWith_().
+          */
+        void mergeHistogram_(TimingInfo* mine, TimingInfo* other, char steal)
+        {
+            LatencyHistogram* theirs = other->result.histogram;
+            if (!theirs)
+                return;
+            LatencyHistogram* h = mine->result.histogram;
+            if (!h) {
+                if (steal) {
+                    mine->result.histogram = theirs;
+                    other->result.histogram = 0;
+                    return;
+                }
+                h = (LatencyHistogram*)arena_.allocate(
+                  sizeof(LatencyHistogram));
+                mine->result.histogram = h;
+            }
+            for (suint i = 0; i < PROFILER_HISTOGRAM_BUCKETS; i++)
+                h->counts[i] += theirs->counts[i];
+            if (theirs->max > h->max)
+                h->max = theirs->max;
+        }
+#endif
+
+
+
+        /** @return Returns a copy of node and its children, allocated from 
+          *this manager's arena, with up set to up.
+          */
+        TimingInfo* copyTree_(TimingInfo* node, TimingInfo* up)
+        {
+            TimingInfo* copy = (TimingInfo*)arena_.allocate(sizeof(TimingInfo));
+            copy->up = up;
+            copy->fingerprint = node->fingerprint;
+            copy->result = node->result;
+#if PROFILER_LATENCY_HISTOGRAMS
+            LatencyHistogram* h = 
+              seashell::atomic::loadAcquire(&node->result.histogram);
+            if (h) {
+                copy->result.histogram = (LatencyHistogram*)arena_.allocate(
+                  sizeof(LatencyHistogram));
+                memcpy(copy->result.histogram, h, sizeof(LatencyHistogram));
+            }
+#endif
+            if (node->name)
+                copy->name = internName_(node->fingerprint, node->name);
+            copy->file = node->file;
+            copy->line = node->line;
+            copy->function = node->function;
+
+            //In order, and loaded with care; snapshots copy live trees.
+            TimingInfo* last = 0;
+            TimingInfo* child = seashell::atomic::loadAcquire(&node->down);
+            while (child) {
+                TimingInfo* childCopy = copyTree_(child, copy);
+                if (last)
+                    last->next = childCopy;
+                else
+                    copy->down = childCopy;
+                last = childCopy;
+                copy->childCount++;
+                child = child->next;
+            }
+            if (copy->childCount > PROFILER_CHILD_TABLE_MIN)
+                buildChildTable(arena_, copy);
+            return copy;
+        }
+
+
+
+        /** @return Returns this manager's copy of the display name for 
+          *fingerprint, or 0 if it has none.
+          */
+        char* findName_(void* fingerprint)
+        {
+            if (!names_)
+                return 0;
+            const suint mask = namesSize_ - 1;
+            suint i = hashFingerprint(fingerprint, mask);
+            while (names_[i].fingerprint) {
+                if (names_[i].fingerprint == fingerprint)
+                    return names_[i].name;
+                i = (i + 1) & mask;
+            }
+            return 0;
+        }
+
+
+
+        /**Stores name as this manager's display name for fingerprint.
+          */
+        void addName_(void* fingerprint, char* name)
+        {
+            if ((nameCount_ + 1) * 2 > namesSize_) {
+                //The old table is left in the arena.
+                NameEntry* old = names_;
+                const suint oldSize = namesSize_;
+                namesSize_ = oldSize ? oldSize * 2 : 
+                  PROFILER_CHILD_TABLE_MIN * 2;
+                names_ = (NameEntry*)arena_.allocate(
+                  sizeof(NameEntry) * namesSize_);
+                nameCount_ = 0;
+                for (suint i = 0; i < oldSize; i++) {
+                    if (old[i].fingerprint)
+                        addName_(old[i].fingerprint, old[i].name);
+                }
+            }
+
+            const suint mask = namesSize_ - 1;
+            suint i = hashFingerprint(fingerprint, mask);
+            while (names_[i].fingerprint)
+                i = (i + 1) & mask;
+            names_[i].fingerprint = fingerprint;
+            names_[i].name = name;
+            nameCount_++;
+        }
+
+
+
+        /** @return Returns this manager's copy of name, the display name for
+          *fingerprint.
+          */
+        char* internName_(void* fingerprint, const char* name)
+        {
+            char* ret = findName_(fingerprint);
+            if (!ret) {
+                ret = arena_.copyString(name);
+                addName_(fingerprint, ret);
+            }
+            return ret;
+        }
+
+
+
+        /**This function is responsible for compounding recursive TimingInfos 
+          *(detectable via identical fingerprints).  Recursion detection is 
+          *delayed until this step for both speed and reliable stack traces.
+          *
+          *Merges recursive trees.  Used in destructor to compact findings.
+          * @return Returns non-zero if node was a recursive call.  Zero if it
+          *was not.
+          */
+        char cascadeRecursive_(TimingInfo* node)
+        {
+            char removed = 0;
+            TimingInfo* last = 0;
+            TimingInfo* child = node->down;
+            while (child) {
+                TimingInfo* next = child->next;
+                if (cascadeRecursive_(child)) {
+                    removed = 1;
+                    child->next = 0;
+                    if (last) {
+                        last->next = next;
+                    }
+                    else {
+                        //If last is unset, it does NOT mean that node->down
+                        //refers to this child anymore.  That's because when
+                        //during the merge a new profile is added to this 
+                        //node, last would not have been set.
+                        if (node->down == child)
+                            node->down = next;
+                        else {
+                            last = node->down;
+                            while (last->next != child)
+                                last = last->next;
+                            last->next = next;
+                        }
+                    }
+                }
+                else
+                    last = child;
+                child = next;
+            }
+            if (removed)
+                resetChildIndex(arena_, node);
+
+            TimingInfo* parent = node->up;
+            while (parent) {
+                if (parent->fingerprint == node->fingerprint) {
+                    node->result.nestedcalls += node->result.calls;
+                    node->result.calls = 0;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+                    //Already counted in the inclusive time of parent.
+                    node->result.inclusive = 0;
+#endif
+#if PROFILER_LATENCY_HISTOGRAMS
+                    //Recursive calls are not calls of their own.
+                    node->result.histogram = 0;
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+                    //Already counted by parent, too.
+                    for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+                        node->result.counters[i] = 0;
+#endif
+                    mergeWith_(parent, node, 1);
+                    return 1;
+                }
+
+                parent = parent->up;
+            }
+
+            return 0;
+        }
+
+
+
+        /**Writes node and its children to a snapshot, parents first.
+          * @param index Index of the next node written; advanced past node
+          *and its children.
+          */
+        void writeSnapshotGroup_(FILE* f, TimingInfo* node, suint32 parent,
+          suint32& index);
+
+
+        //This ProfilerManager's associated thread.
+        ThreadId myThreadId;
+
+        //The current timing entry
+        TimingInfo* current_;
+
+        //Where current_ is published for the Sampler.  0 for the master.
+        SamplerSlot* slot_;
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        //Innermost live Bomb on this thread.
+        Bomb* bomb_;
+#endif
+
+        //Non-zero unless profiling is off for this thread.
+        char threadEnabled_;
+
+        //Non-zero if this manager belongs to no thread: it gathers a 
+        //snapshot, or holds a finished thread's tree.
+        char detached_;
+
+        //Next finished thread's manager waiting to be merged.
+        ProfilerManager* nextPending_;
+
+        //On the master, finished threads' managers waiting to be merged, and
+        //how many there are.
+        ProfilerManager* pending_;
+        sint pendingCount_;
+
+        //Where this manager's TimingInfos and names are allocated.
+        ProfilerArena arena_;
+
+        //Display names, by fingerprint.  Open addressing; namesSize_ is a
+        //power of two, and the table is at most half full.
+        NameEntry* names_;
+        suint namesSize_;
+        suint nameCount_;
+
+#if PROFILER_EVENT_TRACE
+        //Numeric id of this ProfilerManager's thread.
+        sint threadNumber_;
+#endif
+
+#if PROFILER_HARDWARE_COUNTERS
+        //This thread's counters (see openCounters()); all -1 if it has none.
+        sint counterFds_[PROFILER_NUM_COUNTERS];
+#endif
+
+    public:
+        //Mutex used to lock producing the master ProfilerManager.  Only the
+        //master's is used; it is held while merging into the master and
+        //while writing snapshots.
+        seashell::Mutex masterMutex;
+
+        //The number of running ProfilerManagers.
+        static sint numProfilerManager;
+    
+        //Entry whose children are overhead timers.
+        static TimingInfo* initializationTimings;
+
+        //The overhead timing entry for a profiler's overhead with its own
+        //reported timings
+        static TimingInfo* overheadSelfTimings;
+
+        //Overhead timing entry for a profiler's overhead to its parent.
+        static TimingInfo* overheadContainedTimings;
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        //Ticks that a Bomb measures of itself.
+        static real64 overheadSelfTicks;
+
+        //Ticks that a Bomb adds to its parent beyond what it measures.
+        static real64 overheadContainedTicks;
+
+        //Milliseconds per timing::getTicks() tick.
+        static real64 msPerTick;
+#endif
+    
+        //Is it time when statics are being destroyed?  Do not delete the master
+        //ProfilerManager until this is non-zero.
+        static char staticDestruction;
+    };
+    sint ProfilerManager::numProfilerManager = 0;
+    char ProfilerManager::staticDestruction = 0;
+    TimingInfo* ProfilerManager::initializationTimings = 0;
+    TimingInfo* ProfilerManager::overheadSelfTimings = 0;
+    TimingInfo* ProfilerManager::overheadContainedTimings = 0;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+    real64 ProfilerManager::overheadSelfTicks = 0;
+    real64 ProfilerManager::overheadContainedTicks = 0;
+    real64 ProfilerManager::msPerTick = 0;
+#endif
+    ProfilerManager* master = new ProfilerManager(1);
+    
+    
+    
+    static class ProfilerManagerDestroy {
+    public:
+        ~ProfilerManagerDestroy()
+        {
+            ProfilerManager::staticDestruction = 1;
+            if (ProfilerManager::numProfilerManager == 0) {
+                delete master;
+            }
+        }
+    } staticDestructionInformant;
+
+
+
+    void* getStackFingerprint()
+    {
+        if (!master)
+            return 0;
+        ProfilerManager* pm = getThreadManager();
+        if (!pm) //destructing
+            return 0;
+        return (void*)pm->getCurrent();
+    }
+
+
+
+    void _printStackTraceBackwards(FILE* file, TimingInfo* record)
+    {
+        if (!record)
+            return;
+        _printStackTraceBackwards(file, record->up);
+        if (record->line > 0) {
+            fprintf(file, "%s(%i)\n  %s\n",
+              record->file, record->line, record->function);
+        }
+        else {
+            fprintf(file, "%s\n", topLevelName);
+        }
+    }
+
+
+
+    void printStackTrace(FILE* file, void* fingerprint)
+    {
+        TimingInfo* record = (TimingInfo*)fingerprint;
+        _printStackTraceBackwards(file, record);
+    }
+
+
+
+    class ColumnData
+    {
+    public:
+        /**Prints the name of the column.
+          */
+        virtual void printName(FILE* f) = 0;
+        /**Prints the value of the TimingInfo struct.
+          */
+        virtual void printValue(FILE* f, TimingInfo* t) = 0;
+        /**Returns the char width of this column (not including dividers)
+          */
+        virtual sint getSize() { return 8; }
+    };
+
+
+
+    class a : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|Total ms|   Calls"); }
+        void printValue(FILE* f, TimingInfo* t) 
+        {
+            sint runtime = (sint)t->result.runtime;
+            fprintf(f, "|%8i|%8i", runtime, t->result.calls); 
+        }
+        sint getSize() { return 17; }
+    } ColumnRuntimeAndCalls;
+
+    class c : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|  Nested"); }
+        void printValue(FILE* f, TimingInfo* t) { fprintf(f, "|%8i", t->result.nestedcalls); }
+    } ColumnNested;
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+    class f : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|   Incl ms"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            fprintf(f, "|%10.3f", 
+              (double)t->result.inclusive * ProfilerManager::msPerTick);
+        }
+        sint getSize() { return 10; }
+    } ColumnInclusive;
+
+    class g : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|   Excl ms"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            fprintf(f, "|%10.3f", 
+              (double)t->result.exclusive * ProfilerManager::msPerTick);
+        }
+        sint getSize() { return 10; }
+    } ColumnExclusive;
+#endif
+
+#if MMGR
+    /**Prints a byte count, scaled to fit a 9 character column.
+      */
+    static void printBytes(FILE* f, big_suint bytes)
+    {
+        if (bytes < 1000)
+            fprintf(f, "|%7i b", (suint)bytes);
+        else if ((bytes >> 10) < 1000)
+            fprintf(f, "|%7.3fkb", (double)bytes / 1024.0);
+        else if ((bytes >> 20) < 1000)
+            fprintf(f, "|%7.3fmb", (double)bytes / 1048576.0);
+        else
+            fprintf(f, "|%7.3fgb", (double)bytes / (1048576.0 * 1024.0));
+    }
+
+    class d : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|Allocated"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            printBytes(f, t->result.allocations);
+        }
+        sint getSize() { return 9; }
+    } ColumnAllocations;
+
+    class e : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|    Freed"); }
+        void printValue(FILE* f, TimingInfo* t)
+        { 
+            printBytes(f, t->result.deallocations);
+        }
+        sint getSize() { return 9; }
+    } ColumnFrees;
+
+    class AllocationCountColumn : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|   Allocs"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            fprintf(f, "|%9llu", 
+              (unsigned long long)t->result.allocationCount);
+        }
+        sint getSize() { return 9; }
+    } ColumnAllocationCount;
+
+    class LiveColumn : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|     Live"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            const sint64 live = t->result.liveBytes;
+            printBytes(f, live > 0 ? (big_suint)live : 0);
+        }
+        sint getSize() { return 9; }
+    } ColumnLive;
+
+    class PeakColumn : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|     Peak"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            printBytes(f, (big_suint)t->result.peakBytes);
+        }
+        sint getSize() { return 9; }
+    } ColumnPeak;
+#endif
+
+#if PROFILER_LATENCY_HISTOGRAMS
+    class PercentileColumn : public ColumnData { public:
+        PercentileColumn(const char* title, real64 fraction) 
+          : title_(title), fraction_(fraction) {}
+        void printName(FILE* f) { fprintf(f, "%s", title_); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            if (!t->result.histogram) {
+                fprintf(f, "|         -");
+                return;
+            }
+            fprintf(f, "|%10.3f", getPercentileMs(t, fraction_));
+        }
+        sint getSize() { return 10; }
+
+        /** @return Returns a percentile of t's call durations in ms, less 
+          *the overhead of t's own Bomb.  The overhead of Bombs nested in t
+          *is not known per call, so it is not subtracted.
+          */
+        static real64 getPercentileMs(TimingInfo* t, real64 fraction)
+        {
+            real64 ticks = (real64)getHistogramPercentile(
+              t->result.histogram, fraction);
+            ticks -= ProfilerManager::overheadSelfTicks;
+            if (ticks < 0)
+                ticks = 0;
+            return ticks * ProfilerManager::msPerTick;
+        }
+    private:
+        const char* title_;
+        real64 fraction_;
+    } ColumnP50("|    p50 ms", 0.5), ColumnP90("|    p90 ms", 0.9), 
+      ColumnP99("|    p99 ms", 0.99), ColumnP999("|   p999 ms", 0.999), 
+      ColumnMax("|    Max ms", 1.0);
+#endif
+
+#if PROFILER_HARDWARE_COUNTERS
+    /**Prints a counter, in millions or billions if it is too large.
+      */
+    void printCounterValue(FILE* f, big_suint value)
+    {
+        if (value < 10000000)
+            fprintf(f, "|%8llu", (unsigned long long)value);
+        else if (value < 10000000000ULL)
+            fprintf(f, "|%7.2fM", (double)value / 1000000.0);
+        else
+            fprintf(f, "|%7.2fG", (double)value / 1000000000.0);
+    }
+
+    class CounterColumn : public ColumnData { public:
+        CounterColumn(sint counter) : counter_(counter) {}
+        void printName(FILE* f)
+        {
+            if (counterSet)
+                fprintf(f, "%s", counterSet->titles[counter_]);
+            else
+                fprintf(f, "|Counter%i", counter_);
+        }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            if (counterSet)
+                printCounterValue(f, t->result.counters[counter_]);
+            else
+                fprintf(f, "|       -");
+        }
+    private:
+        sint counter_;
+    } ColumnCounter0(0), ColumnCounter1(1), ColumnCounter2(2), 
+      ColumnCounter3(3);
+
+    class h : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|     IPC"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            //Instructions per cycle; hardware counters only.
+            const big_suint cycles = t->result.counters[0];
+            if (counterSet == &hardwareCounters && cycles > 0) {
+                fprintf(f, "|%8.2f", 
+                  (double)t->result.counters[1] / (double)cycles);
+            }
+            else
+                fprintf(f, "|       -");
+        }
+    } ColumnIpc;
+#endif
+
+#if PROFILER_LOCK_CONTENTION
+    /** @return Returns ticks in ms.  Unlike ProfilerManager::msPerTick, 
+      *available with any timing method.
+      */
+    static real64 lockTicksToMs(big_suint ticks)
+    {
+        static const real64 msPerTick = 1000.0 / timing::getTicksPerSecond();
+        return (real64)ticks * msPerTick;
+    }
+
+    class LockCountColumn : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|   Locks"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            fprintf(f, "|%8llu", (unsigned long long)t->result.locks);
+        }
+    } ColumnLocks;
+
+    class ContendedLockColumn : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|  Waited"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            fprintf(f, "|%8llu", 
+              (unsigned long long)t->result.contendedLocks);
+        }
+    } ColumnContendedLocks;
+
+    class LockWaitColumn : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|   Wait ms"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            fprintf(f, "|%10.3f", lockTicksToMs(t->result.lockWaitTicks));
+        }
+        sint getSize() { return 10; }
+    } ColumnLockWait;
+
+    class LockHoldColumn : public ColumnData { public:
+        void printName(FILE* f) { fprintf(f, "|MaxHold ms"); }
+        void printValue(FILE* f, TimingInfo* t)
+        {
+            fprintf(f, "|%10.3f", 
+              lockTicksToMs(t->result.lockMaxHoldTicks));
+        }
+        sint getSize() { return 10; }
+    } ColumnLockHold;
+#endif
+
+
+
+    static ColumnData* columns[] = { 
+        &ColumnRuntimeAndCalls,
+        &ColumnNested,
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        &ColumnInclusive,
+        &ColumnExclusive,
+#endif
+#if MMGR
+        &ColumnAllocations,
+        &ColumnFrees,
+        &ColumnAllocationCount,
+        &ColumnLive,
+        &ColumnPeak,
+#endif
+#if PROFILER_LATENCY_HISTOGRAMS
+        &ColumnP50,
+        &ColumnP90,
+        &ColumnP99,
+        &ColumnP999,
+        &ColumnMax,
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+        &ColumnCounter0,
+        &ColumnCounter1,
+        &ColumnIpc,
+        &ColumnCounter2,
+        &ColumnCounter3,
+#endif
+#if PROFILER_LOCK_CONTENTION
+        &ColumnLocks,
+        &ColumnContendedLocks,
+        &ColumnLockWait,
+        &ColumnLockHold,
+#endif
+    };
+    static const sint numColumns = sizeof(columns) / sizeof(columns[0]);
+    
+
+
+    void outputProfilerGroup(FILE* f, sint columnStart, sint columnStop, 
+      sint childLevel, TimingInfo* record, const suint maxNameLength)
+    {
+        while (record)
+        {
+            for (sint t = 0; t < childLevel - 1; t++)
+                fprintf(f, "  ");
+            if (record->down) {
+                if (childLevel > 0)
+                    fprintf(f, "+ ");
+            }
+            else if (childLevel > 0) {
+                fprintf(f, "| ");
+            }
+            const char* name = record->name;
+            if (!name)
+                name = topLevelName;
+
+            const sint nameLength = (sint)strlen(name);
+            fwrite(name, 1, nameLength, f);
+
+            sint spaces = maxNameLength - nameLength - childLevel * 2;
+            while (spaces > 1) {
+                if ((spaces & 1) == 0)
+                    fprintf(f, " .");
+                else
+                    fprintf(f, ". ");
+                spaces -= 2;
+            }
+            while (spaces > 0) {
+                fprintf(f, ".");
+                spaces--;
+            }
+
+            for (sint i = columnStart; i < columnStop; i++)
+                columns[i]->printValue(f, record);
+            fprintf(f, "\n");
+
+            outputProfilerGroup(f, columnStart, columnStop, childLevel + 1, record->down, maxNameLength);
+            record = record->next;
+        }
+    }
+
+
+
+    /**Sorts the profiles in order of descending execution time.  Also 
+      *processes record names to crop names that are similar to their 
+      *parents'.
+      * @return Returns the maximum name length.
+      */
+    suint sortTimingsGroup(ProfilerArena& arena, TimingInfo* profile, 
+      suint additionalLength)
+    {
+        //Very poor sorting algorithm.
+        if (!profile)
+            return 0;
+
+        //process the first record in the list outside of the loop.
+        suint ret = sortTimingsGroup(arena, profile->down, 
+          additionalLength + 2);
+
+        //After children have cropped their names, crop ours.
+        cropProfilerName(arena, profile);
+
+        suint returnTemp;
+        if (profile->name)
+            returnTemp = additionalLength + (suint)strlen(profile->name);
+        else
+            returnTemp = additionalLength + (suint)strlen(topLevelName);
+        if (returnTemp > ret)
+            ret = returnTemp;
+
+        TimingInfo* t = profile->next;
+        profile->next = 0;
+        while (t) {
+            big_suint runtime = t->result.runtime;
+            TimingInfo* next = t->next;
+            t->next = 0;
+
+            TimingInfo* last = 0;
+            TimingInfo* temp = profile;
+            while (true) {
+                if (temp->result.runtime <= runtime) {
+                    if (last) {
+                        last->next = t;
+                        t->next = temp;
+                    }
+                    else {
+                        t->up->down = t;
+                        t->next = profile;
+                        profile = t;
+                    }
+                    break;
                 }
-                if (myChild) { //match
-                    mergeWithAndSteal_(myChild, child);
 
-                    if (last) {
-                        last->next = child->next;
-                        child->next = 0;
-                        freeTimingGroup_(child);
-                        child = last->next;
-                        continue;
-                    }
-                    else {
-                        last = child->next;
-                        child->next = 0;
-                        freeTimingGroup_(child);
-                        child = last;
-                        last = 0;
-                        other->down = child;
-                        continue;
-                    }
+                if (!temp->next) {
+                    temp->next = t;
+                    break;
+                }
+                last = temp;
+                temp = temp->next;
+            }
+
+            suint returnTemp = sortTimingsGroup(arena, t->down, 
+              additionalLength + 2);
+            if (returnTemp > ret)
+                ret = returnTemp;
+            //After r's children's names are cropped, crop r's
+            cropProfilerName(arena, t);
+            returnTemp = additionalLength + (suint)strlen(t->name);
+            if (returnTemp > ret)
+                ret = returnTemp;
+
+            t = next;
+        }
+
+        return ret;
+    }
+
+
+
+    void printProfilerResults(TimingInfo* current, ProfilerArena& arena)
+    {
+        eassert(current->up == 0, Exception, "Non-top level print-out requested.");
+        suint maxNameLength = sortTimingsGroup(arena, current, 2);
+
+        const sint spacesLeft = (sint)(maxNameLength - strlen("Function"));
+#ifdef CONSOLE_OUTPUT
+        printf("--------------------\nProfiling results:\n");
+
+        //Output all results upside-down.  Since this is a console
+        //print out, we want the most relevant information at the
+        //bottom.
+        std::vector<sint> columnTraverse;
+        columnTraverse.push_back(0);
+        sint columnStart = 0;
+        while (columnStart < numColumns) {
+            sint columnStop = columnStart + 1;
+            sint columnsForData = 80 - maxNameLength - 1 - columns[columnStart]->getSize();
+            while (columnStop < numColumns && columnsForData > 0) {
+                columnsForData -= columns[columnStop]->getSize() + 1;
+                if (columnsForData < 0)
+                    break;
+                columnStop++;
+            }
+            columnTraverse.push_back(columnStop);
+            columnStart = columnStop;
+        }
+
+        const sint profilerBlocks = (sint)columnTraverse.size();
+        sint columnStop = numColumns;
+        for (sint j = profilerBlocks - 2; j >= 0; j--)
+        {
+            columnStart = columnTraverse[j];
+            for (sint i = 0; i < spacesLeft; i++)
+                printf(" ");
+            printf("%s", "Function");
+            for (sint i = columnStart; i < columnStop; i++)
+                columns[i]->printName(stdout);
+            printf("\n");
+            outputProfilerGroup(stdout, columnStart, columnStop, 0, current, maxNameLength);
+            printf("\n\n");
+            columnStop = columnStart;
+        }
+        printf("--------------------\n");
+#endif
+        FILE* f = fopen(output, "wt");
+        for (sint i = 0; i < spacesLeft; i++)
+            fprintf(f, " ");
+        fprintf(f, "%s", "Function");
+        for (sint i = 0; i < numColumns; i++)
+            columns[i]->printName(f);
+
+        fprintf(f, "\n");
+        outputProfilerGroup(f, 0, numColumns, 0, current, maxNameLength);
+        fclose(f);
+    }
+
+
+
+#if PROFILER_EVENT_TRACE
+    sint writeTrace(const char* file)
+    {
+        //Event names live in the master's arena once their threads exit.
+        if (!master)
+            return 0;
+        FILE* f = fopen(file, "wt");
+        if (!f)
+            return 0;
+
+        const real64 usPerTick = 1000000.0 / timing::getTicksPerSecond();
+        TraceEvent* copy = (TraceEvent*)malloc(
+          sizeof(TraceEvent) * PROFILER_TRACE_EVENTS);
+        char first = 1;
+        fprintf(f, "{\"traceEvents\":[");
+
+        SamplerBlock* block = &samplerSlots;
+        while (block) {
+            for (sint i = 0; i < PROFILER_SAMPLER_BLOCK_SLOTS; i++) {
+                SamplerSlot* slot = &block->slots[i];
+                TraceEvent* events = 
+                  seashell::atomic::loadAcquire(&slot->events);
+                if (!events)
+                    continue;
+
+                //Copy the events, then drop any that the owner may have
+                //overwritten meanwhile.
+                const suint32 end = 
+                  seashell::atomic::loadAcquire(&slot->eventCount);
+                const suint32 available = 
+                  slot->eventsFull ? PROFILER_TRACE_EVENTS : end;
+                for (suint32 j = 0; j < available; j++) {
+                    copy[j] = events[(end - available + j) & 
+                      (PROFILER_TRACE_EVENTS - 1)];
                 }
-                else { //we must add it!
-                    if (last) {
-                        last->next = child->next;
-                        child->next = mine->down;
-                        mine->down = child;
-                        child->up = mine;
-                        child = last->next;
-                        continue;
-                    }
-                    else {
-                        last = child->next;
-                        child->next = mine->down;
-                        mine->down = child;
-                        child->up = mine;
-                        child = last;
-                        last = 0;
-                        other->down = child;
+                seashell::atomic::memoryBarrier();
+                const suint32 now = 
+                  seashell::atomic::loadAcquire(&slot->eventCount);
+                const suint32 written = now - end + 1;
+                const suint32 room = PROFILER_TRACE_EVENTS - available;
+                const suint32 lost = written > room ? written - room : 0;
+
+                for (suint32 j = lost; j < available; j++) {
+                    const TraceEvent& e = copy[j];
+                    if (e.start < traceBaseTicks || e.end < e.start)
                         continue;
+                    fprintf(f, first ? "\n" : ",\n");
+                    first = 0;
+                    fprintf(f, "{\"name\":");
+                    snapshot::printJsonString(f, e.name ? e.name : "");
+                    fprintf(f, ",\"cat\":\"profiler\",\"ph\":\"X\","
+                      "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%lld}",
+                      (e.start - traceBaseTicks) * usPerTick,
+                      (e.end - e.start) * usPerTick, (sint64)e.thread);
+                }
+            }
+            block = seashell::atomic::loadAcquire(&block->next);
+        }
+
+        fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        free(copy);
+        const char success = !ferror(f);
+        return (fclose(f) == 0) && success;
+    }
+#endif
+
+
+
+    /** @return Returns non-zero if node is the entry whose children are
+      *overhead timers (or a snapshot's copy of it).
+      */
+    inline char isInitializationTimings(TimingInfo* node)
+    {
+        TimingInfo* t = ProfilerManager::initializationTimings;
+        return t && node->fingerprint == t->fingerprint;
+    }
+
+
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
+    /**Attributes elapsed time to every thread's current TimingInfo (or, 
+      *with METHOD_SAMPLING_METHOD 2, flags each thread to do so itself).
+      */
+    void sampleSlots(big_suint timeElapsed)
+    {
+        seashell::atomic::add(&samplerPass, 1);
+
+        SamplerBlock* block = &samplerSlots;
+        while (block) {
+            for (sint i = 0; i < PROFILER_SAMPLER_BLOCK_SLOTS; i++) {
+                SamplerSlot* slot = &block->slots[i];
+#if METHOD_SAMPLING_METHOD == 1
+                //Grab the currently valid tag and update that (Note that
+                //without the temporary, += reads the slot twice and can
+                //update a TimingInfo that has since been retired).
+                TimingInfo* current = 
+                  seashell::atomic::loadAcquire(&slot->current);
+                if (current && seashell::atomic::loadAcquire(&slot->enabled))
+                    current->result.runtime += timeElapsed;
+#else
+                if (seashell::atomic::loadAcquire(&slot->inUse) &&
+                  seashell::atomic::loadAcquire(&slot->enabled))
+                    slot->sampleDue = 1;
+#endif
+            }
+            block = seashell::atomic::loadAcquire(&block->next);
+        }
+
+        seashell::atomic::add(&samplerPass, 1);
+    }
+
+
+
+    //Thread for samples.  Sleeps on a semaphore while profiling is off for
+    //the process, rather than waking to sample nothing.
+    class Sampler : public seashell::Thread
+    {
+    public:
+        Sampler()
+        {
+            stopping_ = 0;
+#ifdef _WINDOWS
+            wakeup_ = CreateSemaphore(0, 0, 0x7fffffff, 0);
+#elif defined(_LINUX)
+            sem_init(&wakeup_, 0, 0);
+#endif
+            startThread();
+        }
+
+        ~Sampler()
+        {
+            seashell::atomic::storeRelease(&stopping_, (sint32)1);
+            wake();
+            stopThread();
+#ifdef _WINDOWS
+            CloseHandle(wakeup_);
+#elif defined(_LINUX)
+            sem_destroy(&wakeup_);
+#endif
+        }
+
+        /**Wakes the thread if it is parked (or makes its next park return
+          *at once).
+          */
+        void wake()
+        {
+#ifdef _WINDOWS
+            ReleaseSemaphore(wakeup_, 1, 0);
+#elif defined(_LINUX)
+            sem_post(&wakeup_);
+#endif
+        }
+
+        void run()
+        {
+#if METHOD_SAMPLING_METHOD == 1 //perceived run time
+            const big_suint interval = 1;
+#else                           //processor run time
+            const big_suint interval = 10;
+#endif
+            big_suint last = timing::getSystemMs();
+            while (1) {
+                queryExit();
+
+                if (!seashell::atomic::loadAcquire(&processEnabled) &&
+                  !seashell::atomic::loadAcquire(&stopping_)) {
+                    //setEnabled(1) wakes us.  Time spent disabled is not
+                    //charged to anything.
+#ifdef _WINDOWS
+                    WaitForSingleObject(wakeup_, INFINITE);
+#elif defined(_LINUX)
+                    while (sem_wait(&wakeup_) != 0 && errno == EINTR);
+#endif
+                    last = timing::getSystemMs();
+                    continue;
+                }
+
+                timing::sleepThread(interval);
+                big_suint time = timing::getSystemMs();
+                if (time - last >= interval && 
+                  seashell::atomic::loadAcquire(&processEnabled)) {
+                    big_suint timeElapsed = time - last;
+                    last = time;
+                    sampleSlots(timeElapsed);
+                }
+            }
+        }
+
+    private:
+        //Non-zero once the destructor has been called.
+        volatile sint32 stopping_;
+
+#ifdef _WINDOWS
+        HANDLE wakeup_;
+#elif defined(_LINUX)
+        sem_t wakeup_;
+#endif
+    };
+    Sampler* volatile sampleThread = 0;
+
+
+
+    /**Sums timings from all children, if necessary.
+      * @return Returns the runtime of the queried node.
+      */
+    big_suint cascadeTimings(TimingInfo* node)
+    {
+        if (isInitializationTimings(node))
+            return node->result.runtime;
+        big_suint childSum = 0;
+
+        TimingInfo* child = node->down;
+        while (child) {
+            childSum += cascadeTimings(child);
+
+#if MMGR
+            node->result.allocations += child->result.allocations;
+            node->result.deallocations += child->result.deallocations;
+#endif
+            child = child->next;
+        }
+        node->result.runtime += childSum;
+
+        if (PROFILER_PROCESS_OVERHEAD) {
+            if (ProfilerManager::initializationTimings) {
+                TimingInfo* t = ProfilerManager::overheadSelfTimings;
+                big_suint tempRuntime = node->result.runtime;
+                //Take off overhead caused by merely starting the profiler
+                node->result.runtime -= 
+                  (node->result.calls + node->result.nestedcalls) *
+                  t->result.runtime / (t->result.calls + 
+                  t->result.nestedcalls);
+
+                //Since returns are processed by our parents, the return value
+                //should represent contained overhead
+                t = ProfilerManager::overheadContainedTimings;
+                return tempRuntime - 
+                  ((node->result.calls + node->result.nestedcalls) *
+                  t->result.runtime / (t->result.calls + 
+                  t->result.nestedcalls));
+            }
+        }
+        return node->result.runtime;
+    }
+#elif PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+    /**Takes the measured profiler overhead off of a node's times, sets its 
+      *reported runtime, and sums allocations from children.
+      * @return Returns the number of Bombs nested (at any depth) in the 
+      *queried node.
+      */
+    big_suint cascadeTimings(TimingInfo* node)
+    {
+        if (isInitializationTimings(node)) {
+            //Its children were cascaded during initialization, but its own
+            //time was still running then.
+            node->result.runtime = (big_suint)(node->result.inclusive * 
+              ProfilerManager::msPerTick + 0.5);
+            return 0;
+        }
+
+        big_suint childBombs = 0;
+        big_suint nestedBombs = 0;
+        big_suint childInclusive = 0;
+        TimingInfo* child = node->down;
+        while (child) {
+            nestedBombs += cascadeTimings(child);
+            childBombs += child->result.calls + child->result.nestedcalls;
+            childInclusive += child->result.inclusive;
+
+#if MMGR
+            node->result.allocations += child->result.allocations;
+            node->result.deallocations += child->result.deallocations;
+#endif
+            child = child->next;
+        }
+        nestedBombs += childBombs;
+
+        const real64 self = ProfilerManager::overheadSelfTicks;
+        const real64 contained = ProfilerManager::overheadContainedTicks;
+        const big_suint bombs = node->result.calls + node->result.nestedcalls;
+        if (bombs == 0) {
+            //No Bomb times this node (the top level); it is its children.
+            node->result.inclusive = childInclusive;
+        }
+        else {
+            big_suint overhead = (big_suint)(bombs * self + 
+              childBombs * contained);
+            if (node->result.exclusive > overhead)
+                node->result.exclusive -= overhead;
+            else
+                node->result.exclusive = 0;
+
+            overhead = (big_suint)(bombs * self + 
+              nestedBombs * (self + contained));
+            if (node->result.inclusive > overhead)
+                node->result.inclusive -= overhead;
+            else
+                node->result.inclusive = 0;
+        }
+
+        node->result.runtime = (big_suint)(node->result.inclusive * 
+          ProfilerManager::msPerTick + 0.5);
+        return nestedBombs;
+    }
+#endif //PROFILER_TIMING_METHOD
+
+
+
+    //Static copies of the calibration TimingInfos (see keepTimings()).
+    static TimingInfo calibrationTimings[3];
+
+    /** @return Returns a copy in static storage of node's fingerprint and
+      *results.  Calibration nodes live in the arena of the thread that 
+      *initialized the profiler, which is released when that thread's 
+      *tree is merged, but are read by every later cascadeTimings().
+      */
+    TimingInfo* keepTimings(TimingInfo* node, sint index)
+    {
+        TimingInfo* copy = &calibrationTimings[index];
+        copy->fingerprint = node->fingerprint;
+        copy->result = node->result;
+#if PROFILER_LATENCY_HISTOGRAMS
+        copy->result.histogram = 0;
+#endif
+        return copy;
+    }
+
+
+
+    void ProfilerManager::initialize()
+    {PROFILER(0);
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
+        seashell::atomic::storeRelease(&sampleThread, new Sampler());
+        //Pairs with setEnabled(); if it ran before sampleThread was set, 
+        //the sampler may have parked without being woken.
+        seashell::atomic::memoryBarrier();
+        if (seashell::atomic::loadAcquire(&processEnabled))
+            sampleThread->wake();
+#elif PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        msPerTick = 1000.0 / timing::getTicksPerSecond();
+#endif
+        TimingInfo* selfTimings = 0;
+        TimingInfo* containedTimings = 0;
+
+        {//Initialize a profiler for the overhead of this mechanism.
+            TimingInfo* temp = 0;
+            const sint profilerLoops = PROFILER_OVERHEAD_LOOPS;
+            for (sint i = 0; i < profilerLoops; i++)
+            {PROFILER("Profiler Self-Overhead");
+            }
+            temp = getThreadManager()->getCurrent()->down;
+            temp->result.calls = profilerLoops;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            overheadSelfTicks = (real64)temp->result.inclusive / profilerLoops;
+#endif
+
+            selfTimings = temp;
+        }
+
+        {//Another overhead mechanism; this one is the overhead for a parent
+            TimingInfo* temp = 0;
+            const sint profilerLoops = PROFILER_OVERHEAD_LOOPS;
+            {PROFILER("Profiler Contained-Overhead");
+                for (sint i = 0; i < profilerLoops; i++) {
+                    PROFILER("temp");
+                }
+                temp = PROFBOMB192525.timingInfo_;
+            }
+            temp->result.calls = profilerLoops;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            //Everything the parent measured of itself is loop and child Bomb
+            //overhead.
+            overheadContainedTicks = (real64)temp->result.exclusive / 
+              profilerLoops;
+#endif
+            cascadeTimings(temp);
+            //The children are left in the thread's arena.
+            temp->down = 0;
+            resetChildIndex(arena_, temp);
+
+            containedTimings = temp;
+        }
+
+        {//Time a X ms segment to count ticks
+            TimingInfo* temp = 0;
+#if PROFILER_HARDWARE_COUNTERS
+            //Counter reads spend their time in the kernel, which 
+            //getThreadExecutionMs() does not count; time the segment by the
+            //wall clock, or it runs for seconds.
+            big_suint (*getMs)() = timing::getSystemMs;
+#else
+            big_suint (*getMs)() = timing::getThreadExecutionMs;
+#endif
+            {PROFILER("123 ms");
+                big_suint start = getMs();
+                while (getMs() - start < 123) {
+                    PROFILER("temp");
+                    {
+                        {PROFILER("temp");}
+                        PROFILER("temp");
                     }
                 }
 
-                last = child;
-                child = child->next;
+                temp = PROFBOMB192525.timingInfo_;
             }
+            cascadeTimings(temp);
+            //The children are left in the thread's arena.
+            temp->down = 0;
+            resetChildIndex(arena_, temp);
         }
 
+        //cascade the timings here; it won't happen later because we don't
+        //want these time info's measurements altered.
+        cascadeTimings(PROFBOMB192525.timingInfo_);
 
+        overheadSelfTimings = keepTimings(selfTimings, 0);
+        overheadContainedTimings = keepTimings(containedTimings, 1);
+        initializationTimings = keepTimings(PROFBOMB192525.timingInfo_, 2);
+    }
 
-        /**This function is responsible for compounding recursive TimingInfos 
-          *(detectable via identical fingerprints).  Recursion detection is 
-          *delayed until this step for both speed and reliable stack traces.
-          *
-          *Merges recursive trees.  Used in destructor to compact findings.
-          * @return Returns non-zero if node was a recursive call.  Zero if it
-          *was not.
-          */
-        char cascadeRecursive_(TimingInfo* node)
-        {
-            TimingInfo* last = 0;
-            TimingInfo* child = node->down;
-            while (child) {
-                TimingInfo* next = child->next;
-                if (cascadeRecursive_(child)) {
-                    child->next = 0;
-                    freeTimingGroup_(child);
-                    if (last) {
-                        last->next = next;
-                    }
-                    else {
-                        //If last is unset, it does NOT mean that node->down
-                        //refers to this child anymore.  That's because when
-                        //during the merge a new profile is added to this 
-                        //node, last would not have been set.
-                        if (node->down == child)
-                            node->down = next;
-                        else {
-                            last = node->down;
-                            while (last->next != child)
-                                last = last->next;
-                            last->next = next;
-                        }
-                    }
-                }
-                else
-                    last = child;
-                child = next;
-            }
 
-            TimingInfo* parent = node->up;
-            while (parent) {
-                if (parent->fingerprint == node->fingerprint) {
-                    node->result.nestedcalls += node->result.calls;
-                    node->result.calls = 0;
-                    mergeWithAndSteal_(parent, node);
-                    return 1;
-                }
 
-                parent = parent->up;
-            }
+    /** @return Returns the number of TimingInfos in node and its children.
+      */
+    suint32 countTimingTree(TimingInfo* node)
+    {
+        suint32 count = 1;
+        for (TimingInfo* t = node->down; t; t = t->next)
+            count += countTimingTree(t);
+        return count;
+    }
 
-            return 0;
+
+
+    //Values written for each TimingInfo in a snapshot.  Must match the
+    //order of values in ProfilerManager::writeSnapshotGroup_().
+    static const suint32 snapshotFields[] = {
+        snapshot::FIELD_CALLS,
+        snapshot::FIELD_NESTED_CALLS,
+        snapshot::FIELD_RUNTIME_MS,
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        snapshot::FIELD_INCLUSIVE_NS,
+        snapshot::FIELD_EXCLUSIVE_NS,
+#endif
+#if MMGR
+        snapshot::FIELD_ALLOCATED,
+        snapshot::FIELD_FREED,
+        snapshot::FIELD_ALLOCATION_COUNT,
+        snapshot::FIELD_LIVE_BYTES,
+        snapshot::FIELD_PEAK_BYTES,
+#endif
+#if PROFILER_LATENCY_HISTOGRAMS
+        snapshot::FIELD_P50_NS,
+        snapshot::FIELD_P90_NS,
+        snapshot::FIELD_P99_NS,
+        snapshot::FIELD_P999_NS,
+        snapshot::FIELD_MAX_NS,
+#endif
+#if PROFILER_LOCK_CONTENTION
+        snapshot::FIELD_LOCKS,
+        snapshot::FIELD_CONTENDED_LOCKS,
+        snapshot::FIELD_LOCK_WAIT_NS,
+        snapshot::FIELD_LOCK_MAX_HOLD_NS,
+#endif
+    };
+    static const suint32 numSnapshotFields = 
+      sizeof(snapshotFields) / sizeof(snapshotFields[0]);
+
+#if MMGR
+    //One snapshot field per size class, from FIELD_SIZE_CLASSES on.
+    typedef char SizeClassesMatch[snapshot::SNAPSHOT_SIZE_CLASSES ==
+      ALLOCATION_SIZE_CLASSES ? 1 : -1];
+#endif
+
+    //Most values written for a TimingInfo, size classes and counters 
+    //included.
+    static const suint32 maxSnapshotFields = 
+      numSnapshotFields + snapshot::SNAPSHOT_SIZE_CLASSES + 
+      PROFILER_NUM_COUNTERS;
+
+
+
+    /**Fills fields with the ids of the values written for each TimingInfo.
+      * @return Returns the number of fields.
+      */
+    suint32 getSnapshotFields(suint32* fields)
+    {
+        suint32 count = 0;
+        for (suint32 i = 0; i < numSnapshotFields; i++)
+            fields[count++] = snapshotFields[i];
+#if MMGR
+        for (sint i = 0; i < ALLOCATION_SIZE_CLASSES; i++)
+            fields[count++] = snapshot::FIELD_SIZE_CLASSES + i;
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+        if (counterSet) {
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++)
+                fields[count++] = counterSet->fields[i];
         }
+#endif
+        return count;
+    }
 
 
 
-        /**Frees the timing group specified by current_.  This function, 
-          *unfortunately, should never be called if the memory manager is 
-          *running because it hooks into these
-          */
-        void freeTimingGroup_(TimingInfo* node)
-        {
-#if !MMGR
-            while (node) {
-                freeTimingGroup_(node->down);
-                TimingInfo* remove = node;
-                node = node->next;
-                free(remove);
-            }
-#endif//!MMGR
+    /**Fills values with node's values of the fields from 
+      *getSnapshotFields(), in the same order.
+      * @return Returns the number of values.
+      */
+    suint32 getSnapshotValues(TimingInfo* node, suint64* values)
+    {
+        suint32 i = 0;
+        values[i++] = node->result.calls;
+        values[i++] = node->result.nestedcalls;
+        values[i++] = node->result.runtime;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        values[i++] = (suint64)(node->result.inclusive * 
+          ProfilerManager::msPerTick * 1000000.0);
+        values[i++] = (suint64)(node->result.exclusive * 
+          ProfilerManager::msPerTick * 1000000.0);
+#endif
+#if MMGR
+        values[i++] = node->result.allocations;
+        values[i++] = node->result.deallocations;
+        values[i++] = node->result.allocationCount;
+        values[i++] = node->result.liveBytes > 0 ? 
+          (suint64)node->result.liveBytes : 0;
+        values[i++] = (suint64)node->result.peakBytes;
+#endif
+#if PROFILER_LATENCY_HISTOGRAMS
+        static const real64 fractions[] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+        for (sint k = 0; k < (sint)(sizeof(fractions) / sizeof(fractions[0]));
+          k++) {
+            values[i++] = node->result.histogram ? 
+              (suint64)(PercentileColumn::getPercentileMs(node, 
+              fractions[k]) * 1000000.0) : 0;
+        }
+#endif
+#if PROFILER_LOCK_CONTENTION
+        values[i++] = node->result.locks;
+        values[i++] = node->result.contendedLocks;
+        values[i++] = (suint64)(lockTicksToMs(node->result.lockWaitTicks) *
+          1000000.0);
+        values[i++] = (suint64)(lockTicksToMs(
+          node->result.lockMaxHoldTicks) * 1000000.0);
+#endif
+#if MMGR
+        for (sint k = 0; k < ALLOCATION_SIZE_CLASSES; k++)
+            values[i++] = node->result.sizeClasses[k];
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+        if (counterSet) {
+            for (sint k = 0; k < PROFILER_NUM_COUNTERS; k++)
+                values[i++] = node->result.counters[k];
         }
+#endif
+        return i;
+    }
 
 
-        //This ProfilerManager's associated thread.
-        ThreadId myThreadId;
 
-        //The current timing entry
-        TimingInfo* current_;
+    void ProfilerManager::writeSnapshotGroup_(FILE* f, TimingInfo* node,
+      suint32 parent, suint32& index)
+    {
+        suint64 values[maxSnapshotFields];
+        const suint32 i = getSnapshotValues(node, values);
+
+        const suint32 me = index++;
+        snapshot::writeNode(f, parent, (suint64)(voidptr)node->fingerprint,
+          node->name ? node->name : topLevelName, node->file, 
+          (suint32)node->line, node->function, values, i);
+        for (TimingInfo* t = node->down; t; t = t->next)
+            writeSnapshotGroup_(f, t, me, index);
+    }
 
-        //Mutex used to lock producing the master ProfilerManager
-        seashell::Mutex masterMutex;
-        
-#if METHOD_SAMPLING_METHOD == 2
-        //Flag; if 1, add execution time to active profile.
-        char time;
-#endif
 
-    public:
-        //The number of running ProfilerManagers.
-        static sint numProfilerManager;
-    
-        //Entry whose children are overhead timers.
-        static TimingInfo* initializationTimings;
 
-        //The overhead timing entry for a profiler's overhead with its own
-        //reported timings
-        static TimingInfo* overheadSelfTimings;
+    /** @return Returns a malloc'd copy of s, or of "" if s is 0.
+      */
+    char* copySnapshotString(const char* s)
+    {
+        if (!s)
+            s = "";
+        const size_t length = strlen(s) + 1;
+        char* copy = (char*)malloc(length);
+        memcpy(copy, s, length);
+        return copy;
+    }
 
-        //Overhead timing entry for a profiler's overhead to its parent.
-        static TimingInfo* overheadContainedTimings;
-    
-        //Is it time when statics are being destroyed?  Do not delete the master
-        //ProfilerManager until this is non-zero.
-        static char staticDestruction;
-    };
-    sint ProfilerManager::numProfilerManager = 0;
-    char ProfilerManager::staticDestruction = 0;
-    TimingInfo* ProfilerManager::initializationTimings = 0;
-    TimingInfo* ProfilerManager::overheadSelfTimings = 0;
-    TimingInfo* ProfilerManager::overheadContainedTimings = 0;
-    ProfilerManager* master = new ProfilerManager(1);
-    
-    
-    
-    static class ProfilerManagerDestroy {
-    public:
-        ~ProfilerManagerDestroy()
-        {
-            ProfilerManager::staticDestruction = 1;
-            if (ProfilerManager::numProfilerManager == 0) {
-                delete master;
-            }
+
+
+    /**Copies node and its children into s, as if they had been written to
+      *a snapshot and read back.
+      * @param fields Fields of the values from getSnapshotValues().
+      * @param index Index in s->nodes of node; advanced past node and its
+      *children.
+      */
+    void copyToSnapshot(snapshot::Snapshot* s, TimingInfo* node, 
+      snapshot::Node* up, const suint32* fields, suint32& index)
+    {
+        snapshot::Node* copy = &s->nodes[index++];
+        s->nodeCount = index;
+        copy->up = up;
+        copy->fingerprint = (suint64)(voidptr)node->fingerprint;
+        copy->name = copySnapshotString(node->name ? node->name : 
+          topLevelName);
+        copy->file = copySnapshotString(node->file);
+        copy->line = (suint32)node->line;
+        copy->function = copySnapshotString(node->function);
+
+        suint64 values[maxSnapshotFields];
+        const suint32 count = getSnapshotValues(node, values);
+        for (suint32 i = 0; i < count; i++)
+            copy->values[fields[i]] = values[i];
+
+        snapshot::Node* last = 0;
+        for (TimingInfo* t = node->down; t; t = t->next) {
+            snapshot::Node* child = &s->nodes[index];
+            copyToSnapshot(s, t, copy, fields, index);
+            if (last)
+                last->next = child;
+            else
+                copy->down = child;
+            last = child;
         }
-    } staticDestructionInformant;
+    }
 
 
 
-    void* getStackFingerprint()
+    /** @return Returns a copy of a cascaded tree, as if it had been written
+      *to a snapshot and read back, so that it may be printed the same way
+      *that profreport prints snapshots.  Free with 
+      *snapshot::freeSnapshot().
+      */
+    snapshot::Snapshot* copyTreeToSnapshot(TimingInfo* current)
     {
-        if (!master)
-            return 0;
-        ProfilerManager* pm = profileManagers().get();
-        if (!pm) //destructing
+        snapshot::Snapshot* s = 
+          (snapshot::Snapshot*)calloc(1, sizeof(snapshot::Snapshot));
+        s->time = (suint64)time(0);
+        suint32 fields[maxSnapshotFields];
+        const suint32 fieldCount = getSnapshotFields(fields);
+        for (suint32 i = 0; i < fieldCount; i++)
+            s->hasField[fields[i]] = 1;
+        s->nodes = (snapshot::Node*)calloc(countTimingTree(current), 
+          sizeof(snapshot::Node));
+        suint32 index = 0;
+        copyToSnapshot(s, current, 0, fields, index);
+        return s;
+    }
+
+
+
+    /**Writes a cascaded tree in collapsed stack format, for flamegraph.pl
+      *and speedscope.  Must be called before names are cropped.
+      * @return Returns non-zero on success.
+      */
+    sint printCollapsedStacks(const char* file, TimingInfo* current)
+    {
+        FILE* f = fopen(file, "wt");
+        if (!f)
             return 0;
-        return (void*)pm->getCurrent();
+        snapshot::Snapshot* s = copyTreeToSnapshot(current);
+        snapshot::printCollapsed(f, s);
+        snapshot::freeSnapshot(s);
+        const char success = !ferror(f);
+        return (fclose(f) == 0) && success;
     }
 
 
 
-    void _printStackTraceBackwards(FILE* file, TimingInfo* record)
+#if MMGR
+    /**Writes the scopes of a cascaded tree that allocate the most, by each
+      *allocation statistic.  Must be called before names are cropped.
+      */
+    void printTopAllocators(TimingInfo* current)
     {
-        if (!record)
+        FILE* f = fopen(allocatorsOutput, "wt");
+        if (!f)
             return;
-        _printStackTraceBackwards(file, record->up);
-        if (record->line > 0) {
-            fprintf(file, "%s(%i)\n  %s\n",
-              record->file, record->line, record->function);
+
+        snapshot::Snapshot* s = copyTreeToSnapshot(current);
+
+        static const suint32 sortBy[] = {
+            snapshot::FIELD_ALLOCATED,
+            snapshot::FIELD_ALLOCATION_COUNT,
+            snapshot::FIELD_LIVE_BYTES,
+            snapshot::FIELD_PEAK_BYTES,
+        };
+        for (sint i = 0; i < (sint)(sizeof(sortBy) / sizeof(sortBy[0])); 
+          i++) {
+            if (i)
+                fprintf(f, "\n");
+            snapshot::printTopAllocators(f, s, sortBy[i], 
+              PROFILER_TOP_ALLOCATORS);
         }
-        else {
-            fprintf(file, "%s\n", topLevelName);
+        snapshot::freeSnapshot(s);
+        fclose(f);
+    }
+#endif
+
+
+
+#if PROFILER_LOCK_CONTENTION
+    struct LockSite
+    {
+        //Next site in the same lockSites bucket.
+        LockSite* next;
+
+        //Scope that the Mutexes were constructed in, its path of names, and
+        //its source.  All 0 outside of any scope.
+        void* fingerprint;
+        char* scope;
+        const char* file;
+        suint line;
+
+        //Code that constructed the Mutexes.
+        void* caller;
+
+        //Number of Mutexes constructed here.
+        volatile sint32 mutexes;
+
+        //Totals over all of the Mutexes, changed atomically.
+        volatile sint64 locks;
+        volatile sint64 contendedLocks;
+        volatile sint64 waitTicks;
+
+        //Longest that one of the Mutexes was hard locked, in ticks.
+        big_suint maxHoldTicks;
+        seashell::SpinMutex maxHoldLock;
+    };
+
+    //All sites, hashed by fingerprint and caller.  Sites are never freed.
+    static LockSite* lockSites[PROFILER_LOCK_SITE_BUCKETS];
+    //Zero initialized, and so usable before static constructors run.
+    static seashell::SpinMutex lockSitesLock;
+
+
+
+    /** @return Returns a malloc'd path of names from the top level scope 
+      *down to t, such as "main > load 'textures'".
+      */
+    static char* getScopePath(TimingInfo* t)
+    {
+        suint length = (suint)strlen(topLevelName) + 1;
+        for (TimingInfo* up = t; up && up->up; up = up->up)
+            length += (suint)strlen(up->name ? up->name : "") + 3;
+        char* path = (char*)malloc(length);
+        if (!path)
+            return 0;
+
+        //Written from the end, since the walk goes up.
+        char* start = path + length - 1;
+        *start = 0;
+        for (TimingInfo* up = t; up && up->up; up = up->up) {
+            const char* name = up->name ? up->name : "";
+            const suint nameLength = (suint)strlen(name);
+            start -= nameLength;
+            memcpy(start, name, nameLength);
+            start -= 3;
+            memcpy(start, " > ", 3);
         }
+        start -= strlen(topLevelName);
+        memcpy(start, topLevelName, strlen(topLevelName));
+        return path;
     }
 
 
 
-    void printStackTrace(FILE* file, void* fingerprint)
+    LockSite* getLockSite(void* caller)
     {
-        TimingInfo* record = (TimingInfo*)fingerprint;
-        _printStackTraceBackwards(file, record);
+        //Only the thread's own manager, not getThreadManager(), since 
+        //making one locks Mutexes.
+        ProfilerManager* pm = ManagerCapsule::alive ? threadManager : 0;
+        TimingInfo* t = pm ? pm->getCurrent() : 0;
+        void* fingerprint = t ? t->fingerprint : 0;
+        const suint32 bucket = (suint32)(((voidptr)fingerprint >> 4) ^ 
+          ((voidptr)caller >> 2) * 31) & (PROFILER_LOCK_SITE_BUCKETS - 1);
+
+        LockMutex(lockSitesLock);
+        for (LockSite* site = lockSites[bucket]; site; site = site->next) {
+            if (site->fingerprint == fingerprint && site->caller == caller) {
+                site->mutexes++;
+                return site;
+            }
+        }
+
+        LockSite* site = (LockSite*)calloc(1, sizeof(LockSite));
+        if (!site)
+            return 0;
+        site->fingerprint = fingerprint;
+        if (t && t->up) {
+            site->scope = getScopePath(t);
+            site->file = t->file;
+            site->line = t->line;
+        }
+        site->caller = caller;
+        site->mutexes = 1;
+        site->next = lockSites[bucket];
+        lockSites[bucket] = site;
+        return site;
     }
 
 
 
-    class ColumnData
+    void recordLock(LockSite* site, char contended, big_suint waitTicks)
     {
-    public:
-        /**Prints the name of the column.
-          */
-        virtual void printName(FILE* f) = 0;
-        /**Prints the value of the TimingInfo struct.
-          */
-        virtual void printValue(FILE* f, TimingInfo* t) = 0;
-        /**Returns the char width of this column (not including dividers)
-          */
-        virtual sint getSize() { return 8; }
-    };
+        if (!processEnabled)
+            return;
+        if (site) {
+            seashell::atomic::add64(&site->locks, 1);
+            if (contended) {
+                seashell::atomic::add64(&site->contendedLocks, 1);
+                seashell::atomic::add64(&site->waitTicks, (sint64)waitTicks);
+            }
+        }
 
+        //Scopes are only changed by their own thread, like Bombs do.
+        ProfilerManager* pm = ManagerCapsule::alive ? threadManager : 0;
+        if (pm && pm->isThreadEnabled()) {
+            TimingInfo* t = pm->getCurrent();
+            t->result.locks++;
+            if (contended) {
+                t->result.contendedLocks++;
+                t->result.lockWaitTicks += waitTicks;
+            }
+        }
+    }
 
 
-    class a : public ColumnData { public:
-        void printName(FILE* f) { fprintf(f, "|Total ms|   Calls"); }
-        void printValue(FILE* f, TimingInfo* t) 
-        {
-            sint runtime = (sint)t->result.runtime;
-            fprintf(f, "|%8i|%8i", runtime, t->result.calls); 
+
+    void recordLockHold(LockSite* site, big_suint holdTicks)
+    {
+        if (!processEnabled)
+            return;
+        if (site && holdTicks > site->maxHoldTicks) {
+            LockMutex(site->maxHoldLock);
+            if (holdTicks > site->maxHoldTicks)
+                site->maxHoldTicks = holdTicks;
         }
-        sint getSize() { return 17; }
-    } ColumnRuntimeAndCalls;
 
-    class c : public ColumnData { public:
-        void printName(FILE* f) { fprintf(f, "|  Nested"); }
-        void printValue(FILE* f, TimingInfo* t) { fprintf(f, "|%8i", t->result.nestedcalls); }
-    } ColumnNested;
+        ProfilerManager* pm = ManagerCapsule::alive ? threadManager : 0;
+        if (pm && pm->isThreadEnabled()) {
+            TimingInfo* t = pm->getCurrent();
+            if (holdTicks > t->result.lockMaxHoldTicks)
+                t->result.lockMaxHoldTicks = holdTicks;
+        }
+    }
 
-#if MMGR
-    class d : public ColumnData { public:
-        void printName(FILE* f) { fprintf(f, "|Allocated"); }
-        void printValue(FILE* f, TimingInfo* t)
+
+
+    /**Orders sites by time spent waiting on them, longest first.
+      */
+    static int compareLockSites(const void* a, const void* b)
+    {
+        const sint64 waitA = (*(LockSite* const*)a)->waitTicks;
+        const sint64 waitB = (*(LockSite* const*)b)->waitTicks;
+        if (waitA != waitB)
+            return waitA > waitB ? -1 : 1;
+        const sint64 locksA = (*(LockSite* const*)a)->locks;
+        const sint64 locksB = (*(LockSite* const*)b)->locks;
+        return locksA > locksB ? -1 : (locksA < locksB ? 1 : 0);
+    }
+
+
+
+    sint writeLockReport(const char* file)
+    {
+        FILE* f = fopen(file, "wt");
+        if (!f)
+            return 0;
+
+        //Sites are only ever added, so they may be read once gathered.
+        LockSite** sites = 0;
+        suint32 count = 0;
         {
-            big_suint allocations = t->result.allocations;
-            if (allocations < 1000)
-                fprintf(f, "|%7i b", (suint)allocations);
-            else if ((allocations >> 10) < 1000)
-                fprintf(f, "|%7.3fkb", (double)allocations / 1024.0);
-            else if ((allocations >> 20) < 1000)
-                fprintf(f, "|%7.3fmb", (double)allocations / 1048576.0);
-            else
-                fprintf(f, "|%7.3fgb", (double)allocations / (1048576.0 * 1024.0));
+            LockMutex(lockSitesLock);
+            for (suint32 i = 0; i < PROFILER_LOCK_SITE_BUCKETS; i++) {
+                for (LockSite* site = lockSites[i]; site; site = site->next)
+                    count++;
+            }
+            sites = (LockSite**)malloc((count + 1) * sizeof(LockSite*));
+            count = 0;
+            for (suint32 i = 0; sites && i < PROFILER_LOCK_SITE_BUCKETS; 
+              i++) {
+                for (LockSite* site = lockSites[i]; site; site = site->next) {
+                    if (site->locks)
+                        sites[count++] = site;
+                }
+            }
+        }
+        if (!sites) {
+            fclose(f);
+            return 0;
         }
-        sint getSize() { return 9; }
-    } ColumnAllocations;
-
-    class e : public ColumnData { public:
-        void printName(FILE* f) { fprintf(f, "|    Freed"); }
-        void printValue(FILE* f, TimingInfo* t)
-        { 
-            big_suint deallocations = t->result.deallocations;
-            if (deallocations < 1000)
-                fprintf(f, "|%7i b", (suint)deallocations);
-            else if ((deallocations >> 10) < 1000)
-                fprintf(f, "|%7.3fkb", (double)deallocations / 1024.0);
-            else if ((deallocations >> 20) < 1000)
-                fprintf(f, "|%7.3fmb", (double)deallocations / 1048576.0);
+        qsort(sites, count, sizeof(LockSite*), compareLockSites);
+        if (count > PROFILER_TOP_LOCK_SITES)
+            count = PROFILER_TOP_LOCK_SITES;
+
+        fprintf(f, "Top %u Mutex creation sites by time spent waiting\n", 
+          count);
+        fprintf(f, "|   Wait ms|   Locks|  Waited|MaxHold ms|Mutexes| "
+          "Created in\n");
+        for (suint32 i = 0; i < count; i++) {
+            LockSite* site = sites[i];
+            fprintf(f, "|%10.3f|%8llu|%8llu|%10.3f|%7i| ", 
+              lockTicksToMs((big_suint)site->waitTicks),
+              (unsigned long long)site->locks, 
+              (unsigned long long)site->contendedLocks,
+              lockTicksToMs(site->maxHoldTicks), (sint)site->mutexes);
+            if (site->scope) {
+                fprintf(f, "%s (%s:%u), from %p\n", site->scope, site->file,
+                  (suint32)site->line, site->caller);
+            }
             else
-                fprintf(f, "|%7.3fgb", (double)deallocations / (1048576.0 * 1024.0));
+                fprintf(f, "%s, from %p\n", topLevelName, site->caller);
         }
-        sint getSize() { return 9; }
-    } ColumnFrees;
+        free(sites);
+        fclose(f);
+        return 1;
+    }
 #endif
 
 
 
-#if MMGR
-    static const sint numColumns = 4;
-#else
-    static const sint numColumns = 2;
-#endif
-    static ColumnData* columns[numColumns] = { 
-        &ColumnRuntimeAndCalls,
-        &ColumnNested
-#if MMGR
-        ,
-        &ColumnAllocations,
-        &ColumnFrees 
-#endif
+    //One step of merging finished threads' trees.  Each task touches only
+    //its own trees, so tasks run in parallel.
+    struct MergeRound
+    {
+        //Detached managers being merged.  A tree that has been absorbed is
+        //deleted, and left dangling here.
+        ProfilerManager** trees;
+        sint count;
+
+        //0 to prepare every tree.  Otherwise, task i merges 
+        //trees[(2i + 1) * stride] into trees[2i * stride].
+        sint stride;
+
+        //Number of tasks, and the next task to be claimed.
+        sint tasks;
+        volatile sint32 next;
     };
-    
 
 
-    void outputProfilerGroup(FILE* f, sint columnStart, sint columnStop, 
-      sint childLevel, TimingInfo* record, const suint maxNameLength)
+
+    /**Runs tasks from a MergeRound until none are left.
+      */
+    void runMergeTasks(MergeRound* round)
     {
-        while (record)
-        {
-            for (sint t = 0; t < childLevel - 1; t++)
-                fprintf(f, "  ");
-            if (record->down) {
-                if (childLevel > 0)
-                    fprintf(f, "+ ");
-            }
-            else if (childLevel > 0) {
-                fprintf(f, "| ");
+        sint i;
+        while ((i = seashell::atomic::add(&round->next, 1) - 1) < 
+          round->tasks) {
+            if (round->stride == 0)
+                round->trees[i]->prepareDetached_();
+            else {
+                const sint into = i * round->stride * 2;
+                round->trees[into]->absorbDetached_(
+                  round->trees[into + round->stride]);
             }
-            const char* name = record->name;
-            if (!name)
-                name = topLevelName;
+        }
+    }
 
-            const sint nameLength = (sint)strlen(name);
-            fwrite(name, 1, nameLength, f);
 
-            sint spaces = maxNameLength - nameLength - childLevel * 2;
-            while (spaces > 1) {
-                if ((spaces & 1) == 0)
-                    fprintf(f, " .");
-                else
-                    fprintf(f, ". ");
-                spaces -= 2;
-            }
-            while (spaces > 0) {
-                fprintf(f, ".");
-                spaces--;
-            }
 
-            for (sint i = columnStart; i < columnStop; i++)
-                columns[i]->printValue(f, record);
-            fprintf(f, "\n");
+    //Helps the thread calling mergePending_() with a MergeRound.  Must not 
+    //profile or allocate through the memory manager, either of which would 
+    //give it a ProfilerManager that locks the master's mutex as it exits.
+    class MergeWorker : public seashell::Thread
+    {
+    public:
+        MergeWorker()
+          : round_(0)
+        {
+        }
 
-            outputProfilerGroup(f, columnStart, columnStop, childLevel + 1, record->down, maxNameLength);
-            record = record->next;
+        ~MergeWorker()
+        {
+            stopThread();
+        }
+
+        void start(MergeRound* round)
+        {
+            round_ = round;
+            startThread();
         }
-    }
 
+        void run()
+        {
+            runMergeTasks(round_);
+        }
 
+    private:
+        MergeRound* round_;
+    };
 
-    /**Sorts the profiles in order of descending execution time.  Also 
-      *processes record names to crop names that are similar to their 
-      *parents'.
-      * @return Returns the maximum name length.
+
+
+    /**Runs every task of round, on up to PROFILER_MERGE_THREADS threads.
       */
-    suint sortTimingsGroup(TimingInfo* profile, suint additionalLength)
+    void runMergeRound(MergeRound* round)
     {
-        //Very poor sorting algorithm.
-        if (!profile)
-            return 0;
+        round->next = 0;
+        sint helpers = seashell::systeminfo::getActiveProcessors();
+        if (helpers > PROFILER_MERGE_THREADS)
+            helpers = PROFILER_MERGE_THREADS;
+        if (helpers > round->tasks)
+            helpers = round->tasks;
+        helpers--; //This thread works too.
+
+        if (helpers <= 0) {
+            runMergeTasks(round);
+            return;
+        }
+        MergeWorker* workers = new MergeWorker[helpers];
+        for (sint i = 0; i < helpers; i++)
+            workers[i].start(round);
+        runMergeTasks(round);
+        delete[] workers; //Joins them.
+    }
 
-        //process the first record in the list outside of the loop.
-        suint ret = sortTimingsGroup(profile->down, additionalLength + 2);
 
-        //After children have cropped their names, crop ours.
-        cropProfilerName(profile);
 
-        suint returnTemp;
-        if (profile->name)
-            returnTemp = additionalLength + (suint)strlen(profile->name);
-        else
-            returnTemp = additionalLength + (suint)strlen(topLevelName);
-        if (returnTemp > ret)
-            ret = returnTemp;
+    void ProfilerManager::prepareDetached_()
+    {
+        cascadeRecursive_(current_);
+        cascadeTimings(current_);
+    }
 
-        TimingInfo* t = profile->next;
-        profile->next = 0;
-        while (t) {
-            big_suint runtime = t->result.runtime;
-            TimingInfo* next = t->next;
-            t->next = 0;
 
-            TimingInfo* last = 0;
-            TimingInfo* temp = profile;
-            while (true) {
-                if (temp->result.runtime <= runtime) {
-                    if (last) {
-                        last->next = t;
-                        t->next = temp;
-                    }
-                    else {
-                        t->up->down = t;
-                        t->next = profile;
-                        profile = t;
-                    }
-                    break;
-                }
 
-                if (!temp->next) {
-                    temp->next = t;
-                    break;
-                }
-                last = temp;
-                temp = temp->next;
-            }
+    void ProfilerManager::absorbDetached_(ProfilerManager* other)
+    {
+        mergeWith_(current_, other->current_, 1);
+        arena_.adopt(other->arena_);
+        delete other;
+    }
 
-            suint returnTemp = sortTimingsGroup(t->down, additionalLength + 2);
-            if (returnTemp > ret)
-                ret = returnTemp;
-            //After r's children's names are cropped, crop r's
-            cropProfilerName(t);
-            returnTemp = additionalLength + (suint)strlen(t->name);
-            if (returnTemp > ret)
-                ret = returnTemp;
 
-            t = next;
+
+    void ProfilerManager::mergePending_()
+    {
+        if (!pending_)
+            return;
+
+        //Trees are merged pairwise: 0 with 1, 2 with 3, and so on, then 0 
+        //with 2, and so on.  Every merge in a step is independent, so the 
+        //work of each step is spread over several threads, and the master 
+        //only merges in one tree.
+        MergeRound round;
+        round.count = pendingCount_;
+        round.trees = (ProfilerManager**)malloc(sizeof(ProfilerManager*) *
+          round.count);
+        sint i = 0;
+        for (ProfilerManager* pm = pending_; pm; pm = pm->nextPending_)
+            round.trees[i++] = pm;
+        pending_ = 0;
+        pendingCount_ = 0;
+
+        round.stride = 0;
+        round.tasks = round.count;
+        runMergeRound(&round);
+        for (round.stride = 1; round.stride < round.count; 
+          round.stride *= 2) {
+            round.tasks = (round.count + round.stride - 1) / 
+              (round.stride * 2);
+            runMergeRound(&round);
         }
 
-        return ret;
+        ProfilerManager* merged = round.trees[0];
+        free(round.trees);
+
+        //The memory manager may still print stack traces through the 
+        //finished threads' TimingInfos, and the event trace may still name
+        //them.
+#if MMGR || PROFILER_EVENT_TRACE
+        mergeWith_(current_, merged->current_, 1);
+        arena_.adopt(merged->arena_);
+#else
+        mergeWith_(current_, merged->current_, 0);
+#endif
+        delete merged;
     }
 
 
 
-    void printProfilerResults(TimingInfo* current)
+    sint ProfilerManager::writeSnapshot_(const char* file)
     {
-        eassert(current->up == 0, Exception, "Non-top level print-out requested.");
-        suint maxNameLength = sortTimingsGroup(current, 2);
-
-        const sint spacesLeft = (sint)(maxNameLength - strlen("Function"));
-#ifdef CONSOLE_OUTPUT
-        printf("--------------------\nProfiling results:\n");
-
-        //Output all results upside-down.  Since this is a console
-        //print out, we want the most relevant information at the
-        //bottom.
-        std::vector<sint> columnTraverse;
-        columnTraverse.push_back(0);
-        sint columnStart = 0;
-        while (columnStart < numColumns) {
-            sint columnStop = columnStart + 1;
-            sint columnsForData = 80 - maxNameLength - 1 - columns[columnStart]->getSize();
-            while (columnStop < numColumns && columnsForData > 0) {
-                columnsForData -= columns[columnStop]->getSize() + 1;
-                if (columnsForData < 0)
-                    break;
-                columnStop++;
+        mergePending_();
+
+        //Everything is gathered into copies.  Live trees are still being
+        //added to, and the master's tree has already been cascaded.
+        ProfilerManager gathered(current_);
+        SamplerBlock* block = &samplerSlots;
+        while (block) {
+            for (sint i = 0; i < PROFILER_SAMPLER_BLOCK_SLOTS; i++) {
+                TimingInfo* root = 
+                  seashell::atomic::loadAcquire(&block->slots[i].root);
+                if (root) {
+                    TimingInfo* copy = gathered.copyTree_(root, 0);
+                    gathered.cascadeRecursive_(copy);
+                    cascadeTimings(copy);
+                    gathered.mergeWith_(gathered.current_, copy, 1);
+                }
             }
-            columnTraverse.push_back(columnStop);
-            columnStart = columnStop;
+            block = seashell::atomic::loadAcquire(&block->next);
         }
 
-        const sint profilerBlocks = (sint)columnTraverse.size();
-        sint columnStop = numColumns;
-        for (sint j = profilerBlocks - 2; j >= 0; j--)
-        {
-            columnStart = columnTraverse[j];
-            for (sint i = 0; i < spacesLeft; i++)
-                printf(" ");
-            printf("%s", "Function");
-            for (sint i = columnStart; i < columnStop; i++)
-                columns[i]->printName(stdout);
-            printf("\n");
-            outputProfilerGroup(stdout, columnStart, columnStop, 0, current, maxNameLength);
-            printf("\n\n");
-            columnStop = columnStart;
+        //Written beside the destination and renamed over it, so that a
+        //reader never sees half of a snapshot.
+        const sint tempLength = (sint)strlen(file) + 5;
+        char* temp = (char*)malloc(tempLength);
+        StringCchCopy(temp, tempLength, file);
+        StringCchCat(temp, tempLength, ".tmp");
+
+        sint success = 0;
+        FILE* f = fopen(temp, "wb");
+        if (f) {
+            suint32 fields[maxSnapshotFields];
+            const suint32 fieldCount = getSnapshotFields(fields);
+            snapshot::writeHeader(f, (suint64)time(0), 
+              countTimingTree(gathered.current_), fields, fieldCount);
+            suint32 index = 0;
+            writeSnapshotGroup_(f, gathered.current_, 
+              snapshot::SNAPSHOT_NO_PARENT, index);
+            success = !ferror(f);
+            if (fclose(f) != 0)
+                success = 0;
         }
-        printf("--------------------\n");
+        if (success) {
+#ifdef _WINDOWS
+            success = MoveFileExA(temp, file, MOVEFILE_REPLACE_EXISTING);
+#else
+            success = (rename(temp, file) == 0);
 #endif
-        FILE* f = fopen(output, "wt");
-        for (sint i = 0; i < spacesLeft; i++)
-            fprintf(f, " ");
-        fprintf(f, "%s", "Function");
-        for (sint i = 0; i < numColumns; i++)
-            columns[i]->printName(f);
-
-        fprintf(f, "\n");
-        outputProfilerGroup(f, 0, numColumns, 0, current, maxNameLength);
-        fclose(f);
+        }
+        free(temp);
+        return success;
     }
 
 
 
-#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
-    //Thread for samples.
-    class Sampler : public seashell::Thread
+    //File that the snapshot thread writes to.
+    char* snapshotFile = 0;
+
+    //ms between snapshots; 0 to only write them on request.
+    suint snapshotInterval = 0;
+
+    //Set to request a snapshot.  Set from signal handlers.
+    volatile sig_atomic_t snapshotRequested = 0;
+
+
+
+    //Thread that writes snapshots.
+    class SnapshotWriter : public seashell::Thread
     {
     public:
-        Sampler()
+        SnapshotWriter()
         {
             startThread();
         }
 
-        ~Sampler()
+        ~SnapshotWriter()
         {
             stopThread();
         }
 
         void run()
         {
-#if METHOD_SAMPLING_METHOD == 1 //perceived run time
-            const big_suint interval = 1;
-#else                           //processor run time
-            const big_suint interval = 10;
-#endif
             big_suint last = timing::getSystemMs();
             while (1) {
                 queryExit();
 
-                timing::sleepThread(interval);
+                timing::sleepThread(PROFILER_SNAPSHOT_POLL_MS);
                 big_suint time = timing::getSystemMs();
-                if (time - last >= interval) {
-                    big_suint timeElapsed = time - last;
+                if (snapshotRequested || 
+                  (snapshotInterval && time - last >= snapshotInterval)) {
+                    snapshotRequested = 0;
                     last = time;
-                    profileManagers().foreach(
-                      &ProfilerManager::incrementCurrent, &timeElapsed);
+                    writeSnapshot(snapshotFile);
                 }
             }
         }
     };
-    Sampler* sampleThread = 0;
+    SnapshotWriter* snapshotThread = 0;
 
 
 
-    /**Sums timings from all children, if necessary.
-      * @return Returns the runtime of the queried node.
-      */
-    big_suint cascadeTimings(TimingInfo* node)
+#if defined(_LINUX) && PROFILER_SNAPSHOT_SIGNAL
+    void snapshotSignalHandler(int)
     {
-        if (node == ProfilerManager::initializationTimings)
-            return node->result.runtime;
-        big_suint childSum = 0;
-
-        TimingInfo* child = node->down;
-        while (child) {
-            childSum += cascadeTimings(child);
-
-#if MMGR
-            node->result.allocations += child->result.allocations;
-            node->result.deallocations += child->result.deallocations;
-#endif
-            child = child->next;
-        }
-        node->result.runtime += childSum;
-
-        if (PROFILER_PROCESS_OVERHEAD) {
-            if (ProfilerManager::initializationTimings) {
-                TimingInfo* t = ProfilerManager::overheadSelfTimings;
-                big_suint tempRuntime = node->result.runtime;
-                //Take off overhead caused by merely starting the profiler
-                node->result.runtime -= 
-                  (node->result.calls + node->result.nestedcalls) *
-                  t->result.runtime / (t->result.calls + 
-                  t->result.nestedcalls);
-
-                //Since returns are processed by our parents, the return value
-                //should represent contained overhead
-                t = ProfilerManager::overheadContainedTimings;
-                return tempRuntime - 
-                  ((node->result.calls + node->result.nestedcalls) *
-                  t->result.runtime / (t->result.calls + 
-                  t->result.nestedcalls));
-            }
-        }
-        return node->result.runtime;
+        snapshotRequested = 1;
     }
-#endif //PROFILER_TIMING_METHOD
-
-
-
-    void ProfilerManager::initialize()
-    {PROFILER(0);
-#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
-        sampleThread = new Sampler();
 #endif
 
-        {//Initialize a profiler for the overhead of this mechanism.
-            TimingInfo* temp = 0;
-            const sint profilerLoops = PROFILER_OVERHEAD_LOOPS;
-            for (sint i = 0; i < profilerLoops; i++)
-            {PROFILER("Profiler Self-Overhead");
-            }
-            temp = profileManagers().get()->getCurrent()->down;
-            temp->result.calls = profilerLoops;
 
-            ProfilerManager::overheadSelfTimings = temp;
-        }
 
-        {//Another overhead mechanism; this one is the overhead for a parent
-            TimingInfo* temp = 0;
-            const sint profilerLoops = PROFILER_OVERHEAD_LOOPS;
-            {PROFILER("Profiler Contained-Overhead");
-                for (sint i = 0; i < profilerLoops; i++) {
-                    PROFILER("temp");
-                }
-                temp = PROFBOMB192525.timingInfo_;
-            }
-            temp->result.calls = profilerLoops;
-            cascadeTimings(temp);
-            freeTimingGroup_(temp->down);
-            temp->down = 0;
+    sint writeSnapshot(const char* file)
+    {
+        if (!master)
+            return 0;
+        LockMutex(master->masterMutex);
+        return master->writeSnapshot_(file);
+    }
 
-            ProfilerManager::overheadContainedTimings = temp;
-        }
 
-        {//Time a X ms segment to count ticks
-            TimingInfo* temp = 0;
-            {PROFILER("123 ms");
-                big_suint start = timing::getThreadExecutionMs();
-                while (timing::getThreadExecutionMs() - start < 123) {
-                    PROFILER("temp");
-                    {
-                        {PROFILER("temp");}
-                        PROFILER("temp");
-                    }
-                }
 
-                temp = PROFBOMB192525.timingInfo_;
-            }
-            cascadeTimings(temp);
-            freeTimingGroup_(temp->down);
-            temp->down = 0;
-        }
+    void startSnapshots(const char* file, suint intervalMs)
+    {
+        if (!master || snapshotThread)
+            return;
+        snapshotFile = strdup(file);
+        snapshotInterval = intervalMs;
+#if defined(_LINUX) && PROFILER_SNAPSHOT_SIGNAL
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = snapshotSignalHandler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(PROFILER_SNAPSHOT_SIGNAL, &action, 0);
+#endif
+        snapshotThread = new SnapshotWriter();
+    }
 
-        //cascade the timings here; it won't happen later because we don't
-        //want these time info's measurements altered.
-        cascadeTimings(PROFBOMB192525.timingInfo_);
 
-        ProfilerManager::initializationTimings = PROFBOMB192525.timingInfo_;
+
+    void requestSnapshot()
+    {
+        snapshotRequested = 1;
     }
 
 
 
     ProfilerManager::~ProfilerManager()
     {
+        if (detached_) {
+            arena_.release();
+            return;
+        }
+        if (threadManager == this)
+            threadManager = 0;
+
 #if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
         if (master == this) {
-            delete sampleThread;
+            Sampler* sampler = sampleThread;
+            seashell::atomic::storeRelease(&sampleThread, (Sampler*)0);
+            delete sampler;
         }
 #endif
 
@@ -940,62 +3437,119 @@ namespace profiler
             current_ = current_->up;
 
         if (this != master) {
-#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
-            cascadeRecursive_(current_);
-            cascadeTimings(current_);
+#if PROFILER_HARDWARE_COUNTERS
+            closeCounters(counterFds_);
 #endif
+            char lastManager;
+            {//Snapshots copy our tree while holding this lock, so it may not
+             //change shape until they can no longer find it.
+                LockMutex(master->masterMutex);
+
+                seashell::atomic::storeRelease(&slot_->root, (TimingInfo*)0);
+                releaseSamplerSlot(slot_);
+                slot_ = 0;
+
+                //Merging is left for later, when it is done for many 
+                //threads at once.  This keeps thread exit cheap.
+                ProfilerManager* finished = new ProfilerManager(this);
+                finished->nextPending_ = master->pending_;
+                master->pending_ = finished;
+                master->pendingCount_++;
+                if (master->pendingCount_ >= PROFILER_PENDING_MAX)
+                    master->mergePending_();
+
+                numProfilerManager--;
+                lastManager = (numProfilerManager == 0 && staticDestruction);
+            }
 
-            LockMutex(masterMutex);
-
-            master->mergeWithAndSteal_(master->current_, current_);
-
-            numProfilerManager--;
-            if (numProfilerManager == 0 && staticDestruction) {
+            //Not while locked; the master stops the snapshot thread, which
+            //may be waiting on the lock.
+            if (lastManager) {
                 delete master;
             }
         }
         else { //master
+            {
+                LockMutex(masterMutex);
+                mergePending_();
+            }
+            printCollapsedStacks(collapsedOutput, current_);
+#if MMGR
+            printTopAllocators(current_);
+#endif
+#if PROFILER_LOCK_CONTENTION
+            writeLockReport(locksOutput);
+#endif
+#if PROFILER_EVENT_TRACE
+            writeTrace(traceOutput);
+#endif
+            if (snapshotThread) {
+                delete snapshotThread;
+                snapshotThread = 0;
+                writeSnapshot_(snapshotFile);
+            }
+
             //We are the master.  Print ourselves out.
-            printProfilerResults(current_);
+            printProfilerResults(current_, arena_);
             master = 0;
+
+            //Freeing the timing group, while good programming practice, 
+            //inhibits the memory manager's ability to draw conclusions about
+            //memory leaks in this thread's area.
+#if !MMGR
+            arena_.release();
+#endif
         }
+    }
+
+
+
+    void setEnabled(char enabled)
+    {
+        const sint32 was = seashell::atomic::exchange(&processEnabled, 
+          (sint32)(enabled ? 1 : 0));
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
+        //The sampler parks while profiling is off.
+        Sampler* sampler = seashell::atomic::loadAcquire(&sampleThread);
+        if (enabled && !was && sampler)
+            sampler->wake();
+#else
+        (void)was;
+#endif
+    }
+
+
+
+    char isEnabled()
+    {
+        return processEnabled != 0;
+    }
+
 
-        //Freeing the timing group, while good programming practice, inhibits
-        //the memory manager's ability to draw conclusions about memory leaks
-        //in this thread's area.
-        //freeTimingGroup_(current_);
+
+    void setThreadEnabled(char enabled)
+    {
+        ProfilerManager* pm = getThreadManager();
+        if (pm)
+            pm->setThreadEnabled(enabled);
     }
 
 
 
-    Bomb::Bomb(void* fingerprint,
+    void Bomb::enter_(void* fingerprint,
       const char* file, suint line, const char* function, const char* name)
     {
-        profiler::ProfilerManager* pm = profiler::profileManagers().get();
-        if (pm) {
+        profiler::ProfilerManager* pm = getThreadManager();
+        if (pm && pm->isThreadEnabled()) {
+            manager_ = pm;
             timingInfo_ = pm->locateFingerprint(fingerprint);
             if (timingInfo_->result.calls == 0) {
                 //Initialize the name
                 timingInfo_->file = file;
                 timingInfo_->line = line;
                 timingInfo_->function = function;
-                
-                {//generate display name string
-                    char* temp;
-                    if (!name)
-                        temp = strdup(function);
-                    else {
-                        sint nameLength = (sint)strlen(function) + (sint)strlen(name) + 
-                          4;
-                        temp = (char*)malloc(nameLength);
-                        StringCchCopy(temp, nameLength, function);
-                        StringCchCat(temp, nameLength, " \"");
-                        StringCchCat(temp, nameLength, name);
-                        StringCchCat(temp, nameLength, "\"");
-                    }
-
-                    timingInfo_->name = temp;
-                }
+                timingInfo_->name = pm->getDisplayName(fingerprint, function,
+                  name);
             }
             eassert(timingInfo_->runtime.callDepth >= 0, Exception, "Why does a "
               "profiler have a negative call depth?");
@@ -1006,25 +3560,599 @@ namespace profiler
             else {
                 timingInfo_->result.nestedcalls++;
             }
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+            parent_ = pm->enterBomb(this);
+            childTicks_ = 0;
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+            pm->readCounters(countersStart_);
+#endif
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED || \
+  PROFILER_EVENT_TRACE
+            //Last, so that none of the above is timed.
+            start_ = timing::getTicks();
+#endif
         }
-        else { //No profiler manager; in destruction sequence?
+        else { //Off for this thread, or no profiler manager (in destruction
+               //sequence?)
             timingInfo_ = 0;
         }
     }
 
 
 
-    Bomb::~Bomb()
+    void Bomb::leave_()
     {
-        if (timingInfo_) {
-            timingInfo_->runtime.callDepth--;
-            eassert(timingInfo_->runtime.callDepth >= 0, Exception, "Why does a "
-              "profiler have a negative call depth?");
-            profiler::profileManagers().get()->invalidateFingerprint();
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED || \
+  PROFILER_EVENT_TRACE
+        //First, so that none of the below is timed.
+        const big_suint end = timing::getTicks();
+#endif
+        profiler::ProfilerManager* pm = manager_;
+#if PROFILER_HARDWARE_COUNTERS
+        big_suint counters[PROFILER_NUM_COUNTERS];
+        pm->readCounters(counters);
+#endif
+        timingInfo_->runtime.callDepth--;
+        eassert(timingInfo_->runtime.callDepth >= 0, Exception, "Why does a "
+          "profiler have a negative call depth?");
+#if PROFILER_HARDWARE_COUNTERS
+        if (timingInfo_->runtime.callDepth == 0) {
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++) {
+                //Scaled counts are estimates, and may fall back a little.
+                if (counters[i] > countersStart_[i]) {
+                    timingInfo_->result.counters[i] += 
+                      counters[i] - countersStart_[i];
+                }
+            }
         }
+#endif
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        const big_suint elapsed = end - start_;
+        timingInfo_->result.exclusive += elapsed - childTicks_;
+        if (timingInfo_->runtime.callDepth == 0) {
+            timingInfo_->result.inclusive += elapsed;
+#if PROFILER_LATENCY_HISTOGRAMS
+            pm->recordLatency(timingInfo_, elapsed);
+#endif
+        }
+        if (parent_)
+            parent_->childTicks_ += elapsed;
+        pm->leaveBomb(parent_);
+#endif
+#if PROFILER_EVENT_TRACE
+        pm->traceEvent(timingInfo_->name, start_, end);
+#endif
+        pm->invalidateFingerprint();
     }
 } //profiler
 
+#if TESTING >= TESTLEVEL_IMPORTANT
+    TEST_BUDDY(profilerSnapshot)
+    {
+        //Scopes that are still open, on a thread that is still running, 
+        //belong in a snapshot too.
+        const char* file = "profiler_snapshot_test.bin";
+        profiler::snapshot::Snapshot* s = 0;
+        {PROFILER("snapshot outer");
+            for (sint i = 0; i < 3; i++) {
+                PROFILER("snapshot inner");
+            }
+            testAssert(profiler::writeSnapshot(file), "Could not write "
+              "snapshot");
+            s = profiler::snapshot::readSnapshot(file);
+        }
+        remove(file);
+        testAssert(s, "Could not read snapshot back");
+
+        profiler::snapshot::Node* inner = 0;
+        for (suint32 i = 0; i < s->nodeCount; i++) {
+            if (strstr(s->nodes[i].name, "\"snapshot inner\""))
+                inner = &s->nodes[i];
+        }
+        testAssert(inner, "Inner scope missing from snapshot");
+        testAssert(inner->values[profiler::snapshot::FIELD_CALLS] == 3, 
+          "Inner scope has %i calls; expected 3", 
+          (sint)inner->values[profiler::snapshot::FIELD_CALLS]);
+        testAssert(strstr(inner->up->name, "\"snapshot outer\""), "Inner "
+          "scope's parent is %s", inner->up->name);
+        testAssert(s->nodes[0].up == 0 && inner->up->up, "Snapshot tree is "
+          "malformed");
+        profiler::snapshot::freeSnapshot(s);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+    TEST_BUDDY(profilerCollapsedStacks)
+    {
+        const char* file = "profiler_snapshot_test.bin";
+        const char* collapsedFile = "profiler_collapsed_test.txt";
+        {PROFILER("collapsed outer");
+            {PROFILER("collapsed inner");
+                big_suint start = timing::getSystemMs();
+                while (timing::getSystemMs() - start < 5);
+            }
+            testAssert(profiler::writeSnapshot(file), "Could not write "
+              "snapshot");
+        }
+        profiler::snapshot::Snapshot* s = 
+          profiler::snapshot::readSnapshot(file);
+        remove(file);
+        testAssert(s, "Could not read snapshot back");
+        FILE* f = fopen(collapsedFile, "wt");
+        profiler::snapshot::printCollapsed(f, s);
+        fclose(f);
+        profiler::snapshot::freeSnapshot(s);
+
+        //The inner scope's line names its whole stack.
+        char line[4096];
+        char found = 0;
+        f = fopen(collapsedFile, "rt");
+        while (fgets(line, sizeof(line), f)) {
+            const char* outer = strstr(line, "\"collapsed outer\";");
+            if (outer && strstr(outer, "\"collapsed inner\" "))
+                found = 1;
+        }
+        fclose(f);
+        remove(collapsedFile);
+        testAssert(found, "Inner scope's stack missing from collapsed "
+          "output");
+
+        //profile.folded is written from the live tree at exit; each line 
+        //holds a scope's time less its children's.
+        profiler::TimingInfo nodes[3];
+        memset(nodes, 0, sizeof(nodes));
+        char outerName[] = "folded outer";
+        char innerName[] = "folded inner";
+        nodes[0].down = &nodes[1];
+        nodes[1].up = &nodes[0];
+        nodes[1].down = &nodes[2];
+        nodes[1].name = outerName;
+        nodes[2].up = &nodes[1];
+        nodes[2].name = innerName;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+        //Microseconds, from ticks.
+        const real64 ticksPerMs = 1.0 / profiler::ProfilerManager::msPerTick;
+        nodes[1].result.exclusive = (big_suint)(6 * ticksPerMs);
+        nodes[2].result.exclusive = (big_suint)(4 * ticksPerMs);
+        const sint scale = 1000;
+#else
+        //Milliseconds.
+        nodes[1].result.runtime = 10;
+        nodes[2].result.runtime = 4;
+        const sint scale = 1;
+#endif
+        testAssert(profiler::printCollapsedStacks(collapsedFile, nodes), 
+          "Could not write collapsed stacks");
+        sint outerValue = -1, innerValue = -1;
+        f = fopen(collapsedFile, "rt");
+        while (f && fgets(line, sizeof(line), f)) {
+            if (!strncmp(line, "folded outer;folded inner ", 26))
+                innerValue = atoi(line + 26);
+            else if (!strncmp(line, "folded outer ", 13))
+                outerValue = atoi(line + 13);
+        }
+        if (f)
+            fclose(f);
+        remove(collapsedFile);
+        testAssert(abs(outerValue - 6 * scale) <= scale / 100 && 
+          abs(innerValue - 4 * scale) <= scale / 100, "Collapsed stacks "
+          "gave %i and %i; expected %i and %i", outerValue, innerValue,
+          6 * scale, 4 * scale);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+    TEST_BUDDY(profilerEnabling)
+    {
+        //Off for the process on the second pass, and for this thread on the
+        //third.
+        const char wasEnabled = profiler::isEnabled();
+        void* outside = profiler::getStackFingerprint();
+        profiler::TimingInfo* t = 0;
+        for (sint i = 0; i < 4; i++) {
+            profiler::setEnabled(i != 1);
+            profiler::setThreadEnabled(i != 2);
+            PROFILER("toggled scope");
+            void* inside = profiler::getStackFingerprint();
+            if (i == 1 || i == 2) {
+                testAssert(inside == outside, "Scope was timed while "
+                  "profiling was off (pass %i)", i);
+            }
+            else
+                t = (profiler::TimingInfo*)inside;
+        }
+        profiler::setThreadEnabled(1);
+        profiler::setEnabled(wasEnabled);
+        testAssert(t && t->result.calls == 2, "Scope has %i calls; expected "
+          "2", t ? (sint)t->result.calls : -1);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+    TEST_BUDDY(profilerDeferredMerge)
+    {
+        //Finished threads' trees are merged when a snapshot is taken.
+        class ScopeThread : public seashell::Thread
+        {
+        public:
+            ~ScopeThread()
+            {
+                stopThread();
+            }
+
+            void run()
+            {
+                for (sint i = 0; i < 5; i++) {
+                    PROFILER("deferred merge scope");
+                }
+            }
+        };
+        {
+            ScopeThread threads[3];
+            for (sint i = 0; i < 3; i++)
+                threads[i].startThread();
+        }
+
+        const char* file = "profiler_snapshot_test.bin";
+        testAssert(profiler::writeSnapshot(file), "Could not write "
+          "snapshot");
+        profiler::snapshot::Snapshot* s = 
+          profiler::snapshot::readSnapshot(file);
+        remove(file);
+        testAssert(s, "Could not read snapshot back");
+        profiler::snapshot::Node* scope = 0;
+        for (suint32 i = 0; i < s->nodeCount; i++) {
+            if (strstr(s->nodes[i].name, "\"deferred merge scope\""))
+                scope = &s->nodes[i];
+        }
+        testAssert(scope, "Finished threads' scope missing from snapshot");
+        testAssert(scope->values[profiler::snapshot::FIELD_CALLS] == 15, 
+          "Finished threads' scope has %i calls; expected 15", 
+          (sint)scope->values[profiler::snapshot::FIELD_CALLS]);
+        profiler::snapshot::freeSnapshot(s);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && PROFILER_EVENT_TRACE
+    TEST_BUDDY(profilerEventTrace)
+    {
+        const char* file = "profiler_trace_test.json";
+        {PROFILER("traced scope");
+        }
+        testAssert(profiler::writeTrace(file), "Could not write trace");
+
+        FILE* f = fopen(file, "rb");
+        fseek(f, 0, SEEK_END);
+        const sint size = (sint)ftell(f);
+        fseek(f, 0, SEEK_SET);
+        char* text = (char*)calloc(1, size + 1);
+        fread(text, 1, size, f);
+        fclose(f);
+        remove(file);
+        const char* event = strstr(text, "\\\"traced scope\\\"");
+        testAssert(strncmp(text, "{\"traceEvents\":[", 16) == 0, 
+          "Trace does not start as trace_event JSON");
+        testAssert(event && strstr(event, "\"ph\":\"X\""), "Traced "
+          "scope missing from trace");
+        free(text);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && \
+  PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING
+    TEST_BUDDY(profilerSamplerParking)
+    {
+        //The sampler should stop passing over the slots while profiling is
+        //off for the process, and start again once it is turned back on.
+        const char wasEnabled = profiler::isEnabled();
+        profiler::setEnabled(1);
+        {PROFILER("sampler parking");} //Starts the sampler, if need be.
+
+        profiler::setEnabled(0);
+        timing::sleepThread(30); //Long enough for it to park.
+        const sint32 parked = 
+          seashell::atomic::loadAcquire(&profiler::samplerPass);
+        timing::sleepThread(50);
+        const sint32 later = 
+          seashell::atomic::loadAcquire(&profiler::samplerPass);
+        testAssert(later == parked, "Sampler made %i passes while profiling "
+          "was off", (sint)(later - parked) / 2);
+
+        profiler::setEnabled(1);
+        const big_suint start = timing::getSystemMs();
+        while (seashell::atomic::loadAcquire(&profiler::samplerPass) == 
+          parked && timing::getSystemMs() - start < 1000)
+            timing::sleepThread(1);
+        testAssert(seashell::atomic::loadAcquire(&profiler::samplerPass) != 
+          parked, "Sampler was not woken when profiling was turned on");
+        profiler::setEnabled(wasEnabled);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && \
+  PROFILER_TIMING_METHOD == TIMING_METHOD_SAMPLING && \
+  METHOD_SAMPLING_METHOD == 1
+    TEST_BUDDY(profilerSamplerThreadDisabled)
+    {
+        //Time that a thread spends with profiling off for it should not be
+        //charged to the scope it was in.
+        const char wasEnabled = profiler::isEnabled();
+        profiler::setEnabled(1);
+        {PROFILER("sampled while disabled");
+            profiler::TimingInfo* t = 
+              (profiler::TimingInfo*)profiler::getStackFingerprint();
+            profiler::setThreadEnabled(0);
+            //Let any pass that saw the thread enabled finish.
+            const sint32 pass = 
+              seashell::atomic::loadAcquire(&profiler::samplerPass);
+            const big_suint start = timing::getSystemMs();
+            while (seashell::atomic::loadAcquire(&profiler::samplerPass) - 
+              pass < 3 && timing::getSystemMs() - start < 1000)
+                timing::sleepThread(1);
+            const big_suint before = t->result.runtime;
+            timing::sleepThread(50);
+            const big_suint after = t->result.runtime;
+            profiler::setThreadEnabled(1);
+            testAssert(after == before, "%i ms were sampled while profiling "
+              "was off for the thread", (sint)(after - before));
+        }
+        profiler::setEnabled(wasEnabled);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && \
+  PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+    TEST_BUDDY(profilerInstrumentedTiming)
+    {
+        //A scope that spins for 5 ms should report about 5 ms, and a scope
+        //that only contains it should report next to nothing of its own.
+        profiler::TimingInfo* outer;
+        profiler::TimingInfo* inner;
+        {PROFILER("outer");
+            outer = (profiler::TimingInfo*)profiler::getStackFingerprint();
+            {PROFILER("inner");
+                inner = (profiler::TimingInfo*)profiler::getStackFingerprint();
+                big_suint start = timing::getSystemMs();
+                while (timing::getSystemMs() - start < 5);
+            }
+        }
+
+        const real64 msPerTick = 1000.0 / timing::getTicksPerSecond();
+        const real64 innerMs = inner->result.inclusive * msPerTick;
+        const real64 outerMs = outer->result.inclusive * msPerTick;
+        const real64 outerSelfMs = outer->result.exclusive * msPerTick;
+        testAssert(innerMs > 3.5 && innerMs < 50.0, "Inner scope measured "
+          "%f ms; expected about 5", innerMs);
+        testAssert(outerMs >= innerMs, "Outer scope (%f ms) measured less "
+          "than inner scope (%f ms)", outerMs, innerMs);
+        testAssert(outerSelfMs < 0.5, "Outer scope measured %f ms of its "
+          "own time; expected next to none", outerSelfMs);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && PROFILER_LOCK_CONTENTION
+    TEST_BUDDY(profilerLockContention)
+    {
+        //A lock that waits for another thread counts against the waiting 
+        //scope, and against the site that made the Mutex.
+        static seashell::Mutex* m;
+        static volatile sint32 held;
+        class Holder : public seashell::Thread
+        {
+        public:
+            ~Holder()
+            {
+                stopThread();
+            }
+
+            void run()
+            {
+                LockMutex(*m);
+                seashell::atomic::storeRelease(&held, (sint32)1);
+                timing::sleepThread(20);
+            }
+        };
+
+        //Asking whether a lock is held takes no lock.
+        seashell::RWMutex rw;
+        profiler::TimingInfo* t;
+        {PROFILER("lock contention");
+            t = (profiler::TimingInfo*)profiler::getStackFingerprint();
+            m = new seashell::Mutex();
+            held = 0;
+            Holder holder;
+            holder.startThread();
+            while (!seashell::atomic::loadAcquire(&held))
+                timing::sleepThread(1);
+            m->mutexLock();
+            m->mutexUnlock();
+            for (sint i = 0; i < 10; i++) {
+                LockMutex(*m);
+            }
+            testAssert(!m->mutexIsLocked() && !rw.mutexIsLocked(), 
+              "Reported a lock that is not held");
+        }
+        const real64 waitMs = profiler::lockTicksToMs(t->result.lockWaitTicks);
+        testAssert(t->result.locks == 11, "Scope took %i locks; expected 11",
+          (sint)t->result.locks);
+        testAssert(t->result.contendedLocks == 1, "Scope waited for %i "
+          "locks; expected 1", (sint)t->result.contendedLocks);
+        testAssert(waitMs > 10.0 && waitMs < 1000.0, "Scope waited %f ms; "
+          "expected about 20", waitMs);
+
+        //The site is in the report, with the holder's lock too.
+        const char* file = "profiler_locks_test.txt";
+        testAssert(profiler::writeLockReport(file), "Could not write lock "
+          "report");
+        char line[4096];
+        char found = 0;
+        FILE* f = fopen(file, "rt");
+        while (fgets(line, sizeof(line), f)) {
+            if (!strstr(line, "\"lock contention\""))
+                continue;
+            double siteWaitMs = 0;
+            unsigned int locks = 0, contended = 0;
+            sscanf(line, "|%lf|%u|%u|", &siteWaitMs, &locks, &contended);
+            testAssert(locks == 12 && contended == 1 && siteWaitMs > 10.0,
+              "Site reported %u locks, %u waited, %f ms waiting", locks,
+              contended, siteWaitMs);
+            found = 1;
+        }
+        fclose(f);
+        remove(file);
+        testAssert(found, "Mutex creation site missing from lock report");
+        delete m;
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && MMGR
+    TEST_BUDDY(profilerAllocationStats)
+    {
+        //Allocations count against the scope that made them, even when they
+        //are freed elsewhere.
+        //Volatile so that the compiler cannot leave out the allocations.
+        profiler::TimingInfo* t = 0;
+        char* volatile kept = 0;
+        {PROFILER("allocation stats");
+            t = (profiler::TimingInfo*)profiler::getStackFingerprint();
+            kept = new char[1 << 20];
+            for (sint i = 0; i < 10; i++) {
+                char* volatile temp = new char[48];
+                delete[] temp;
+            }
+        }
+        testAssert(t->result.allocationCount == 11, "Scope made %i "
+          "allocations; expected 11", (sint)t->result.allocationCount);
+        const sint small = profiler::getAllocationSizeClass(48);
+        const sint large = profiler::ALLOCATION_SIZE_CLASSES - 1;
+        testAssert(t->result.sizeClasses[small] == 10 && 
+          t->result.sizeClasses[large] == 1, "Allocations in the wrong size "
+          "classes");
+        testAssert(t->result.liveBytes == (1 << 20), "Scope has %i live "
+          "bytes; expected %i", (sint)t->result.liveBytes, 1 << 20);
+        testAssert(t->result.peakBytes == (1 << 20) + 48, "Scope peaked at "
+          "%i bytes; expected %i", (sint)t->result.peakBytes, (1 << 20) + 48);
+
+        //It tops the report of live bytes.
+        const char* file = "profiler_snapshot_test.bin";
+        const char* reportFile = "profiler_allocators_test.txt";
+        testAssert(profiler::writeSnapshot(file), "Could not write "
+          "snapshot");
+        profiler::snapshot::Snapshot* s = 
+          profiler::snapshot::readSnapshot(file);
+        remove(file);
+        testAssert(s, "Could not read snapshot back");
+        FILE* f = fopen(reportFile, "wt");
+        profiler::snapshot::printTopAllocators(f, s, 
+          profiler::snapshot::FIELD_LIVE_BYTES, 1);
+        fclose(f);
+        profiler::snapshot::freeSnapshot(s);
+
+        char line[4096];
+        char found = 0;
+        f = fopen(reportFile, "rt");
+        while (fgets(line, sizeof(line), f)) {
+            if (strstr(line, "\"allocation stats\""))
+                found = 1;
+        }
+        fclose(f);
+        remove(reportFile);
+        testAssert(found, "Scope missing from top of allocation report");
+
+        delete[] kept;
+        testAssert(t->result.liveBytes == 0, "Scope has %i live bytes after "
+          "its allocation was freed", (sint)t->result.liveBytes);
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && PROFILER_HARDWARE_COUNTERS
+    TEST_BUDDY(profilerHardwareCounters)
+    {
+        //A scope counts the work done inside of it, and its parent counts 
+        //at least as much.
+        profiler::TimingInfo* outer;
+        profiler::TimingInfo* inner;
+        volatile sint sum = 0;
+        {PROFILER("counted outer");
+            outer = (profiler::TimingInfo*)profiler::getStackFingerprint();
+            {PROFILER("counted inner");
+                inner = (profiler::TimingInfo*)profiler::getStackFingerprint();
+                for (sint i = 0; i < 1000000; i++)
+                    sum += i;
+            }
+        }
+
+        if (!profiler::counterSet)
+            printf("No performance counters could be opened\n");
+        else {
+            testAssert(inner->result.counters[0] > 0, "Inner scope counted "
+              "nothing");
+            if (profiler::counterSet == &profiler::hardwareCounters) {
+                testAssert(inner->result.counters[1] > 1000000, "Inner "
+                  "scope counted %i instructions for a million loops", 
+                  (sint)inner->result.counters[1]);
+            }
+            for (sint i = 0; i < PROFILER_NUM_COUNTERS; i++) {
+                testAssert(outer->result.counters[i] >= 
+                  inner->result.counters[i], "Outer scope counted less "
+                  "than inner scope (counter %i)", i);
+            }
+        }
+    }
+    END_TEST_BUDDY()
+#endif
+
+#if TESTING >= TESTLEVEL_IMPORTANT && PROFILER_LATENCY_HISTOGRAMS
+    TEST_BUDDY(profilerLatencyHistograms)
+    {
+        //Every duration lands in a bucket that holds it, and buckets are 
+        //no wider than 1/16th of what they hold.
+        for (big_suint ticks = 1; ticks < ((big_suint)1 << 47); 
+          ticks = ticks * 3 / 2 + 1) {
+            const suint bucket = profiler::getHistogramBucket(ticks);
+            const big_suint bucketMax = 
+              profiler::getHistogramBucketMax(bucket);
+            testAssert(bucketMax >= ticks && (bucket == 0 || 
+              profiler::getHistogramBucketMax(bucket - 1) < ticks), 
+              "Bucket %i does not hold %lld ticks", (sint)bucket, ticks);
+            testAssert(bucketMax - ticks <= ticks / 16, "Bucket %i is too "
+              "wide for %lld ticks", (sint)bucket, ticks);
+        }
+
+        //One slow call in a hundred shows in the tail, not the median.
+        profiler::TimingInfo* t = 0;
+        for (sint i = 0; i < 100; i++) {
+            PROFILER("latency scope");
+            t = (profiler::TimingInfo*)profiler::getStackFingerprint();
+            if (i == 50) {
+                big_suint start = timing::getSystemMs();
+                while (timing::getSystemMs() - start < 5);
+            }
+        }
+        const real64 msPerTick = 1000.0 / timing::getTicksPerSecond();
+        const real64 p50 = profiler::getHistogramPercentile(
+          t->result.histogram, 0.5) * msPerTick;
+        const real64 p999 = profiler::getHistogramPercentile(
+          t->result.histogram, 0.999) * msPerTick;
+        testAssert(p50 < 0.5, "Median call took %f ms", p50);
+        testAssert(p999 > 4.0, "Slowest call took %f ms; expected about 5",
+          p999);
+    }
+    END_TEST_BUDDY()
+#endif
+
 #if TESTING >= TESTLEVEL_THOROUGH
     void recurse(sint i)
     {PROFILER(0);
@@ -1040,6 +4168,149 @@ namespace profiler
         recurse(5);
     }
     END_TEST_BUDDY()
+
+    TEST_BUDDY(profilerFanoutBenchmark)
+    {
+        //Entering a scope should cost the same no matter how many siblings
+        //it has.  Each marker is a distinct fingerprint (a distinct child).
+        static int markers[256];
+        const sint loops = 4000000;
+        for (sint children = 1; children <= 256; children *= 4) {
+            for (sint i = 0; i < children; i++) {
+                profiler::Bomb warm((void*)&markers[i], __FILE__, __LINE__,
+                  __FUNCTION__, "child");
+            }
+
+            big_suint start = timing::getSystemMs();
+            for (sint i = 0; i < loops; i++) {
+                profiler::Bomb b((void*)&markers[i & (children - 1)],
+                  __FILE__, __LINE__, __FUNCTION__, "child");
+            }
+            big_suint elapsed = timing::getSystemMs() - start;
+
+            printf("%3i children: %6.1f ns per Bomb\n", children,
+              (double)elapsed * 1000000.0 / loops);
+        }
+    }
+    END_TEST_BUDDY()
+
+    TEST_BUDDY(profilerDisabledBenchmark)
+    {
+        //A PROFILER() while profiling is off should cost next to nothing.
+        const char wasEnabled = profiler::isEnabled();
+        const sint loops = 100000000;
+        for (sint pass = 0; pass < 2; pass++) {
+            profiler::setEnabled(pass == 0 ? 0 : 1);
+            big_suint start = timing::getTicks();
+            for (sint i = 0; i < loops / (pass == 0 ? 1 : 20); i++) {
+                PROFILER("maybe disabled");
+            }
+            big_suint elapsed = timing::getTicks() - start;
+
+            printf("%s: %6.2f ns per PROFILER()\n", 
+              pass == 0 ? "Disabled" : "Enabled", 
+              (double)elapsed * 1000000000.0 / timing::getTicksPerSecond() /
+              (loops / (pass == 0 ? 1 : 20)));
+        }
+        profiler::setEnabled(wasEnabled);
+    }
+    END_TEST_BUDDY()
+
+    TEST_BUDDY(profilerEmptyScopeBenchmark)
+    {
+        //The cost of the profiler itself, which is what it adds to the 
+        //loops that it measures.
+        const sint loops = 20000000;
+        for (sint pass = 0; pass < 3; pass++) {
+            big_suint start = timing::getTicks();
+            for (sint i = 0; i < loops; i++) {
+                PROFILER("empty scope");
+            }
+            const real64 seconds = (real64)(timing::getTicks() - start) / 
+              timing::getTicksPerSecond();
+
+            printf("Pass %i: %6.1f million empty PROFILER() scopes per "
+              "second (%.2f ns each)\n", pass, loops / seconds / 1000000.0,
+              seconds * 1000000000.0 / loops);
+        }
+    }
+    END_TEST_BUDDY()
+
+    TEST_BUDDY(profilerFirstTouchBenchmark)
+    {
+        //Entering a scope for the first time allocates its TimingInfo and
+        //display name.  Each pass gets a fresh parent, so that every Bomb in
+        //it is a new scope.
+        static int parents[4];
+        static int markers[16384];
+        const sint scopes = sizeof(markers) / sizeof(markers[0]);
+        for (sint pass = 0; pass < 4; pass++) {
+            profiler::Bomb parent((void*)&parents[pass], __FILE__, __LINE__,
+              __FUNCTION__, "parent");
+            big_suint start = timing::getTicks();
+            for (sint i = 0; i < scopes; i++) {
+                profiler::Bomb b((void*)&markers[i], __FILE__, __LINE__,
+                  __FUNCTION__, "new scope");
+            }
+            big_suint elapsed = timing::getTicks() - start;
+
+            printf("Pass %i: %6.1f ns per new scope\n", pass,
+              (double)elapsed * 1000000000.0 / timing::getTicksPerSecond() /
+              scopes);
+        }
+    }
+    END_TEST_BUDDY()
+
+    TEST_BUDDY(profilerThreadExitBenchmark)
+    {
+        //Threads that finish together should not wait on each other to
+        //merge their trees.  Each thread enters the same wide set of scopes.
+        static int markers[1024];
+        static volatile sint32 exitNow;
+        const sint scopes = sizeof(markers) / sizeof(markers[0]);
+        const sint threadCount = 200;
+        class ScopeThread : public seashell::Thread
+        {
+        public:
+            ~ScopeThread()
+            {
+                stopThread();
+            }
+
+            void run()
+            {
+                {PROFILER("exiting thread");
+                    for (sint i = 0; i < scopes; i++) {
+                        profiler::Bomb b((void*)&markers[i], __FILE__, 
+                          __LINE__, __FUNCTION__, "scope");
+                    }
+                }
+                while (!seashell::atomic::loadAcquire(&exitNow))
+                    timing::sleepThread(1);
+            }
+        };
+
+        exitNow = 0;
+        ScopeThread* threads = new ScopeThread[threadCount];
+        for (sint i = 0; i < threadCount; i++)
+            threads[i].startThread();
+        timing::sleepThread(500);
+
+        big_suint start = timing::getTicks();
+        seashell::atomic::storeRelease(&exitNow, (sint32)1);
+        delete[] threads;
+        big_suint exited = timing::getTicks();
+        const char* file = "profiler_snapshot_test.bin";
+        profiler::writeSnapshot(file);
+        big_suint merged = timing::getTicks();
+        remove(file);
+
+        const real64 msPerTick = 1000.0 / timing::getTicksPerSecond();
+        printf("%i threads of %i scopes: %.1f ms to exit, %.1f ms to "
+          "snapshot\n", threadCount, scopes, (exited - start) * msPerTick,
+          (merged - exited) * msPerTick);
+    }
+    END_TEST_BUDDY()
 #endif
 
 #endif
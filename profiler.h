@@ -38,7 +38,80 @@
 //(usually the console), define PROFILER_CONSOLE.
 //
 //Note that if this is compiled with MMGR, then each profiler
-//section will have a memory usage tracker associated with it.
+//section will have a memory usage tracker associated with it.  Allocated
+//and Freed include nested sections; Allocs (the number of allocations), 
+//Live (bytes not yet freed, wherever they are freed) and Peak (the most
+//Live has been) count only the section's own allocations.  At exit, 
+//profile.allocators.txt lists the sections that allocate the most by each
+//of these, with the sizes of their allocations; profreport --top does the
+//same for a snapshot.
+//
+//
+//Snapshots:
+//Programs that run for a long time (or that crash) never reach the final
+//print out.  PROFILER_START_SNAPSHOTS("file", ms) writes a binary snapshot
+//of all results so far every ms milliseconds, whenever 
+//PROFILER_REQUEST_SNAPSHOT() is used (and on Linux, on SIGUSR1; see 
+//PROFILER_SNAPSHOT_SIGNAL in profiler.cpp), and at exit.  Snapshots are 
+//read with the profreport tool, which prints them in the above format, as
+//JSON, or as the difference between two snapshots.
+//
+//
+//Flame graphs and traces:
+//At exit, the profiler also writes profile.folded, the tree in collapsed
+//stack format (one "Scope;Nested Scope;... time" line per scope) for 
+//flamegraph.pl or speedscope.  Times are exclusive ms, or exclusive us
+//with TIMING_METHOD_INSTRUMENTED.  profreport --collapsed does the same for
+//a snapshot.
+//
+//With PROFILER_EVENT_TRACE, every Bomb's start and end are also recorded in
+//a per-thread ring buffer, and profile.trace.json is written at exit in
+//Chrome's trace_event format (chrome://tracing, Perfetto), which shows how
+//threads overlap in time.
+//
+//
+//Hardware counters:
+//On Linux, with PROFILER_HARDWARE_COUNTERS, every scope also counts the 
+//cycles, instructions, last level cache misses and branch misses of its 
+//outermost calls, read from perf_event_open counters that each thread opens
+//for itself.  The IPC column is instructions per cycle; a hot scope with low
+//IPC and many cache misses is memory bound.  Where hardware counters are not
+//available (virtual machines, perf_event_paranoid), the columns count task
+//clock ns, page faults, context switches and CPU migrations instead.
+//When the kernel has to share the counter registers with other users, it
+//counts the group only part of the time, and counts are scaled up from
+//that part, so are then estimates.
+//
+//
+//Turning profiling on and off:
+//profiler::setEnabled() turns profiling on or off for the whole process, 
+//and setThreadEnabled() for the calling thread.  While profiling is off, a
+//PROFILER() costs one load and a branch.  Scopes that are open when 
+//profiling is turned off are still timed to their end, and results are
+//kept, so that profiling may be turned on for a few minutes at a time on a
+//running program (along with snapshots, above).  Profiling starts on, 
+//unless PROFILER_START_ENABLED is 0, which is the default for FAST builds
+//(made with FAST_PROFILE; see seashell.h).
+//
+//
+//Latency histograms:
+//With PROFILER_LATENCY_HISTOGRAMS, every scope also keeps a log-bucketed 
+//histogram of the durations of its outermost calls, precise to within 
+//1/16th.  The p50, p90, p99, p999 and Max columns are read from it, and are
+//written to snapshots.
+//
+//
+//Lock contention:
+//With PROFILER_LOCK_CONTENTION, every seashell::Mutex and RWMutex lock is
+//counted against the scope that takes it: Locks counts them, Waited counts
+//those that had to wait for another thread, Wait ms is the time spent 
+//waiting, and MaxHold ms is the longest that a hard lock released in the 
+//scope was held.  They are also counted against the mutex's creation 
+//site, the scope and code that constructed it, so that all of the mutexes
+//in one kind of object count together.  At exit, profile.locks.txt lists 
+//the sites that were waited on the longest; a convoy shows up as a site 
+//with a large Wait ms and a MaxHold ms far longer than its waits should 
+//need.
 
 #ifndef PROFILER_H_
 #define PROFILER_H_
@@ -46,6 +119,66 @@
 //Define PROFILER_CONSOLE to output to console instead of file.
 //#define PROFILER_CONSOLE
 
+//Timing methods.
+//Sampling: A sampler thread periodically credits elapsed time to whichever
+//scope each thread is in.  Cheap, but scopes much shorter than the sampling
+//interval are statistical noise.
+//Instrumented: Every Bomb reads the processor's tick counter on entry and 
+//exit, and each scope accumulates exact inclusive and exclusive times.  The
+//measured per-Bomb overhead is subtracted from the results.
+#define TIMING_METHOD_SAMPLING 1
+#define TIMING_METHOD_INSTRUMENTED 2
+
+//Define PROFILER_TIMING_METHOD in project settings to select a method.
+#ifndef PROFILER_TIMING_METHOD
+#define PROFILER_TIMING_METHOD TIMING_METHOD_SAMPLING
+#endif
+
+//Define PROFILER_START_ENABLED as 0 or 1 in project settings to choose 
+//whether profiling is on at startup.
+#ifndef PROFILER_START_ENABLED
+#ifdef FAST
+#define PROFILER_START_ENABLED 0
+#else
+#define PROFILER_START_ENABLED 1
+#endif
+#endif
+
+//Define PROFILER_EVENT_TRACE as 1 in project settings to record an event
+//trace.  Costs two tick counter reads and a buffer write per Bomb.
+#ifndef PROFILER_EVENT_TRACE
+#define PROFILER_EVENT_TRACE 0
+#endif
+
+//Define PROFILER_HARDWARE_COUNTERS as 1 in project settings to add hardware
+//counter columns.  Costs two system calls per Bomb.  Linux only.
+#if !defined(PROFILER_HARDWARE_COUNTERS) || !defined(_LINUX)
+#undef PROFILER_HARDWARE_COUNTERS
+#define PROFILER_HARDWARE_COUNTERS 0
+#endif
+
+//Number of counters that each scope keeps with PROFILER_HARDWARE_COUNTERS.
+#define PROFILER_NUM_COUNTERS 4
+
+//Define PROFILER_LATENCY_HISTOGRAMS as 1 in project settings to keep a
+//histogram of call durations per scope.  Costs about 6kb per scope, and a
+//few instructions per Bomb.  Requires TIMING_METHOD_INSTRUMENTED.
+#ifndef PROFILER_LATENCY_HISTOGRAMS
+#define PROFILER_LATENCY_HISTOGRAMS 0
+#endif
+#if PROFILER_LATENCY_HISTOGRAMS && \
+  PROFILER_TIMING_METHOD != TIMING_METHOD_INSTRUMENTED
+#error PROFILER_LATENCY_HISTOGRAMS requires TIMING_METHOD_INSTRUMENTED.
+#endif
+
+//Define PROFILER_LOCK_CONTENTION as 1 in project settings to count Mutex 
+//locks and waits.  Costs a try lock, a few tick counter reads and atomic 
+//adds per lock.
+#if !defined(PROFILER_LOCK_CONTENTION) || !PROFILE
+#undef PROFILER_LOCK_CONTENTION
+#define PROFILER_LOCK_CONTENTION 0
+#endif
+
 #if PROFILE
 namespace profiler
 {
@@ -81,6 +214,62 @@ void* getStackFingerprint();
   */
 void printStackTrace(FILE* file, void* fingerprint);
 
+/**Writes a binary snapshot (see profiler_snapshot.h) of all results so far,
+  *including those of threads that are still running, without stopping any
+  *of them.  The file is replaced all at once; a reader never sees part of a
+  *snapshot.
+  * @param file File to write.
+  * @return Returns non-zero on success.
+  */
+sint writeSnapshot(const char* file);
+
+/**Starts a thread that writes snapshots to a file, replacing the last one.
+  *A snapshot is written every intervalMs, on requestSnapshot(), and once
+  *more when the profiler shuts down.  Only the first call has any effect.
+  * @param file File to write.
+  * @param intervalMs Milliseconds between snapshots, or 0 to only write 
+  *them on request.
+  */
+void startSnapshots(const char* file, suint intervalMs);
+
+/**Requests a snapshot from the thread started by startSnapshots().  Safe to
+  *call from a signal handler.
+  */
+void requestSnapshot();
+
+/**Turns profiling on or off for the whole process.  While it is off, no
+  *new scope is timed, on any thread.
+  */
+void setEnabled(char enabled);
+
+/** @return Returns non-zero if profiling is on for the whole process.
+  */
+char isEnabled();
+
+/**Turns profiling on or off for the calling thread only.  Has no effect 
+  *while profiling is off for the whole process.
+  */
+void setThreadEnabled(char enabled);
+
+#if PROFILER_EVENT_TRACE
+/**Writes the most recent events of every thread in Chrome's trace_event
+  *JSON format.  Events of threads that have exited are kept until their
+  *buffers are reused by new threads.
+  * @param file File to write.
+  * @return Returns non-zero on success.
+  */
+sint writeTrace(const char* file);
+#endif
+
+#if PROFILER_LOCK_CONTENTION
+/**Writes the Mutex creation sites that have been waited on the longest, as
+  *profile.locks.txt is written at exit.
+  * @param file File to write.
+  * @return Returns non-zero on success.
+  */
+sint writeLockReport(const char* file);
+#endif
+
 //--------------------------------
 //--    Internal information    --
 //--------------------------------
@@ -88,7 +277,34 @@ void printStackTrace(FILE* file, void* fingerprint);
 //Tells the profiler that the calling thread is about to be terminated.
 void terminateThread();
 
+//Non-zero while profiling is on for the whole process.  Only written by
+//setEnabled().
+extern volatile sint32 processEnabled;
+
+#if PROFILER_LOCK_CONTENTION
+//Where Mutexes were constructed, and their lock counts.
+struct LockSite;
+
+/** @return Returns the site of a Mutex being constructed on the calling
+  *thread, in its current scope, by the code at caller; or 0 if memory ran
+  *out.
+  */
+LockSite* getLockSite(void* caller);
+
+/**Counts a lock of a Mutex from site (which may be 0) against it and the 
+  *calling thread's current scope.
+  * @param waitTicks Ticks spent waiting for the lock, if contended.
+  */
+void recordLock(LockSite* site, char contended, big_suint waitTicks);
+
+/**Counts the time that a Mutex from site was hard locked for, as it is 
+  *unlocked.
+  */
+void recordLockHold(LockSite* site, big_suint holdTicks);
+#endif
+
 struct TimingInfo;
+class ProfilerManager;
 class BombLocator;
 
 /**Bomb is initialized with every PROFILER() tag, and destroyed on the 
@@ -109,26 +325,82 @@ public:
 	  * @param name Name of this section of profiled code.
 	  */
 	Bomb(void* fingerprint,
-      const char* file, suint line, const char* function, const char* name);
+      const char* file, suint line, const char* function, const char* name)
+    {
+        if (processEnabled)
+            enter_(fingerprint, file, line, function, name);
+        else
+            timingInfo_ = 0;
+    }
 
 	/**Destructor stops the timing info.
 	  */
-	~Bomb();
+	~Bomb()
+    {
+        if (timingInfo_)
+            leave_();
+    }
 
 private:
+    /**Starts timing, unless profiling is off for this thread.  Arguments as
+      *the constructor.
+      */
+    void enter_(void* fingerprint, const char* file, suint line, 
+      const char* function, const char* name);
+
+    /**Stops timing.
+      */
+    void leave_();
+
     //Current timing info for this bomb.
     TimingInfo* timingInfo_;
+
+    //ProfilerManager of the thread that this bomb is on.  Set along with
+    //timingInfo_.
+    ProfilerManager* manager_;
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED || \
+  PROFILER_EVENT_TRACE
+    //Tick count when this bomb was initialized.
+    big_suint start_;
+#endif
+
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+    //Ticks spent in bombs directly nested inside this one.
+    big_suint childTicks_;
+
+    //Bomb that this bomb is nested inside of, on this thread.
+    Bomb* parent_;
+#endif
+
+#if PROFILER_HARDWARE_COUNTERS
+    //Counter values when this bomb was initialized.
+    big_suint countersStart_[PROFILER_NUM_COUNTERS];
+#endif
 };
 
 
 
 #define PROFILER_TERMINATE_THREAD() profiler::terminateThread();
+#define PROFILER_START_SNAPSHOTS(file, intervalMs) \
+  profiler::startSnapshots(file, intervalMs);
+#define PROFILER_REQUEST_SNAPSHOT() profiler::requestSnapshot();
+#define PROFILER_ENABLE() profiler::setEnabled(1);
+#define PROFILER_DISABLE() profiler::setEnabled(0);
+#define PROFILER_ENABLE_THREAD() profiler::setThreadEnabled(1);
+#define PROFILER_DISABLE_THREAD() profiler::setThreadEnabled(0);
 } //Profiler
 
 #else //No profiling
 #define PROFILER(t)
 #define PROFILER_RESET()
 #define PROFILER_TERMINATE_THREAD()
+#define PROFILER_START_SNAPSHOTS(file, intervalMs)
+#define PROFILER_REQUEST_SNAPSHOT()
+#define PROFILER_ENABLE()
+#define PROFILER_DISABLE()
+#define PROFILER_ENABLE_THREAD()
+#define PROFILER_DISABLE_THREAD()
 #endif
 
 #endif//PROFILER_H_
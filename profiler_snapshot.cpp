@@ -0,0 +1,825 @@
+//Reading and writing of profiler snapshots.  See profiler_snapshot.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "types.h"
+#include "profiler_snapshot.h"
+
+namespace profiler
+{
+
+namespace snapshot
+{
+
+//Strings longer than this are taken to mean a corrupt snapshot.
+const suint32 SNAPSHOT_MAX_STRING = 1 << 16;
+
+//Value fields per node beyond which a snapshot is taken to be corrupt.
+const suint32 SNAPSHOT_MAX_FIELDS = 1024;
+
+static const char* fieldNames[FIELD_MAX] = {
+    0,
+    "calls",
+    "nestedCalls",
+    "runtimeMs",
+    "inclusiveNs",
+    "exclusiveNs",
+    "allocated",
+    "freed",
+    "cycles",
+    "instructions",
+    "cacheMisses",
+    "branchMisses",
+    "taskClockNs",
+    "pageFaults",
+    "contextSwitches",
+    "cpuMigrations",
+    "p50Ns",
+    "p90Ns",
+    "p99Ns",
+    "p999Ns",
+    "maxNs",
+    "allocationCount",
+    "liveBytes",
+    "peakBytes",
+    "allocsTo16",
+    "allocsTo32",
+    "allocsTo64",
+    "allocsTo128",
+    "allocsTo256",
+    "allocsTo512",
+    "allocsTo1k",
+    "allocsTo2k",
+    "allocsTo4k",
+    "allocsTo8k",
+    "allocsTo16k",
+    "allocsTo32k",
+    "allocsTo64k",
+    "allocsOver64k",
+    "locks",
+    "contendedLocks",
+    "lockWaitNs",
+    "lockMaxHoldNs",
+};
+
+
+
+const char* getFieldName(suint32 field)
+{
+    if (field == 0 || field >= FIELD_MAX)
+        return 0;
+    return fieldNames[field];
+}
+
+
+
+suint32 findField(const char* name)
+{
+    for (suint32 field = 1; field < FIELD_MAX; field++) {
+        if (strcmp(fieldNames[field], name) == 0)
+            return field;
+    }
+    return 0;
+}
+
+
+
+static void writeU32(FILE* f, suint32 value)
+{
+    unsigned char bytes[4];
+    for (sint i = 0; i < 4; i++)
+        bytes[i] = (unsigned char)(value >> (i * 8));
+    fwrite(bytes, 1, 4, f);
+}
+
+
+
+static void writeU64(FILE* f, suint64 value)
+{
+    unsigned char bytes[8];
+    for (sint i = 0; i < 8; i++)
+        bytes[i] = (unsigned char)(value >> (i * 8));
+    fwrite(bytes, 1, 8, f);
+}
+
+
+
+static void writeString(FILE* f, const char* s)
+{
+    if (!s)
+        s = "";
+    const suint32 length = (suint32)strlen(s);
+    writeU32(f, length);
+    fwrite(s, 1, length, f);
+}
+
+
+
+void writeHeader(FILE* f, suint64 time, suint32 nodeCount,
+  const suint32* fields, suint32 fieldCount)
+{
+    fwrite("SSPF", 1, 4, f);
+    writeU32(f, SNAPSHOT_VERSION);
+    writeU64(f, time);
+    writeU32(f, nodeCount);
+    writeU32(f, fieldCount);
+    for (suint32 i = 0; i < fieldCount; i++)
+        writeU32(f, fields[i]);
+}
+
+
+
+void writeNode(FILE* f, suint32 parent, suint64 fingerprint,
+  const char* name, const char* file, suint32 line, const char* function,
+  const suint64* values, suint32 fieldCount)
+{
+    writeU32(f, parent);
+    writeU64(f, fingerprint);
+    writeU32(f, line);
+    writeString(f, name);
+    writeString(f, file);
+    writeString(f, function);
+    for (suint32 i = 0; i < fieldCount; i++)
+        writeU64(f, values[i]);
+}
+
+
+
+/** @return Returns non-zero if a value was read.
+  */
+static char readU32(FILE* f, suint32* value)
+{
+    unsigned char bytes[4];
+    if (fread(bytes, 1, 4, f) != 4)
+        return 0;
+    *value = 0;
+    for (sint i = 0; i < 4; i++)
+        *value |= (suint32)bytes[i] << (i * 8);
+    return 1;
+}
+
+
+
+/** @return Returns non-zero if a value was read.
+  */
+static char readU64(FILE* f, suint64* value)
+{
+    unsigned char bytes[8];
+    if (fread(bytes, 1, 8, f) != 8)
+        return 0;
+    *value = 0;
+    for (sint i = 0; i < 8; i++)
+        *value |= (suint64)bytes[i] << (i * 8);
+    return 1;
+}
+
+
+
+/** @return Returns a malloc'd string, or 0 if one could not be read.
+  */
+static char* readString(FILE* f)
+{
+    suint32 length;
+    if (!readU32(f, &length) || length > SNAPSHOT_MAX_STRING)
+        return 0;
+    char* s = (char*)malloc(length + 1);
+    if (fread(s, 1, length, f) != length) {
+        free(s);
+        return 0;
+    }
+    s[length] = 0;
+    return s;
+}
+
+
+
+Snapshot* readSnapshot(const char* file)
+{
+    FILE* f = fopen(file, "rb");
+    if (!f)
+        return 0;
+
+    Snapshot* s = (Snapshot*)calloc(1, sizeof(Snapshot));
+    suint32* fields = 0;
+    Node** lastChild = 0;
+    char ok = 0;
+    do {
+        char magic[4];
+        suint32 version, nodeCount, fieldCount;
+        if (fread(magic, 1, 4, f) != 4 || memcmp(magic, "SSPF", 4) != 0)
+            break;
+        if (!readU32(f, &version) || version > SNAPSHOT_VERSION)
+            break;
+        if (!readU64(f, &s->time) || !readU32(f, &nodeCount) ||
+          !readU32(f, &fieldCount))
+            break;
+        if (nodeCount == 0 || fieldCount > SNAPSHOT_MAX_FIELDS)
+            break;
+
+        fields = (suint32*)malloc(sizeof(suint32) * (fieldCount + 1));
+        suint32 i;
+        for (i = 0; i < fieldCount; i++) {
+            if (!readU32(f, &fields[i]))
+                break;
+            if (getFieldName(fields[i]))
+                s->hasField[fields[i]] = 1;
+        }
+        if (i < fieldCount)
+            break;
+
+        //Nodes are allocated up front, but only counted as they are read so
+        //that a truncated file frees cleanly.
+        s->nodes = (Node*)calloc(nodeCount, sizeof(Node));
+        lastChild = (Node**)calloc(nodeCount, sizeof(Node*));
+        for (i = 0; i < nodeCount; i++) {
+            Node* node = &s->nodes[i];
+            s->nodeCount = i + 1;
+
+            suint32 parent;
+            if (!readU32(f, &parent))
+                break;
+            if (i == 0 ? parent != SNAPSHOT_NO_PARENT : parent >= i)
+                break;
+            if (!readU64(f, &node->fingerprint) || !readU32(f, &node->line))
+                break;
+            if ((node->name = readString(f)) == 0 ||
+              (node->file = readString(f)) == 0 ||
+              (node->function = readString(f)) == 0)
+                break;
+
+            suint32 j;
+            for (j = 0; j < fieldCount; j++) {
+                suint64 value;
+                if (!readU64(f, &value))
+                    break;
+                if (getFieldName(fields[j]))
+                    node->values[fields[j]] = value;
+            }
+            if (j < fieldCount)
+                break;
+
+            if (i > 0) {
+                //Keep children in the order they were written.
+                node->up = &s->nodes[parent];
+                if (lastChild[parent])
+                    lastChild[parent]->next = node;
+                else
+                    node->up->down = node;
+                lastChild[parent] = node;
+            }
+        }
+        ok = (i == nodeCount);
+    } while (0);
+
+    free(lastChild);
+    free(fields);
+    fclose(f);
+    if (!ok) {
+        freeSnapshot(s);
+        return 0;
+    }
+    return s;
+}
+
+
+
+void freeSnapshot(Snapshot* s)
+{
+    if (!s)
+        return;
+    for (suint32 i = 0; i < s->nodeCount; i++) {
+        free(s->nodes[i].name);
+        free(s->nodes[i].file);
+        free(s->nodes[i].function);
+    }
+    free(s->nodes);
+    free(s);
+}
+
+
+
+//---------------
+//    Reports
+//---------------
+
+//How a column's values are printed.
+enum ColumnKind
+{
+    COLUMN_COUNT,
+    COLUMN_NS_AS_MS,
+    COLUMN_BYTES,
+    COLUMN_LARGE_COUNT
+};
+
+struct Column
+{
+    suint32 field;
+    const char* title;
+    ColumnKind kind;
+};
+
+//Columns in the order that the profiler prints them.
+static const Column columns[] = {
+    { FIELD_RUNTIME_MS, "|Total ms", COLUMN_COUNT },
+    { FIELD_CALLS, "|   Calls", COLUMN_COUNT },
+    { FIELD_NESTED_CALLS, "|  Nested", COLUMN_COUNT },
+    { FIELD_INCLUSIVE_NS, "|   Incl ms", COLUMN_NS_AS_MS },
+    { FIELD_EXCLUSIVE_NS, "|   Excl ms", COLUMN_NS_AS_MS },
+    { FIELD_ALLOCATED, "|Allocated", COLUMN_BYTES },
+    { FIELD_FREED, "|    Freed", COLUMN_BYTES },
+    { FIELD_ALLOCATION_COUNT, "|   Allocs", COLUMN_LARGE_COUNT },
+    { FIELD_LIVE_BYTES, "|     Live", COLUMN_BYTES },
+    { FIELD_PEAK_BYTES, "|     Peak", COLUMN_BYTES },
+    { FIELD_CYCLES, "|  Cycles", COLUMN_LARGE_COUNT },
+    { FIELD_INSTRUCTIONS, "|  Instrs", COLUMN_LARGE_COUNT },
+    { FIELD_CACHE_MISSES, "|LLC Miss", COLUMN_LARGE_COUNT },
+    { FIELD_BRANCH_MISSES, "| Br Miss", COLUMN_LARGE_COUNT },
+    { FIELD_TASK_CLOCK_NS, "| Task ns", COLUMN_LARGE_COUNT },
+    { FIELD_PAGE_FAULTS, "|PgFaults", COLUMN_LARGE_COUNT },
+    { FIELD_CONTEXT_SWITCHES, "|Ctx Swch", COLUMN_LARGE_COUNT },
+    { FIELD_CPU_MIGRATIONS, "|Migrates", COLUMN_LARGE_COUNT },
+    { FIELD_P50_NS, "|    p50 ms", COLUMN_NS_AS_MS },
+    { FIELD_P90_NS, "|    p90 ms", COLUMN_NS_AS_MS },
+    { FIELD_P99_NS, "|    p99 ms", COLUMN_NS_AS_MS },
+    { FIELD_P999_NS, "|   p999 ms", COLUMN_NS_AS_MS },
+    { FIELD_MAX_NS, "|    Max ms", COLUMN_NS_AS_MS },
+    { FIELD_LOCKS, "|   Locks", COLUMN_LARGE_COUNT },
+    { FIELD_CONTENDED_LOCKS, "|  Waited", COLUMN_LARGE_COUNT },
+    { FIELD_LOCK_WAIT_NS, "|   Wait ms", COLUMN_NS_AS_MS },
+    { FIELD_LOCK_MAX_HOLD_NS, "|MaxHold ms", COLUMN_NS_AS_MS },
+};
+static const sint numColumns = sizeof(columns) / sizeof(columns[0]);
+
+
+
+static void printValue(FILE* f, const Column& column, sint64 value,
+  char signedValue)
+{
+    switch (column.kind) {
+    case COLUMN_COUNT:
+        fprintf(f, signedValue ? "|%+8lld" : "|%8lld", value);
+        break;
+    case COLUMN_NS_AS_MS:
+        fprintf(f, signedValue ? "|%+10.3f" : "|%10.3f",
+          (double)value / 1000000.0);
+        break;
+    case COLUMN_BYTES:
+        {
+            const suint64 bytes = value < 0 ? -value : value;
+            if (bytes < 1000)
+                fprintf(f, signedValue ? "|%+7lld b" : "|%7lld b", value);
+            else if ((bytes >> 10) < 1000)
+                fprintf(f, signedValue ? "|%+7.3fkb" : "|%7.3fkb",
+                  (double)value / 1024.0);
+            else if ((bytes >> 20) < 1000)
+                fprintf(f, signedValue ? "|%+7.3fmb" : "|%7.3fmb",
+                  (double)value / 1048576.0);
+            else
+                fprintf(f, signedValue ? "|%+7.3fgb" : "|%7.3fgb",
+                  (double)value / (1048576.0 * 1024.0));
+        }
+        break;
+    case COLUMN_LARGE_COUNT:
+        {
+            const suint64 count = value < 0 ? -value : value;
+            if (count < 10000000)
+                fprintf(f, signedValue ? "|%+8lld" : "|%8lld", value);
+            else if (count < 10000000000LL)
+                fprintf(f, signedValue ? "|%+7.2fM" : "|%7.2fM",
+                  (double)value / 1000000.0);
+            else
+                fprintf(f, signedValue ? "|%+7.2fG" : "|%7.2fG",
+                  (double)value / 1000000000.0);
+        }
+        break;
+    }
+}
+
+
+
+/**Crops a node's name for display the way the profiler does: a ** prefix
+  *replaces the parent's whole name, and *:: replaces shared namespaces and
+  *classes.
+  */
+static std::string cropName(const Node* node)
+{
+    const Node* up = node->up;
+    if (!up || !up->up) //The top level's name is never a prefix.
+        return node->name;
+
+    const char* upName = up->name;
+    const char* name = node->name;
+    const sint upNameLength = (sint)strlen(upName);
+    if (strncmp(upName, name, upNameLength) == 0)
+        return std::string("**") + (name + upNameLength);
+    for (sint i = upNameLength - 1; i > 0; i--) {
+        if (upName[i] == ':' && upName[i - 1] == ':') {
+            if (strncmp(upName, name, i) == 0)
+                return std::string("*:") + (name + i);
+            break;
+        }
+    }
+    return name;
+}
+
+
+
+/** @return Returns the child of before that corresponds to node, or 0.
+  */
+static const Node* findMatch(const Node* before, const Node* node)
+{
+    if (!before)
+        return 0;
+    for (const Node* t = before->down; t; t = t->next) {
+        if (t->line == node->line && strcmp(t->name, node->name) == 0 &&
+          strcmp(t->file, node->file) == 0)
+            return t;
+    }
+    return 0;
+}
+
+
+
+//A node being printed, and its counterpart in an earlier snapshot (if
+//printing a diff).
+struct Row
+{
+    const Node* node;
+    const Node* before;
+    sint64 sortKey;
+};
+
+static bool rowGreater(const Row& a, const Row& b)
+{
+    return a.sortKey > b.sortKey;
+}
+
+
+
+//State shared while printing a table.
+struct TableState
+{
+    FILE* f;
+    const Snapshot* s;
+    char diff;
+    sint maxNameLength;
+};
+
+
+
+static sint64 getValue(const TableState& state, const Row& row,
+  suint32 field)
+{
+    sint64 value = (sint64)row.node->values[field];
+    if (state.diff && row.before)
+        value -= (sint64)row.before->values[field];
+    return value;
+}
+
+
+
+/**Fills rows with the children of row, most runtime first.
+  */
+static void getChildRows(const TableState& state, const Row& row,
+  std::vector<Row>& rows)
+{
+    for (const Node* t = row.node->down; t; t = t->next) {
+        Row child;
+        child.node = t;
+        child.before = state.diff ? findMatch(row.before, t) : 0;
+        child.sortKey = getValue(state, child, FIELD_RUNTIME_MS);
+        rows.push_back(child);
+    }
+    std::stable_sort(rows.begin(), rows.end(), rowGreater);
+}
+
+
+
+/** @return Returns the width needed for the names of row and its children.
+  */
+static sint measureRows(const Node* node, sint additionalLength)
+{
+    sint ret = additionalLength + (sint)cropName(node).length();
+    for (const Node* t = node->down; t; t = t->next) {
+        sint childLength = measureRows(t, additionalLength + 2);
+        if (childLength > ret)
+            ret = childLength;
+    }
+    return ret;
+}
+
+
+
+static void printRow(TableState& state, const Row& row, sint childLevel)
+{
+    FILE* f = state.f;
+    for (sint t = 0; t < childLevel - 1; t++)
+        fprintf(f, "  ");
+    if (childLevel > 0)
+        fprintf(f, row.node->down ? "+ " : "| ");
+
+    const std::string name = cropName(row.node);
+    fwrite(name.c_str(), 1, name.length(), f);
+
+    sint spaces = state.maxNameLength - (sint)name.length() - childLevel * 2;
+    while (spaces > 1) {
+        if ((spaces & 1) == 0)
+            fprintf(f, " .");
+        else
+            fprintf(f, ". ");
+        spaces -= 2;
+    }
+    while (spaces > 0) {
+        fprintf(f, ".");
+        spaces--;
+    }
+
+    for (sint i = 0; i < numColumns; i++) {
+        if (state.s->hasField[columns[i].field]) {
+            printValue(f, columns[i], getValue(state, row, columns[i].field),
+              state.diff);
+        }
+    }
+    fprintf(f, "\n");
+
+    std::vector<Row> children;
+    getChildRows(state, row, children);
+    for (size_t i = 0; i < children.size(); i++)
+        printRow(state, children[i], childLevel + 1);
+}
+
+
+
+static void printRows(FILE* f, const Snapshot* s, const Node* before)
+{
+    TableState state;
+    state.f = f;
+    state.s = s;
+    state.diff = (before != 0);
+    state.maxNameLength = measureRows(&s->nodes[0], 2);
+
+    for (sint i = 0; i < state.maxNameLength - (sint)strlen("Function"); i++)
+        fprintf(f, " ");
+    fprintf(f, "%s", "Function");
+    for (sint i = 0; i < numColumns; i++) {
+        if (s->hasField[columns[i].field])
+            fprintf(f, "%s", columns[i].title);
+    }
+    fprintf(f, "\n");
+
+    Row root;
+    root.node = &s->nodes[0];
+    root.before = before;
+    root.sortKey = 0;
+    printRow(state, root, 0);
+}
+
+
+
+void printTable(FILE* f, Snapshot* s)
+{
+    printRows(f, s, 0);
+}
+
+
+
+void printJsonString(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        const unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+
+
+static void printJsonNode(FILE* f, const Snapshot* s, const Node* node,
+  int indent)
+{
+    fprintf(f, "%*s{\n", indent, "");
+    fprintf(f, "%*s\"name\": ", indent + 2, "");
+    printJsonString(f, node->name);
+    fprintf(f, ",\n%*s\"file\": ", indent + 2, "");
+    printJsonString(f, node->file);
+    fprintf(f, ",\n%*s\"line\": %u", indent + 2, "", node->line);
+    fprintf(f, ",\n%*s\"function\": ", indent + 2, "");
+    printJsonString(f, node->function);
+    for (suint32 i = 1; i < FIELD_MAX; i++) {
+        if (s->hasField[i]) {
+            fprintf(f, ",\n%*s\"%s\": %llu", indent + 2, "",
+              getFieldName(i), node->values[i]);
+        }
+    }
+    fprintf(f, ",\n%*s\"children\": [", indent + 2, "");
+    for (const Node* t = node->down; t; t = t->next) {
+        fprintf(f, t == node->down ? "\n" : ",\n");
+        printJsonNode(f, s, t, indent + 4);
+    }
+    if (node->down)
+        fprintf(f, "\n%*s", indent + 2, "");
+    fprintf(f, "]\n%*s}", indent, "");
+}
+
+
+
+void printJson(FILE* f, Snapshot* s)
+{
+    fprintf(f, "{\n  \"time\": %llu,\n  \"root\":\n", s->time);
+    printJsonNode(f, s, &s->nodes[0], 2);
+    fprintf(f, "\n}\n");
+}
+
+
+
+void printDiff(FILE* f, Snapshot* before, Snapshot* after)
+{
+    fprintf(f, "Change over %lld seconds\n",
+      (sint64)(after->time - before->time));
+    printRows(f, after, &before->nodes[0]);
+}
+
+
+
+/** @return Returns the exclusive time of node, in the units described by
+  *printCollapsed().
+  */
+static suint64 getCollapsedValue(const Snapshot* s, const Node* node)
+{
+    if (s->hasField[FIELD_EXCLUSIVE_NS])
+        return (node->values[FIELD_EXCLUSIVE_NS] + 500) / 1000;
+
+    suint64 children = 0;
+    for (const Node* t = node->down; t; t = t->next)
+        children += t->values[FIELD_RUNTIME_MS];
+    const suint64 runtime = node->values[FIELD_RUNTIME_MS];
+    return runtime > children ? runtime - children : 0;
+}
+
+
+
+static void printCollapsedGroup(FILE* f, const Snapshot* s, 
+  const Node* node, std::string& stack)
+{
+    for (const Node* t = node->down; t; t = t->next) {
+        const size_t length = stack.length();
+        if (length)
+            stack += ';';
+        for (const char* c = t->name; *c; c++)
+            stack += (*c == ';' ? ':' : *c);
+
+        const suint64 value = getCollapsedValue(s, t);
+        if (value)
+            fprintf(f, "%s %llu\n", stack.c_str(), value);
+        printCollapsedGroup(f, s, t, stack);
+        stack.resize(length);
+    }
+}
+
+
+
+void printCollapsed(FILE* f, Snapshot* s)
+{
+    std::string stack;
+    printCollapsedGroup(f, s, &s->nodes[0], stack);
+}
+
+
+
+/** @return Returns node's value of field, leaving out its children's if the
+  *field includes them.
+  */
+static suint64 getOwnValue(const Node* node, suint32 field)
+{
+    const suint64 value = node->values[field];
+    if (field != FIELD_ALLOCATED && field != FIELD_FREED)
+        return value;
+
+    suint64 children = 0;
+    for (const Node* t = node->down; t; t = t->next)
+        children += t->values[field];
+    return value > children ? value - children : 0;
+}
+
+
+
+//Orders nodes by their own value of a field, largest first.
+struct OwnValueGreater
+{
+    suint32 field;
+
+    bool operator()(const Node* a, const Node* b) const
+    {
+        return getOwnValue(a, field) > getOwnValue(b, field);
+    }
+};
+
+
+
+/** @return Returns a short description of the size classes most of node's
+  *allocations fall in, such as "<=64 75%, <=1k 20%".
+  */
+static std::string describeSizes(const Node* node)
+{
+    suint64 total = 0;
+    for (suint32 i = 0; i < SNAPSHOT_SIZE_CLASSES; i++)
+        total += node->values[FIELD_SIZE_CLASSES + i];
+    if (total == 0)
+        return "-";
+
+    std::string description;
+    char used[SNAPSHOT_SIZE_CLASSES] = { 0 };
+    for (sint shown = 0; shown < 2; shown++) {
+        sint best = -1;
+        for (suint32 i = 0; i < SNAPSHOT_SIZE_CLASSES; i++) {
+            const suint64 n = node->values[FIELD_SIZE_CLASSES + i];
+            if (!used[i] && n && (best < 0 || 
+              n > node->values[FIELD_SIZE_CLASSES + best]))
+                best = (sint)i;
+        }
+        if (best < 0)
+            break;
+        used[best] = 1;
+
+        char part[32];
+        const suint32 limit = 16 << best;
+        if (best == (sint)SNAPSHOT_SIZE_CLASSES - 1)
+            sprintf(part, ">%uk", (limit >> 1) >> 10);
+        else if (limit < 1024)
+            sprintf(part, "<=%u", limit);
+        else
+            sprintf(part, "<=%uk", limit >> 10);
+        if (!description.empty())
+            description += ", ";
+        description += part;
+        sprintf(part, " %u%%", (suint32)(
+          node->values[FIELD_SIZE_CLASSES + best] * 100 / total));
+        description += part;
+    }
+    return description;
+}
+
+
+
+void printTopAllocators(FILE* f, Snapshot* s, suint32 field, suint32 count)
+{
+    const char* name = getFieldName(field);
+    if (!name || !s->hasField[field]) {
+        fprintf(f, "Snapshot has no %s values\n", name ? name : "such");
+        return;
+    }
+
+    std::vector<const Node*> nodes;
+    OwnValueGreater greater;
+    greater.field = field;
+    for (suint32 i = 1; i < s->nodeCount; i++) {
+        if (getOwnValue(&s->nodes[i], field))
+            nodes.push_back(&s->nodes[i]);
+    }
+    std::stable_sort(nodes.begin(), nodes.end(), greater);
+    if (nodes.size() > count)
+        nodes.resize(count);
+
+    static const Column reportColumns[] = {
+        { FIELD_ALLOCATED, "|Allocated", COLUMN_BYTES },
+        { FIELD_ALLOCATION_COUNT, "|   Allocs", COLUMN_LARGE_COUNT },
+        { FIELD_LIVE_BYTES, "|     Live", COLUMN_BYTES },
+        { FIELD_PEAK_BYTES, "|     Peak", COLUMN_BYTES },
+    };
+    static const sint numReportColumns = 
+      sizeof(reportColumns) / sizeof(reportColumns[0]);
+
+    fprintf(f, "Top %u scopes by %s (own allocations only)\n", 
+      (suint32)nodes.size(), name);
+    for (sint i = 0; i < numReportColumns; i++)
+        fprintf(f, "%s", reportColumns[i].title);
+    fprintf(f, "| %-22s| Scope\n", "Sizes");
+    for (size_t k = 0; k < nodes.size(); k++) {
+        const Node* node = nodes[k];
+        for (sint i = 0; i < numReportColumns; i++) {
+            printValue(f, reportColumns[i], 
+              (sint64)getOwnValue(node, reportColumns[i].field), 0);
+        }
+        fprintf(f, "| %-22s| ", describeSizes(node).c_str());
+
+        std::string scope = node->name;
+        for (const Node* up = node->up; up && up->up; up = up->up)
+            scope = std::string(up->name) + " > " + scope;
+        fprintf(f, "%s (%s:%u)\n", scope.c_str(), node->file, node->line);
+    }
+}
+
+} //snapshot
+
+} //profiler
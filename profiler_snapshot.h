@@ -0,0 +1,209 @@
+//Binary snapshot format for profiler results, shared by the profiler (which
+//writes snapshots while the application runs) and the profreport tool
+//(which reads them back).
+//
+//This file and profiler_snapshot.cpp depend only on types.h, so that tools
+//may compile them without the rest of seashell.
+//
+//
+//Format (all integers little-endian):
+//  char[4]     "SSPF"
+//  suint32     version (SNAPSHOT_VERSION)
+//  suint64     time the snapshot was taken, in seconds since the epoch
+//  suint32     number of nodes
+//  suint32     number of value fields per node, F
+//  suint32[F]  field id of each value (see Field)
+//  nodes, parents before children:
+//    suint32     index of parent node, or SNAPSHOT_NO_PARENT for the root
+//    suint64     fingerprint
+//    suint32     line
+//    string      name, file, function (suint32 length, then characters)
+//    suint64[F]  values, in header order
+//
+//Readers skip fields they do not know, so new fields may be added without
+//changing the version.
+
+#ifndef PROFILER_SNAPSHOT_H_
+#define PROFILER_SNAPSHOT_H_
+
+#include <stdio.h>
+
+namespace profiler
+{
+
+namespace snapshot
+{
+
+const suint32 SNAPSHOT_VERSION = 1;
+const suint32 SNAPSHOT_NO_PARENT = 0xffffffff;
+
+//Number of allocation size classes: class i counts allocations of up to 
+//16 << i bytes, and the last counts all larger ones.
+const suint32 SNAPSHOT_SIZE_CLASSES = 14;
+
+//Identifiers of per-node values.  Never renumber these; add new fields at
+//the end.
+enum Field
+{
+    FIELD_CALLS = 1,
+    FIELD_NESTED_CALLS = 2,
+    FIELD_RUNTIME_MS = 3,
+    FIELD_INCLUSIVE_NS = 4,
+    FIELD_EXCLUSIVE_NS = 5,
+    FIELD_ALLOCATED = 6,
+    FIELD_FREED = 7,
+    FIELD_CYCLES = 8,
+    FIELD_INSTRUCTIONS = 9,
+    FIELD_CACHE_MISSES = 10,
+    FIELD_BRANCH_MISSES = 11,
+    FIELD_TASK_CLOCK_NS = 12,
+    FIELD_PAGE_FAULTS = 13,
+    FIELD_CONTEXT_SWITCHES = 14,
+    FIELD_CPU_MIGRATIONS = 15,
+    FIELD_P50_NS = 16,
+    FIELD_P90_NS = 17,
+    FIELD_P99_NS = 18,
+    FIELD_P999_NS = 19,
+    FIELD_MAX_NS = 20,
+    FIELD_ALLOCATION_COUNT = 21,
+    FIELD_LIVE_BYTES = 22,
+    FIELD_PEAK_BYTES = 23,
+    //Allocations in each size class: FIELD_SIZE_CLASSES + class.
+    FIELD_SIZE_CLASSES = 24,
+    FIELD_LOCKS = 38,
+    FIELD_CONTENDED_LOCKS = 39,
+    FIELD_LOCK_WAIT_NS = 40,
+    FIELD_LOCK_MAX_HOLD_NS = 41,
+
+    FIELD_MAX = 42
+};
+
+typedef char SizeClassFieldsFit[FIELD_SIZE_CLASSES + SNAPSHOT_SIZE_CLASSES
+  == FIELD_LOCKS ? 1 : -1];
+
+/** @return Returns a short, human readable name for a field, or 0 if the
+  *field is unknown.
+  */
+const char* getFieldName(suint32 field);
+
+/** @return Returns the field named name (see getFieldName()), or 0 if 
+  *there is none.
+  */
+suint32 findField(const char* name);
+
+
+
+//---------------
+//    Writing
+//---------------
+
+/**Writes a snapshot header.
+  * @param fields Ids of the values that follow each node, in order.
+  */
+void writeHeader(FILE* f, suint64 time, suint32 nodeCount,
+  const suint32* fields, suint32 fieldCount);
+
+/**Writes a single node.  Nodes must be written after their parents.
+  * @param values One value per field passed to writeHeader().
+  */
+void writeNode(FILE* f, suint32 parent, suint64 fingerprint,
+  const char* name, const char* file, suint32 line, const char* function,
+  const suint64* values, suint32 fieldCount);
+
+
+
+//---------------
+//    Reading
+//---------------
+
+//A node read from a snapshot.
+struct Node
+{
+    //Children
+    Node* down;
+
+    //Siblings
+    Node* next;
+
+    //Parent
+    Node* up;
+
+    suint64 fingerprint;
+    char* name;
+    char* file;
+    suint32 line;
+    char* function;
+
+    //Values, indexed by Field.  Fields not present in the snapshot are 0.
+    suint64 values[FIELD_MAX];
+};
+
+//A snapshot read back from a file.
+struct Snapshot
+{
+    //Time the snapshot was taken, in seconds since the epoch.
+    suint64 time;
+
+    //Non-zero for each Field present in the snapshot.
+    char hasField[FIELD_MAX];
+
+    //All nodes; nodes[0] is the root.
+    Node* nodes;
+    suint32 nodeCount;
+};
+
+/**Reads a snapshot.
+  * @return Returns the snapshot, or 0 if the file could not be read or is
+  *not a snapshot.  Free with freeSnapshot().
+  */
+Snapshot* readSnapshot(const char* file);
+
+/**Frees a snapshot returned by readSnapshot().
+  */
+void freeSnapshot(Snapshot* s);
+
+/**Prints a snapshot as the profiler's text table (as in profile.txt).
+  */
+void printTable(FILE* f, Snapshot* s);
+
+/**Prints a snapshot as JSON: nested objects with "name", "file", "line",
+  *"function", one member per field, and "children".
+  */
+void printJson(FILE* f, Snapshot* s);
+
+/**Prints the change from one snapshot to a later one as a text table.
+  *Nodes are matched by their path of names and source lines, so snapshots
+  *from different runs of the same program may be compared.
+  */
+void printDiff(FILE* f, Snapshot* before, Snapshot* after);
+
+/**Prints a snapshot in collapsed stack format, for flamegraph.pl and 
+  *speedscope: one "Scope;Nested Scope;... value" line per scope, where 
+  *value is the scope's exclusive time in us if the snapshot has 
+  *FIELD_EXCLUSIVE_NS, and in ms otherwise.
+  */
+void printCollapsed(FILE* f, Snapshot* s);
+
+/**Prints the scopes that allocate the most, sorted by field: one of
+  *FIELD_ALLOCATED, FIELD_FREED, FIELD_ALLOCATION_COUNT, FIELD_LIVE_BYTES,
+  *FIELD_PEAK_BYTES, or a size class.  Each scope counts only its own 
+  *allocations, not those of the scopes nested in it.
+  * @param count Most scopes printed.
+  */
+void printTopAllocators(FILE* f, Snapshot* s, suint32 field, suint32 count);
+
+
+
+//---------------
+//    Helpers
+//---------------
+
+/**Prints s as a quoted JSON string.
+  */
+void printJsonString(FILE* f, const char* s);
+
+} //snapshot
+
+} //profiler
+
+#endif//PROFILER_SNAPSHOT_H_
@@ -8,6 +8,27 @@
 namespace profiler
 {
 
+    struct LatencyHistogram;
+
+#if MMGR
+    //Number of allocation size classes counted per TimingInfo.
+    const sint ALLOCATION_SIZE_CLASSES = MMGR_SIZE_CLASSES;
+
+    /** @return Returns the size class of an allocation: i for allocations 
+      *of up to 16 << i bytes, and the last class for anything larger.
+      */
+    inline sint getAllocationSizeClass(size_t size)
+    {
+        sint sizeClass = 0;
+        size_t limit = 16;
+        while (size > limit && sizeClass < ALLOCATION_SIZE_CLASSES - 1) {
+            limit <<= 1;
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+#endif
+
 	struct TimingInfo
 	{
         //Children
@@ -19,6 +40,27 @@ namespace profiler
         //Parent
         TimingInfo* up;
 
+        //Most recently located child.  Checked before anything else, since
+        //a scope in a loop tends to re-enter the same child over and over.
+        TimingInfo* lastChild;
+
+        //Open-addressed table of children, keyed on fingerprint.  Stays
+        //null until the node has enough children that walking the sibling
+        //list is slower than hashing.
+        TimingInfo** childTable;
+
+        //Number of slots in childTable (always a power of two).
+        suint childTableSize;
+
+        //Number of children in the down list.
+        suint childCount;
+
+#if MMGR
+        //TimingInfo that this one's results were merged into, if any.  
+        //Frees of allocations made here are counted against it instead.
+        TimingInfo* mergedInto;
+#endif
+
         //Fingerprint
         void* fingerprint;
 
@@ -38,12 +80,54 @@ namespace profiler
     		
 		    //Total running time.
 		    big_suint runtime;
+#if PROFILER_TIMING_METHOD == TIMING_METHOD_INSTRUMENTED
+		    //Ticks spent in this profiler, including nested profilers.
+		    big_suint inclusive;
+
+		    //Ticks spent in this profiler, excluding nested profilers.
+		    big_suint exclusive;
+#endif
 #if MMGR
 		    //Total allocated bytes.
 		    big_suint allocations;
 
 		    //Total deallocated bytes.
 		    big_suint deallocations;
+
+		    //The rest count only allocations made directly in this 
+		    //TimingInfo, never those of its children.
+
+		    //Number of allocations.
+		    big_suint allocationCount;
+
+		    //Bytes allocated here that have not yet been freed (wherever 
+		    //they are freed).  Changed atomically.
+		    sint64 liveBytes;
+
+		    //Most that liveBytes has been.  Raised atomically.
+		    sint64 peakBytes;
+
+		    //Number of allocations in each size class (see
+		    //getAllocationSizeClass()).
+		    big_suint sizeClasses[ALLOCATION_SIZE_CLASSES];
+#endif
+#if PROFILER_LATENCY_HISTOGRAMS
+		    //Durations of outermost calls, or 0 until the first finishes.
+		    LatencyHistogram* histogram;
+#endif
+#if PROFILER_LOCK_CONTENTION
+		    //Mutex locks taken here, how many of them waited for another 
+		    //thread, and ticks spent waiting.
+		    big_suint locks;
+		    big_suint contendedLocks;
+		    big_suint lockWaitTicks;
+
+		    //Longest that a hard lock released here was held, in ticks.
+		    big_suint lockMaxHoldTicks;
+#endif
+#if PROFILER_HARDWARE_COUNTERS
+		    //Counter deltas over outermost calls (see CounterSet).
+		    big_suint counters[PROFILER_NUM_COUNTERS];
 #endif
         } result;
 
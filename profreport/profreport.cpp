@@ -0,0 +1,108 @@
+//profreport: prints profiler snapshots (see profiler_snapshot.h).
+//
+//Usage:
+//  profreport [--text] snapshot        Prints the profile.txt table.
+//  profreport --json snapshot          Prints the tree as JSON.
+//  profreport --collapsed snapshot     Prints collapsed stacks, for 
+//                                      flamegraph.pl or speedscope.
+//  profreport --diff before after      Prints what changed between two
+//                                      snapshots.
+//  profreport --top field [count] snapshot
+//                                      Prints the count (default 20) scopes
+//                                      that allocate the most, by field:
+//                                      allocated, allocationCount, 
+//                                      liveBytes, peakBytes, or a size class
+//                                      such as allocsTo256.
+//
+//Depends only on profiler_snapshot.cpp; on Linux, build with e.g.
+//  g++ -D_LINUX -Dbit64 -I.. profreport.cpp ../profiler_snapshot.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "profiler_snapshot.h"
+
+using namespace profiler::snapshot;
+
+
+
+static sint usage()
+{
+    fprintf(stderr, "Usage: profreport [--text] snapshot\n"
+      "       profreport --json snapshot\n"
+      "       profreport --collapsed snapshot\n"
+      "       profreport --diff before after\n"
+      "       profreport --top field [count] snapshot\n");
+    return 2;
+}
+
+
+
+static Snapshot* load(const char* file)
+{
+    Snapshot* s = readSnapshot(file);
+    if (!s)
+        fprintf(stderr, "profreport: %s is not a readable snapshot\n", file);
+    return s;
+}
+
+
+
+int main(int argc, char** argv)
+{
+    if (argc == 2 && argv[1][0] != '-') {
+        Snapshot* s = load(argv[1]);
+        if (!s)
+            return 1;
+        printTable(stdout, s);
+        freeSnapshot(s);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--text") == 0) {
+        Snapshot* s = load(argv[2]);
+        if (!s)
+            return 1;
+        printTable(stdout, s);
+        freeSnapshot(s);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--json") == 0) {
+        Snapshot* s = load(argv[2]);
+        if (!s)
+            return 1;
+        printJson(stdout, s);
+        freeSnapshot(s);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--collapsed") == 0) {
+        Snapshot* s = load(argv[2]);
+        if (!s)
+            return 1;
+        printCollapsed(stdout, s);
+        freeSnapshot(s);
+    }
+    else if (argc == 4 && strcmp(argv[1], "--diff") == 0) {
+        Snapshot* before = load(argv[2]);
+        Snapshot* after = load(argv[3]);
+        if (before && after)
+            printDiff(stdout, before, after);
+        freeSnapshot(before);
+        freeSnapshot(after);
+        if (!before || !after)
+            return 1;
+    }
+    else if ((argc == 4 || argc == 5) && strcmp(argv[1], "--top") == 0) {
+        const suint32 field = findField(argv[2]);
+        const sint count = (argc == 5 ? atoi(argv[3]) : 20);
+        if (!field || count <= 0)
+            return usage();
+        Snapshot* s = load(argv[argc - 1]);
+        if (!s)
+            return 1;
+        printTopAllocators(stdout, s, field, (suint32)count);
+        freeSnapshot(s);
+    }
+    else {
+        return usage();
+    }
+    return 0;
+}
@@ -68,7 +68,7 @@ public:
 
 private:
     //Mutex for locking the pool
-    seashell::Mutex mLock_;
+    seashell::SpinMutex mLock_;
 
     //Pool of resource pointers.  Most basic vector ever
     class FreeObjects {
@@ -155,7 +155,7 @@ public:
 
 private:
     //Mutex to control thread lockin    g
-    Mutex mLock_;
+    RWMutex mLock_;
 
     //List of currently free identifiers
     std::vector<suint> freeList_;
@@ -7,6 +7,8 @@
 #include "pointerchecks.h"
 //Resource pool checks
 #include "resourcepoolchecks.h"
+//Sequence lock checks
+#include "seqlockchecks.h"
 //Bitfield checks
 #include "bitfieldchecks.h"
 //Bytefield checks
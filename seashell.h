@@ -31,7 +31,13 @@
 
 //Handle defines
 #ifdef FAST
-    #define PROFILE 0
+    //Define FAST_PROFILE as well for an optimized build that may still be
+    //profiled.  Profiling then starts disabled; see profiler.h.
+    #ifdef FAST_PROFILE
+        #define PROFILE 1
+    #else
+        #define PROFILE 0
+    #endif
     #define MMGR 0
     #define TESTING TESTLEVEL_CORE
     #define ASSERTIONS 0
@@ -42,6 +48,12 @@
     #define ASSERTIONS 1
 #endif
 
+//Define SLABPOOL as 1 to serve small allocations from the size-class pool
+//(see slabpool.h), with or without MMGR.
+#ifndef SLABPOOL
+    #define SLABPOOL 0
+#endif
+
 #include <string>
 #include <vector>
 
@@ -60,6 +72,9 @@
 //Include the memory manager
 #include "mmgr.h"
 
+//Size-class pool allocator for small objects
+#include "slabpool.h"
+
 //Include the profiler
 #include "profiler.h"
 
@@ -81,9 +96,18 @@
 //Thread functions
 #include "thread.h"
 
+//Atomic operations for lock-free structures
+#include "atomic.h"
+
 //Thread mutex functions
 #include "mutex.h"
 
+//Sequence lock for small read-mostly values
+#include "seqlock.h"
+
+//Pool of worker threads for running tasks
+#include "threadpool.h"
+
 //A linear pool of resources
 #include "resourcepool.h"
 
@@ -0,0 +1,133 @@
+//Sequence lock, for small read-mostly values.
+
+#ifndef SEASHELL_SEQLOCK_H_
+#define SEASHELL_SEQLOCK_H_
+
+namespace seashell
+{
+
+//A value guarded by a sequence number.  Readers copy the value and check 
+//that the sequence number did not change while they did, retrying if it 
+//did; they never write to shared memory, so any number of readers on any
+//number of cores do not slow each other down.  Writers are serialized by a
+//SpinMutex, and make the sequence number odd while they write.
+//
+//T is copied while it may be written, so it must be plain data that is 
+//safe to copy half-written (no pointers that a writer frees), and small, 
+//since readers copy all of it on every read.  Writers should be rare; a 
+//reader spins for as long as writes keep coming.
+//
+//Usage:
+//SeqLock<Stats> stats;
+//Stats s = stats.read();
+//{
+//  SeqLock<Stats>::Writer w(stats);
+//  w->count++;
+//}
+template<typename T>
+class SeqLock
+{
+public:
+    /**A value of T(). */
+    SeqLock()
+      : sequence_(0), value_()
+    {
+    }
+
+
+
+    /**A value of value. */
+    explicit SeqLock(const T& value)
+      : sequence_(0), value_(value)
+    {
+    }
+
+
+
+    /** @return Returns a copy of the value, as some writer left it.  Waits
+      *while a write is in progress.
+      */
+    T read() const
+    {
+        T copy;
+        while (1) {
+            const sint32 before = atomic::loadAcquire(&sequence_);
+            if (before & 1) { //Being written
+                atomic::cpuRelax();
+                continue;
+            }
+            copy = value_;
+            atomic::loadBarrier();
+            if (sequence_ == before)
+                return copy;
+        }
+    }
+
+
+
+    /**Replaces the value. */
+    void write(const T& value)
+    {
+        Writer w(*this);
+        *w = value;
+    }
+
+
+
+    //Scoped writer.  Holds off other writers, and makes readers retry, 
+    //until destroyed.
+    class Writer
+    {
+    public:
+        /**Starts a write of lock. */
+        Writer(SeqLock& lock)
+          : lock_(lock)
+        {
+            lock_.writeLock_.mutexLock();
+            atomic::storeRelease(&lock_.sequence_, lock_.sequence_ + 1);
+            atomic::storeBarrier();
+        }
+
+
+
+        /**Finishes the write. */
+        ~Writer()
+        {
+            atomic::storeRelease(&lock_.sequence_, lock_.sequence_ + 1);
+            lock_.writeLock_.mutexUnlock();
+        }
+
+
+
+        /** @return Returns the value, to be changed. */
+        T& operator*()
+        {
+            return lock_.value_;
+        }
+
+
+
+        T* operator->()
+        {
+            return &lock_.value_;
+        }
+
+    private:
+        SeqLock& lock_;
+    };
+
+private:
+    friend class Writer;
+
+    //Odd while a write is in progress.  Changes with every write.
+    volatile sint32 sequence_;
+
+    //Serializes writers.
+    SpinMutex writeLock_;
+
+    T value_;
+};
+
+} //seashell
+
+#endif//SEASHELL_SEQLOCK_H_
@@ -0,0 +1,168 @@
+//Sequence lock tests
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+
+//Value whose fields are always written equal, so that a torn read shows.
+struct SeqLockCheckValue
+{
+    sint a;
+    sint b;
+    sint c;
+    sint d;
+};
+
+TEST_BUDDY(seqLockChecks)
+{
+    static seashell::SeqLock<SeqLockCheckValue> lock;
+    static volatile sint32 stop;
+    static volatile sint32 tornReads;
+    class Reader : public seashell::Thread
+    {
+    public:
+        ~Reader()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            while (!seashell::atomic::loadAcquire(&stop)) {
+                const SeqLockCheckValue v = lock.read();
+                if (v.b != v.a || v.c != v.a || v.d != v.a)
+                    seashell::atomic::add(&tornReads, 1);
+            }
+        }
+    };
+
+    SeqLockCheckValue value = { 0, 0, 0, 0 };
+    lock.write(value);
+    testAssert(lock.read().d == 0, "Did not read back written value");
+
+    stop = 0;
+    tornReads = 0;
+    {
+        Reader readers[3];
+        for (sint i = 0; i < 3; i++)
+            readers[i].startThread();
+        for (sint i = 1; i <= 20000; i++) {
+            seashell::SeqLock<SeqLockCheckValue>::Writer w(lock);
+            w->a = i;
+            w->b = i;
+            w->c = i;
+            (*w).d = i;
+            if (i % 1000 == 0)
+                timing::sleepThread(1);
+        }
+        seashell::atomic::storeRelease(&stop, (sint32)1);
+    }
+    testAssert(tornReads == 0, "%i reads saw a half-written value", 
+      (sint)tornReads);
+    testAssert(lock.read().c == 20000, "Did not read the last write");
+}
+END_TEST_BUDDY()
+
+#endif //TESTING
+
+#if TESTING >= TESTLEVEL_THOROUGH
+
+TEST_BUDDY(seqLockBenchmark)
+{
+    //Readers of a small value, behind a soft locked Mutex, behind a soft
+    //locked RWMutex and behind a SeqLock, with a writer changing it now 
+    //and then.  SeqLock readers share no writes, so their throughput 
+    //should grow with cores.
+    static seashell::Mutex mutex;
+    static SeqLockCheckValue mutexValue;
+    static seashell::RWMutex rwMutex;
+    static SeqLockCheckValue rwMutexValue;
+    static seashell::SeqLock<SeqLockCheckValue> seqLock;
+    static volatile sint32 go;
+    static volatile sint32 stop;
+    static const sint reads = 100000;
+    class Reader : public seashell::Thread
+    {
+    public:
+        //Which value to read: 0 for mutexValue, 1 for rwMutexValue, 2 for
+        //seqLock.
+        sint kind;
+
+        //Sum of the values read, so that the reads are not left out.
+        volatile sint result;
+
+        ~Reader()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            while (!seashell::atomic::loadAcquire(&go))
+                seashell::atomic::cpuRelax();
+            sint sum = 0;
+            for (sint i = 0; i < reads; i++) {
+                if (kind == 2)
+                    sum += seqLock.read().a;
+                else if (kind == 1) {
+                    SoftLockMutex(rwMutex);
+                    sum += rwMutexValue.a;
+                }
+                else {
+                    SoftLockMutex(mutex);
+                    sum += mutexValue.a;
+                }
+            }
+            result = sum;
+        }
+    };
+    class Writer : public seashell::Thread
+    {
+    public:
+        ~Writer()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            for (sint i = 0; !seashell::atomic::loadAcquire(&stop); i++) {
+                {
+                    seashell::SeqLock<SeqLockCheckValue>::Writer w(seqLock);
+                    w->a = i;
+                }
+                {
+                    LockMutex(mutex);
+                    mutexValue.a = i;
+                }
+                {
+                    LockMutex(rwMutex);
+                    rwMutexValue.a = i;
+                }
+                timing::sleepThread(1);
+            }
+        }
+    };
+
+    static const char* const names[] = { "SoftLockMutex(Mutex)", 
+      "SoftLockMutex(RWMutex)", "SeqLock" };
+    for (sint kind = 0; kind < 3; kind++) {
+        for (sint threadCount = 1; threadCount <= 64; threadCount *= 2) {
+            stop = 0;
+            Writer writer;
+            writer.startThread();
+            seashell::Thread* readers[64];
+            for (sint i = 0; i < threadCount; i++) {
+                Reader* r = new Reader;
+                r->kind = kind;
+                readers[i] = r;
+            }
+            const real64 rate = testbuddy::benchmarkThreads(readers, 
+              threadCount, &go, reads);
+            seashell::atomic::storeRelease(&stop, (sint32)1);
+            printf("%s, %i readers: %.2fM reads per second\n",
+              names[kind], threadCount, rate);
+        }
+    }
+}
+END_TEST_BUDDY()
+
+#endif //TESTING
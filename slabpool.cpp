@@ -0,0 +1,520 @@
+//Size-class pool allocator.  See slabpool.h.
+
+#ifdef _WINDOWS
+#include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+#include "seashell.h"
+
+//The pool sits beneath MMGR, so it must use the real malloc() and free().
+#include "disablemmgrmacros.h"
+
+//Bytes in a slab, and its log base 2.  Slabs are aligned to their size.
+const size_t SLABPOOL_SLAB_SIZE = 64 * 1024;
+const suint SLABPOOL_SLAB_BITS = 16;
+
+//Objects moved between a thread's list and a shared list at once.
+const suint SLABPOOL_BATCH = 32;
+
+//Most objects of one class that a thread keeps before it returns a batch.
+const suint SLABPOOL_THREAD_MAX = 2 * SLABPOOL_BATCH;
+
+//Address bits resolved by each level of the slab map; two levels cover
+//48-bit addresses.
+const suint SLABPOOL_MAP_BITS = 16;
+const suint SLABPOOL_MAP_SIZE = 1 << SLABPOOL_MAP_BITS;
+
+namespace seashell
+{
+
+namespace slabpool
+{
+    //Object size of each class: multiples of 16 up to 128, then four
+    //classes to each doubling.
+    static const suint classSizes[] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256, 320, 384, 448, 512,
+        640, 768, 896, 1024
+    };
+    static const sint numClasses =
+      sizeof(classSizes) / sizeof(classSizes[0]);
+
+    //Class of each size, indexed by (size + 15) / 16.  Constant, so that
+    //it is ready before any static constructor allocates.
+    static const unsigned char sizeToClass[SLABPOOL_MAX_SIZE / 16 + 1] = {
+        0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+        12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15,
+        16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17, 17,
+        18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19
+    };
+
+    //Map from slab to its class + 1, or 0 for memory outside of any slab.
+    //Leaves are allocated as slabs appear in their part of memory.
+    static unsigned char* volatile slabMap[SLABPOOL_MAP_SIZE];
+
+    /**Free objects of one class shared by all threads.  Only zero-
+      *initialized members, since operator new may run before any
+      *constructor.
+      */
+    struct SharedList
+    {
+        //Free objects, linked through their first word.
+        void* head;
+
+        //Number of objects in the list.
+        suint count;
+
+        //Non-zero while a thread is changing the list.
+        volatile sint32 lock;
+
+        char padding[SEASHELL_CACHE_LINE -
+          (sizeof(void*) + sizeof(suint) + sizeof(sint32))];
+    };
+    static SharedList sharedLists[numClasses];
+
+    /**A thread's own free objects, by class.
+      */
+    struct ThreadCache
+    {
+        //Free objects, linked through their first word.
+        void* heads[numClasses];
+
+        //Number of objects in each list.
+        suint counts[numClasses];
+    };
+    static SEASHELL_THREAD_LOCAL ThreadCache threadCache;
+
+
+
+    /**Takes a shared list's lock, spinning until it is free.
+      */
+    static void lockList(SharedList* list)
+    {
+        while (atomic::exchange(&list->lock, 1)) {
+            while (list->lock)
+                atomic::cpuRelax();
+        }
+    }
+
+
+
+    /**Releases a shared list's lock.
+      */
+    static void unlockList(SharedList* list)
+    {
+        atomic::storeRelease(&list->lock, (sint32)0);
+    }
+
+
+
+    /** @return Returns the class of the slab holding p, or -1 if p is not
+      *in a slab.
+      */
+    static sint getSlabClass(const void* p)
+    {
+        const voidptr slab = (voidptr)p >> SLABPOOL_SLAB_BITS;
+        unsigned char* leaf = atomic::loadAcquire(&slabMap[
+          (slab >> SLABPOOL_MAP_BITS) & (SLABPOOL_MAP_SIZE - 1)]);
+        if (!leaf)
+            return -1;
+        return (sint)leaf[slab & (SLABPOOL_MAP_SIZE - 1)] - 1;
+    }
+
+
+
+    /**Records the class of a new slab in the slab map.
+      * @return Returns zero if memory ran out.
+      */
+    static char setSlabClass(void* slab, sint sizeClass)
+    {
+        const voidptr index = (voidptr)slab >> SLABPOOL_SLAB_BITS;
+        unsigned char* volatile* root = &slabMap[
+          (index >> SLABPOOL_MAP_BITS) & (SLABPOOL_MAP_SIZE - 1)];
+        unsigned char* leaf = atomic::loadAcquire(root);
+        if (!leaf) {
+            unsigned char* fresh =
+              (unsigned char*)calloc(SLABPOOL_MAP_SIZE, 1);
+            if (!fresh)
+                return 0;
+            leaf = atomic::compareAndSwapPointer(root, (unsigned char*)0,
+              fresh);
+            if (leaf)
+                free(fresh);
+            else
+                leaf = fresh;
+        }
+        atomic::storeRelease(&leaf[index & (SLABPOOL_MAP_SIZE - 1)],
+          (unsigned char)(sizeClass + 1));
+        return 1;
+    }
+
+
+
+    /** @return Returns a new slab, aligned to its size, or 0 if memory ran
+      *out.
+      */
+    static char* allocateSlab()
+    {
+#ifdef _WINDOWS
+        //VirtualAlloc() already aligns to 64kb.
+        return (char*)VirtualAlloc(0, SLABPOOL_SLAB_SIZE,
+          MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+        void* slab;
+        if (posix_memalign(&slab, SLABPOOL_SLAB_SIZE, SLABPOOL_SLAB_SIZE))
+            return 0;
+        return (char*)slab;
+#endif
+    }
+
+
+
+    /**Frees a slab that was never used.
+      */
+    static void freeSlab(char* slab)
+    {
+#ifdef _WINDOWS
+        VirtualFree(slab, 0, MEM_RELEASE);
+#else
+        free(slab);
+#endif
+    }
+
+
+
+    /**Moves all but the first keep objects of a thread's list of a class
+      *to the shared list.  The first were freed most recently, and are the
+      *most likely to be in the cache.
+      */
+    static void releaseObjects(ThreadCache* cache, sint sizeClass,
+      suint keep)
+    {
+        const suint count = cache->counts[sizeClass] - keep;
+        if (!count)
+            return;
+        void* first = cache->heads[sizeClass];
+        if (keep) {
+            void* lastKept = first;
+            for (suint i = 1; i < keep; i++)
+                lastKept = *(void**)lastKept;
+            first = *(void**)lastKept;
+            *(void**)lastKept = 0;
+        }
+        else
+            cache->heads[sizeClass] = 0;
+        void* last = first;
+        for (suint i = 1; i < count; i++)
+            last = *(void**)last;
+        cache->counts[sizeClass] = keep;
+
+        SharedList* list = &sharedLists[sizeClass];
+        lockList(list);
+        *(void**)last = list->head;
+        list->head = first;
+        list->count += count;
+        unlockList(list);
+    }
+
+
+
+    /**Refills a thread's empty list of a class from the shared list, or
+      *else from a new slab.
+      * @return Returns one more object of the class for the caller, or 0 if
+      *memory ran out.
+      */
+    static void* refill(ThreadCache* cache, sint sizeClass)
+    {
+        SharedList* list = &sharedLists[sizeClass];
+        lockList(list);
+        void* first = list->head;
+        if (first) {
+            void* last = first;
+            suint count = 1;
+            while (count < SLABPOOL_BATCH && *(void**)last) {
+                last = *(void**)last;
+                count++;
+            }
+            list->head = *(void**)last;
+            list->count -= count;
+            unlockList(list);
+
+            *(void**)last = 0;
+            cache->heads[sizeClass] = *(void**)first;
+            cache->counts[sizeClass] = count - 1;
+            return first;
+        }
+        unlockList(list);
+
+        char* slab = allocateSlab();
+        if (!slab)
+            return 0;
+        if (!setSlabClass(slab, sizeClass)) {
+            freeSlab(slab);
+            return 0;
+        }
+
+        //The first object is the caller's, the next batch the thread's,
+        //and the rest are shared.
+        const size_t size = classSizes[sizeClass];
+        const suint objects = (suint)(SLABPOOL_SLAB_SIZE / size);
+        for (suint i = 1; i < objects; i++) {
+            *(void**)(slab + i * size) =
+              (i + 1 < objects ? slab + (i + 1) * size : 0);
+        }
+        const suint kept = (objects - 1 < SLABPOOL_BATCH ? objects - 1 :
+          SLABPOOL_BATCH);
+        cache->heads[sizeClass] = (kept ? slab + size : 0);
+        cache->counts[sizeClass] = kept;
+        if (kept < objects - 1) {
+            char* lastKept = slab + kept * size;
+            char* firstShared = lastKept + size;
+            char* lastShared = slab + (objects - 1) * size;
+            *(void**)lastKept = 0;
+
+            lockList(list);
+            *(void**)lastShared = list->head;
+            list->head = firstShared;
+            list->count += objects - 1 - kept;
+            unlockList(list);
+        }
+        return slab;
+    }
+
+
+
+    void* allocate(size_t size)
+    {
+        if (size > SLABPOOL_MAX_SIZE)
+            return malloc(size);
+
+        const sint sizeClass = sizeToClass[(size + 15) >> 4];
+        ThreadCache* cache = &threadCache;
+        void* p = cache->heads[sizeClass];
+        if (p) {
+            cache->heads[sizeClass] = *(void**)p;
+            cache->counts[sizeClass]--;
+            return p;
+        }
+        return refill(cache, sizeClass);
+    }
+
+
+
+    /**Puts an object of a size class on the thread's list.
+      */
+    static inline void freeObject(void* p, sint sizeClass)
+    {
+        ThreadCache* cache = &threadCache;
+        *(void**)p = cache->heads[sizeClass];
+        cache->heads[sizeClass] = p;
+        if (++cache->counts[sizeClass] > SLABPOOL_THREAD_MAX)
+            releaseObjects(cache, sizeClass, SLABPOOL_BATCH);
+    }
+
+
+
+    void deallocate(void* p)
+    {
+        if (!p)
+            return;
+        const sint sizeClass = getSlabClass(p);
+        if (sizeClass < 0) {
+            free(p);
+            return;
+        }
+        freeObject(p, sizeClass);
+    }
+
+
+
+    void deallocate(void* p, size_t size)
+    {
+        if (!p)
+            return;
+        if (size > SLABPOOL_MAX_SIZE) {
+            free(p);
+            return;
+        }
+        freeObject(p, sizeToClass[(size + 15) >> 4]);
+    }
+
+
+
+    size_t getClassSize(void* p)
+    {
+        const sint sizeClass = getSlabClass(p);
+        return (sizeClass < 0 ? 0 : classSizes[sizeClass]);
+    }
+
+
+
+    void releaseThreadCache()
+    {
+        ThreadCache* cache = &threadCache;
+        for (sint i = 0; i < numClasses; i++)
+            releaseObjects(cache, i, 0);
+    }
+
+} //slabpool
+
+} //seashell
+
+
+
+#if SLABPOOL && !MMGR
+//Without MMGR, the pool is the global allocator.  (MMGR takes its own
+//blocks from the pool instead; see mmgr.cpp.)
+void* operator new(size_t size)
+{
+    void* p = seashell::slabpool::allocate(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = seashell::slabpool::allocate(size);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p)
+{
+    seashell::slabpool::deallocate(p);
+}
+
+void operator delete[](void* p)
+{
+    seashell::slabpool::deallocate(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* p, size_t size)
+{
+    seashell::slabpool::deallocate(p, size);
+}
+
+void operator delete[](void* p, size_t size)
+{
+    seashell::slabpool::deallocate(p, size);
+}
+#endif
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+TEST_BUDDY(slabPoolAllocation)
+{
+    using namespace seashell;
+
+    //Every size fits, small sizes are aligned, and freed objects are
+    //reused first.
+    for (size_t size = 0; size <= slabpool::SLABPOOL_MAX_SIZE + 100;
+      size += 7) {
+        char* p = (char*)slabpool::allocate(size);
+        testAssert(p, "Could not allocate %i bytes", (sint)size);
+        memset(p, 0xab, size);
+        if (size <= slabpool::SLABPOOL_MAX_SIZE) {
+            testAssert(((voidptr)p & 15) == 0, "%i bytes allocated at a "
+              "misaligned address", (sint)size);
+            testAssert(slabpool::getClassSize(p) >= size, "%i bytes "
+              "allocated in a class of %i", (sint)size,
+              (sint)slabpool::getClassSize(p));
+        }
+        else {
+            testAssert(slabpool::getClassSize(p) == 0, "%i bytes allocated "
+              "in a size class", (sint)size);
+        }
+        slabpool::deallocate(p);
+        if (size <= slabpool::SLABPOOL_MAX_SIZE) {
+            testAssert(slabpool::allocate(size) == p, "Freed object of %i "
+              "bytes was not reused", (sint)size);
+            slabpool::deallocate(p, size);
+            testAssert(slabpool::allocate(size) == p, "Object of %i bytes "
+              "freed by size was not reused", (sint)size);
+            slabpool::deallocate(p);
+        }
+    }
+
+    //Objects allocated on one thread may be freed on another, after the
+    //first has finished.
+    static const sint count = 1000;
+    static void* objects[count];
+    class AllocThread : public seashell::Thread
+    {
+    public:
+        ~AllocThread()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            for (sint i = 0; i < count; i++) {
+                objects[i] = slabpool::allocate(48);
+                memset(objects[i], i & 0xff, 48);
+            }
+        }
+    };
+    {
+        AllocThread thread;
+        thread.startThread();
+    }
+    for (sint i = 0; i < count; i++) {
+        testAssert(((unsigned char*)objects[i])[47] == (i & 0xff),
+          "Object %i was overwritten", i);
+        slabpool::deallocate(objects[i]);
+    }
+}
+END_TEST_BUDDY()
+#endif
+
+
+
+#if TESTING >= TESTLEVEL_THOROUGH
+TEST_BUDDY(slabPoolBenchmark)
+{
+    //Small-object churn, as from std::vector and std::string: a window of
+    //live objects of mixed sizes, one replaced at a time.
+    static const sint live = 1024;
+    static const sint operations = 4000000;
+    static void* objects[live];
+    const real64 nsPerTick = 1000000000.0 / timing::getTicksPerSecond();
+    for (sint pass = 0; pass < 2; pass++) {
+        suint32 random = 12345;
+        memset(objects, 0, sizeof(objects));
+        big_suint start = timing::getTicks();
+        for (sint i = 0; i < operations; i++) {
+            random = random * 1664525 + 1013904223;
+            const sint slot = (random >> 8) & (live - 1);
+            const size_t size = 8 + ((random >> 20) & 255);
+            if (pass == 0) {
+                free(objects[slot]);
+                objects[slot] = malloc(size);
+            }
+            else {
+                seashell::slabpool::deallocate(objects[slot]);
+                objects[slot] = seashell::slabpool::allocate(size);
+            }
+        }
+        const real64 ns = (timing::getTicks() - start) * nsPerTick /
+          operations;
+        for (sint i = 0; i < live; i++) {
+            if (pass == 0)
+                free(objects[i]);
+            else
+                seashell::slabpool::deallocate(objects[i]);
+        }
+        printf("%s: %.1f ns per free and allocation\n",
+          pass == 0 ? "malloc" : "slabpool", ns);
+    }
+}
+END_TEST_BUDDY()
+#endif
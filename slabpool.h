@@ -0,0 +1,58 @@
+//Size-class pool allocator for small objects.
+//
+//Allocations of up to SLABPOOL_MAX_SIZE bytes are rounded up to one of a
+//few size classes and served from per-thread free lists, which are refilled
+//from (and spill back to) a shared list per class in batches.  Objects are
+//carved out of 64kb slabs, each holding objects of one class; a map from
+//slab to class finds an object's class when it is freed, so objects carry
+//no header.  Larger allocations go to malloc().
+//
+//Slabs are never given back to the system.  A thread's cached objects are
+//returned to the shared lists when a seashell::Thread finishes; other
+//threads should call releaseThreadCache() before they exit.
+//
+//With SLABPOOL defined to 1 (see seashell.h), global operator new and
+//delete use the pool: directly without MMGR, and for MMGR's own blocks
+//with it.
+
+#ifndef SEASHELL_SLABPOOL_H_
+#define SEASHELL_SLABPOOL_H_
+
+namespace seashell
+{
+
+namespace slabpool
+{
+
+//Largest allocation served from a size class.
+const size_t SLABPOOL_MAX_SIZE = 1024;
+
+/** @return Returns at least size bytes, aligned to 16 bytes, or 0 if
+  *memory ran out.
+  */
+void* allocate(size_t size);
+
+/**Frees memory from allocate().  Any thread may free memory allocated by
+  *any other.  Does nothing if p is 0.
+  */
+void deallocate(void* p);
+
+/**Frees memory from allocate(size), without looking up its size class.
+  */
+void deallocate(void* p, size_t size);
+
+/** @return Returns the bytes usable at p, from allocate(), if it is in a
+  *size class; otherwise 0.
+  */
+size_t getClassSize(void* p);
+
+/**Returns the calling thread's cached objects to the shared lists.  The
+  *thread may keep allocating afterwards.
+  */
+void releaseThreadCache();
+
+} //slabpool
+
+} //seashell
+
+#endif//SEASHELL_SLABPOOL_H_
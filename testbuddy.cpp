@@ -206,6 +206,27 @@ void testInstance::runTest(const char* name)
         printf("\n");
 }
 
+
+
+#if TESTING >= TESTLEVEL_THOROUGH
+real64 benchmarkThreads(seashell::Thread** threads, sint threadCount, 
+  volatile sint32* go, sint operations)
+{
+    *go = 0;
+    for (sint i = 0; i < threadCount; i++)
+        threads[i]->startThread();
+    timing::sleepThread(50);
+
+    const big_suint start = timing::getTicks();
+    seashell::atomic::storeRelease(go, (sint32)1);
+    for (sint i = 0; i < threadCount; i++)
+        delete threads[i]; //Joins it.
+    const real64 ms = (timing::getTicks() - start) * 1000.0 / 
+      timing::getTicksPerSecond();
+    return threadCount * operations / ms / 1000.0;
+}
+#endif
+
 } //testbuddy
 
 #endif
@@ -25,6 +25,11 @@
 
 #if TESTING
 
+namespace seashell
+{
+    class Thread;
+}
+
 namespace testbuddy
 {
 
@@ -32,6 +37,20 @@ namespace testbuddy
   */
 void runTests();
 
+#if TESTING >= TESTLEVEL_THOROUGH
+/**Times threads doing the same work at once, for benchmarks.  Starts each
+  *of threads, whose run() must spin until *go is non-zero before doing its
+  *operations, gives them time to reach that point, then releases them all
+  *together.  The threads are joined and deleted.
+  * @param threads Threads from new, threadCount of them.
+  * @param go Flag the threads wait on.  Cleared before they start.
+  * @param operations Number of operations each thread does.
+  * @return Returns millions of operations per second, over all threads.
+  */
+real64 benchmarkThreads(seashell::Thread** threads, sint threadCount, 
+  volatile sint32* go, sint operations);
+#endif
+
 class testInstance
 {
 	static char success;
@@ -110,6 +110,7 @@ void Thread::queryExit()
     //Have we been requested to terminate?
     if (thread_current_->state_ == THREAD_TERMINATE_REQUEST) {
         PROFILER_TERMINATE_THREAD();
+        slabpool::releaseThreadCache();
         thread_current_->state_ = THREAD_FINISHED;
 #if defined(_WINDOWS)
         ExitThread(0);
@@ -237,9 +238,11 @@ void Thread_Help::runThread()
             state_ = THREAD_FAILURE;
         }
         PROFILER_TERMINATE_THREAD();
+        slabpool::releaseThreadCache();
         throw;
     }
     PROFILER_TERMINATE_THREAD();
+    slabpool::releaseThreadCache();
 }
 
 } //seashell
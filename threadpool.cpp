@@ -0,0 +1,682 @@
+//Fixed-size pool of worker threads.  See threadpool.h.
+
+#ifdef _WINDOWS
+#include <windows.h>
+#elif defined(_LINUX)
+#include <errno.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "seashell.h"
+
+//Tasks that a worker's deque holds at first.  A power of two; deques 
+//double when they fill.
+const sint32 THREADPOOL_DEQUE_CAPACITY = 256;
+
+//Times that an idle thread looks for work, pausing in between, before a
+//worker sleeps or a waiting thread starts to yield.
+const sint THREADPOOL_SPINS = 64;
+
+namespace seashell
+{
+
+//Deque indices only grow, and wrap around; they are compared by their
+//difference, so that wrapping does not matter.
+
+/** @return Returns index + amount, wrapping around. */
+static inline sint32 advanceIndex(sint32 index, sint32 amount)
+{
+    return (sint32)((suint32)index + (suint32)amount);
+}
+
+
+
+/** @return Returns to - from, for indices that may have wrapped around. */
+static inline sint32 indexDistance(sint32 from, sint32 to)
+{
+    return (sint32)((suint32)to - (suint32)from);
+}
+
+
+
+//Chase-Lev work-stealing deque of tasks.  Only the owner pushes and pops,
+//at the bottom; any thread may steal from the top.  When full, a bigger 
+//array replaces the old, which is kept until the deque is destroyed, since
+//thieves may still be reading it.
+class WorkDeque
+{
+public:
+    WorkDeque()
+      : top_(0), bottom_(0), retired_(0)
+    {
+        array_ = newArray_(THREADPOOL_DEQUE_CAPACITY);
+    }
+
+
+
+    ~WorkDeque()
+    {
+        free(array_);
+        while (retired_) {
+            Array* next = retired_->retired;
+            free(retired_);
+            retired_ = next;
+        }
+    }
+
+
+
+    /**Adds task at the bottom.  Owner only.
+      * @return Returns non-zero on success, or 0 if memory ran out.
+      */
+    char push(Task* task)
+    {
+        const sint32 bottom = bottom_;
+        const sint32 top = atomic::loadAcquire(&top_);
+        Array* array = array_;
+        if (!array || indexDistance(top, bottom) >= array->capacity) {
+            array = grow_(top, bottom);
+            if (!array)
+                return 0;
+        }
+        array->tasks[bottom & (array->capacity - 1)] = task;
+        atomic::storeRelease(&bottom_, advanceIndex(bottom, 1));
+        return 1;
+    }
+
+
+
+    /**Takes the newest task, from the bottom.  Owner only.
+      * @return Returns the task, or 0 if the deque is empty.
+      */
+    Task* pop()
+    {
+        const sint32 bottom = advanceIndex(bottom_, -1);
+        Array* array = array_;
+        //A full barrier, so that thieves see the new bottom before we read
+        //top.
+        atomic::exchange(&bottom_, bottom);
+        const sint32 top = top_;
+        const sint32 size = indexDistance(top, bottom);
+        if (size < 0) { //Empty
+            atomic::storeRelease(&bottom_, top);
+            return 0;
+        }
+
+        Task* task = array->tasks[bottom & (array->capacity - 1)];
+        if (size > 0)
+            return task;
+
+        //The last task; a thief may be taking it as well.
+        if (atomic::compareAndSwap(&top_, top, advanceIndex(top, 1)) != top)
+            task = 0;
+        atomic::storeRelease(&bottom_, advanceIndex(top, 1));
+        return task;
+    }
+
+
+
+    /**Takes the oldest task, from the top.  Any thread.
+      * @return Returns the task, or 0 if the deque is empty or another 
+      *thread took it first.
+      */
+    Task* steal()
+    {
+        const sint32 top = atomic::loadAcquire(&top_);
+        atomic::memoryBarrier();
+        const sint32 bottom = atomic::loadAcquire(&bottom_);
+        if (indexDistance(top, bottom) <= 0)
+            return 0;
+
+        Array* array = atomic::loadAcquire(&array_);
+        Task* task = array->tasks[top & (array->capacity - 1)];
+        if (atomic::compareAndSwap(&top_, top, advanceIndex(top, 1)) != top)
+            return 0;
+        return task;
+    }
+
+
+
+    /** @return Returns non-zero if the deque seems to hold a task. */
+    char hasTasks() const
+    {
+        return indexDistance(top_, bottom_) > 0;
+    }
+
+private:
+    struct Array
+    {
+        //Number of tasks; a power of two.
+        sint32 capacity;
+
+        //Next older array, once this one is replaced.
+        Array* retired;
+
+        Task* tasks[1];
+    };
+
+
+
+    /** @return Returns a new array of capacity tasks, or 0. */
+    static Array* newArray_(sint32 capacity)
+    {
+        Array* array = (Array*)malloc(sizeof(Array) + 
+          (capacity - 1) * sizeof(Task*));
+        if (array) {
+            array->capacity = capacity;
+            array->retired = 0;
+        }
+        return array;
+    }
+
+
+
+    /**Replaces the array with one twice the size, holding the same tasks.
+      * @return Returns the new array, or 0 if memory ran out.
+      */
+    Array* grow_(sint32 top, sint32 bottom)
+    {
+        Array* old = array_;
+        Array* array = newArray_(old ? old->capacity * 2 : 
+          THREADPOOL_DEQUE_CAPACITY);
+        if (!array)
+            return 0;
+        if (old) {
+            for (sint32 i = top; i != bottom; i = advanceIndex(i, 1)) {
+                array->tasks[i & (array->capacity - 1)] = 
+                  old->tasks[i & (old->capacity - 1)];
+            }
+            old->retired = retired_;
+            retired_ = old;
+        }
+        atomic::storeRelease(&array_, array);
+        return array;
+    }
+
+    //Index of the oldest task, and one past the newest.
+    volatile sint32 top_;
+    volatile sint32 bottom_;
+
+    Array* volatile array_;
+
+    //Arrays that have been replaced, newest first.
+    Array* retired_;
+};
+
+
+
+class ThreadPoolWorker : public Thread
+{
+public:
+    ThreadPoolWorker()
+      : pool(0), nextVictim(0)
+    {
+    }
+
+
+
+    ~ThreadPoolWorker()
+    {
+        stopThread();
+    }
+
+
+
+    void run();
+
+    //Pool that this worker belongs to.
+    ThreadPool* pool;
+
+    //This worker's tasks.
+    WorkDeque deque;
+
+    //Worker that this one tries to steal from first, next time.
+    sint nextVictim;
+
+private:
+    //Keeps workers, which thieves read, off each other's cache lines.
+    char padding_[SEASHELL_CACHE_LINE];
+};
+
+//Worker that the calling thread is, or 0.
+static SEASHELL_THREAD_LOCAL ThreadPoolWorker* currentWorker = 0;
+
+
+
+void ThreadPoolWorker::run()
+{
+    currentWorker = this;
+    sint idle = 0;
+    while (1) {
+        Task* task = pool->findTask_(this);
+        if (task) {
+            pool->runTask_(task);
+            idle = 0;
+            continue;
+        }
+
+        if (atomic::loadAcquire(&pool->stopping_) && !pool->hasWork_())
+            break;
+        if (++idle < THREADPOOL_SPINS)
+            atomic::cpuRelax();
+        else {
+            pool->sleepWorker_();
+            idle = 0;
+        }
+    }
+    currentWorker = 0;
+}
+
+
+
+ThreadPool::ThreadPool()
+{
+    start_(systeminfo::getActiveProcessors());
+}
+
+
+
+ThreadPool::ThreadPool(sint workerCount)
+{
+    start_(workerCount);
+}
+
+
+
+ThreadPool::~ThreadPool()
+{
+    atomic::storeRelease(&stopping_, (sint32)1);
+    atomic::memoryBarrier();
+
+    //Enough wakeups for every worker, asleep or not.
+    for (sint i = 0; i < workerCount_; i++) {
+#ifdef _WINDOWS
+        ReleaseSemaphore(wakeups_, 1, 0);
+#elif defined(_LINUX)
+        sem_post(&wakeups_);
+#endif
+    }
+    //Join every worker before destroying any: those still running may
+    //steal from, or look for work in, the deques of the others.
+    for (sint i = 0; i < workerCount_; i++)
+        workers_[i].stopThread();
+    delete[] workers_;
+
+#ifdef _WINDOWS
+    CloseHandle(wakeups_);
+#elif defined(_LINUX)
+    sem_destroy(&wakeups_);
+#endif
+}
+
+
+
+void ThreadPool::submit(Task& task)
+{
+    submit_(task, 0);
+}
+
+
+
+void ThreadPool::wait(Task& task)
+{
+    helpUntil_(&task.done_, 1);
+}
+
+
+
+void ThreadPool::start_(sint workerCount)
+{
+    if (workerCount < 1)
+        workerCount = 1;
+    workerCount_ = workerCount;
+    queueHead_ = 0;
+    queueTail_ = 0;
+    sleepers_ = 0;
+    stopping_ = 0;
+#ifdef _WINDOWS
+    wakeups_ = CreateSemaphore(0, 0, 0x7fffffff, 0);
+#elif defined(_LINUX)
+    sem_init(&wakeups_, 0, 0);
+#endif
+
+    workers_ = new ThreadPoolWorker[workerCount];
+    for (sint i = 0; i < workerCount; i++) {
+        workers_[i].pool = this;
+        workers_[i].nextVictim = i + 1;
+    }
+    for (sint i = 0; i < workerCount; i++)
+        workers_[i].startThread();
+}
+
+
+
+void ThreadPool::submit_(Task& task, TaskGroup* group)
+{
+    task.group_ = group;
+    task.done_ = 0;
+    if (group)
+        atomic::add(&group->pending_, 1);
+
+    ThreadPoolWorker* self = currentWorker;
+    if (self && self->pool == this) {
+        if (!self->deque.push(&task)) {
+            //Out of memory; do it now instead.
+            runTask_(&task);
+            return;
+        }
+    }
+    else {
+        LockMutex(queueLock_);
+        task.next_ = 0;
+        if (queueTail_)
+            queueTail_->next_ = &task;
+        else
+            queueHead_ = &task;
+        queueTail_ = &task;
+    }
+
+    //Either the task is seen by a worker about to sleep, or the worker is
+    //seen in sleepers_.
+    atomic::memoryBarrier();
+    wakeWorker_();
+}
+
+
+
+Task* ThreadPool::findTask_(ThreadPoolWorker* self)
+{
+    if (self) {
+        Task* task = self->deque.pop();
+        if (task)
+            return task;
+    }
+
+    if (queueHead_) {
+        LockMutex(queueLock_);
+        Task* task = queueHead_;
+        if (task) {
+            queueHead_ = task->next_;
+            if (!queueHead_)
+                queueTail_ = 0;
+            return task;
+        }
+    }
+
+    //Steal, starting from a different worker each time, so that thieves 
+    //spread out over their victims.
+    sint victim = 0;
+    if (self)
+        victim = self->nextVictim++;
+    for (sint i = 0; i < workerCount_; i++) {
+        ThreadPoolWorker* worker = &workers_[(victim + i) % workerCount_];
+        if (worker == self)
+            continue;
+        Task* task = worker->deque.steal();
+        if (task)
+            return task;
+    }
+    return 0;
+}
+
+
+
+void ThreadPool::runTask_(Task* task)
+{
+    //Once the task is done, its owner may free it, and once the group's 
+    //count reaches 0, the group; neither is touched after.
+    TaskGroup* group = task->group_;
+    try {
+        task->run();
+    }
+    catch (const Exception& e) {
+        elog(e);
+    }
+    atomic::storeRelease(&task->done_, (sint32)1);
+    if (group)
+        atomic::add(&group->pending_, -1);
+}
+
+
+
+void ThreadPool::helpUntil_(const volatile sint32* value, sint32 target)
+{
+    ThreadPoolWorker* self = currentWorker;
+    if (self && self->pool != this)
+        self = 0;
+
+    //Waiting threads yield rather than sleep, so that they see at once when
+    //the last task finishes.
+    sint idle = 0;
+    while (atomic::loadAcquire(value) != target) {
+        Task* task = findTask_(self);
+        if (task) {
+            runTask_(task);
+            idle = 0;
+        }
+        else if (++idle < THREADPOOL_SPINS)
+            atomic::cpuRelax();
+        else
+            timing::sleepThread(0);
+    }
+}
+
+
+
+char ThreadPool::hasWork_()
+{
+    if (queueHead_)
+        return 1;
+    for (sint i = 0; i < workerCount_; i++) {
+        if (workers_[i].deque.hasTasks())
+            return 1;
+    }
+    return 0;
+}
+
+
+
+void ThreadPool::wakeWorker_()
+{
+    //Each sleeper taken off the count is owed exactly one wakeup.
+    sint32 sleepers = sleepers_;
+    while (sleepers > 0) {
+        const sint32 seen = atomic::compareAndSwap(&sleepers_, sleepers,
+          sleepers - 1);
+        if (seen == sleepers) {
+#ifdef _WINDOWS
+            ReleaseSemaphore(wakeups_, 1, 0);
+#elif defined(_LINUX)
+            sem_post(&wakeups_);
+#endif
+            return;
+        }
+        sleepers = seen;
+    }
+}
+
+
+
+void ThreadPool::sleepWorker_()
+{
+    //Counted before looking for work one last time; see submit_().
+    atomic::add(&sleepers_, 1);
+    if (hasWork_() || atomic::loadAcquire(&stopping_)) {
+        //Take ourselves back off the count, unless a waker already has, in
+        //which case its wakeup is ours to take.
+        sint32 sleepers = sleepers_;
+        while (sleepers > 0) {
+            const sint32 seen = atomic::compareAndSwap(&sleepers_, sleepers,
+              sleepers - 1);
+            if (seen == sleepers)
+                return;
+            sleepers = seen;
+        }
+    }
+
+#ifdef _WINDOWS
+    WaitForSingleObject(wakeups_, INFINITE);
+#elif defined(_LINUX)
+    while (sem_wait(&wakeups_) != 0 && errno == EINTR);
+#endif
+}
+
+
+
+#if TESTING >= TESTLEVEL_IMPORTANT
+//Adds one to the sint32 at param.
+static void threadPoolTestCount(void* param)
+{
+    atomic::add((volatile sint32*)param, 1);
+}
+
+
+
+//Sums the numbers in [first, last), splitting the range into two tasks
+//until it is small, so that tasks submit and wait on tasks of their own.
+class ThreadPoolTestSum : public Task
+{
+public:
+    ThreadPoolTestSum(ThreadPool& pool, sint64 first, sint64 last)
+      : sum(0), pool_(pool), first_(first), last_(last)
+    {
+    }
+
+    void run()
+    {
+        if (last_ - first_ <= 1000) {
+            for (sint64 i = first_; i < last_; i++)
+                sum += i;
+            return;
+        }
+
+        const sint64 middle = first_ + (last_ - first_) / 2;
+        ThreadPoolTestSum low(pool_, first_, middle);
+        ThreadPoolTestSum high(pool_, middle, last_);
+        {
+            TaskGroup group(pool_);
+            group.run(low);
+            group.run(high);
+        }
+        sum = low.sum + high.sum;
+    }
+
+    sint64 sum;
+
+private:
+    ThreadPool& pool_;
+    sint64 first_;
+    sint64 last_;
+};
+
+
+
+TEST_BUDDY(threadPoolTasks)
+{
+    ThreadPool pool(4);
+    testAssert(pool.getWorkerCount() == 4, "Pool has %i workers; expected "
+      "4", pool.getWorkerCount());
+
+    //Many small tasks from outside of the pool, each run once.
+    volatile sint32 count = 0;
+    const sint taskCount = 10000;
+    std::vector<FunctionTask> tasks(taskCount, 
+      FunctionTask(threadPoolTestCount, (void*)&count));
+    {
+        TaskGroup group(pool);
+        for (sint i = 0; i < taskCount; i++)
+            group.run(tasks[i]);
+    }
+    testAssert(count == taskCount, "Ran %i tasks; expected %i", 
+      (sint)count, taskCount);
+    testAssert(tasks[taskCount - 1].isDone(), "Task not done after its "
+      "group");
+
+    //A task waited on as a future, which runs tasks of its own.
+    ThreadPoolTestSum sum(pool, 0, 1000000);
+    pool.submit(sum);
+    pool.wait(sum);
+    testAssert(sum.isDone() && sum.sum == (sint64)999999 * 1000000 / 2, 
+      "Summed to %lld", (long long)sum.sum);
+
+    //Tasks left queued run before the pool is gone.
+    count = 0;
+    {
+        ThreadPool shortPool(2);
+        for (sint i = 0; i < 1000; i++)
+            shortPool.submit(tasks[i]);
+    }
+    testAssert(count == 1000, "Ran %i tasks before destruction; expected "
+      "1000", (sint)count);
+
+    const sint processors = systeminfo::getActiveProcessors();
+    ThreadPool defaultPool;
+    testAssert(defaultPool.getWorkerCount() == 
+      (processors > 0 ? processors : 1), "Default pool has %i workers, "
+      "with %i processors", defaultPool.getWorkerCount(), processors);
+}
+END_TEST_BUDDY()
+#endif //TESTING
+
+
+
+#if TESTING >= TESTLEVEL_THOROUGH
+TEST_BUDDY(threadPoolBenchmark)
+{
+    //Short jobs, each on a thread of its own, and through a pool.
+    static volatile sint32 count;
+    class JobThread : public Thread
+    {
+    public:
+        ~JobThread()
+        {
+            stopThread();
+        }
+
+        void run()
+        {
+            atomic::add(&count, 1);
+        }
+    };
+
+    const sint jobs = 2000;
+    const real64 usPerTick = 1000000.0 / timing::getTicksPerSecond();
+    big_suint start = timing::getTicks();
+    for (sint i = 0; i < jobs; i++) {
+        JobThread job;
+        job.startThread();
+    }
+    const real64 threadUs = (timing::getTicks() - start) * usPerTick;
+
+    ThreadPool pool;
+    FunctionTask task(threadPoolTestCount, (void*)&count);
+    start = timing::getTicks();
+    for (sint i = 0; i < jobs; i++) {
+        pool.submit(task);
+        pool.wait(task);
+    }
+    const real64 poolUs = (timing::getTicks() - start) * usPerTick;
+
+    std::vector<FunctionTask> tasks(jobs, task);
+    start = timing::getTicks();
+    {
+        TaskGroup group(pool);
+        for (sint i = 0; i < jobs; i++)
+            group.run(tasks[i]);
+    }
+    const real64 groupUs = (timing::getTicks() - start) * usPerTick;
+
+    testAssert(count == jobs * 3, "Ran %i jobs; expected %i", (sint)count,
+      jobs * 3);
+    printf("Thread per job: %.2f us per job\n", threadUs / jobs);
+    printf("ThreadPool (%i workers), one job at a time: %.2f us per job\n",
+      pool.getWorkerCount(), poolUs / jobs);
+    printf("ThreadPool (%i workers), jobs in a group: %.2f us per job\n",
+      pool.getWorkerCount(), groupUs / jobs);
+}
+END_TEST_BUDDY()
+#endif
+
+} //seashell
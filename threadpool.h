@@ -0,0 +1,231 @@
+//Fixed-size pool of worker threads that run Tasks.
+//
+//Each worker keeps its own deque of tasks (a Chase-Lev work-stealing 
+//deque): tasks submitted from a worker go on the bottom of its deque, it
+//runs its newest tasks first, and idle workers steal the oldest from the
+//top of others'.  Tasks submitted from other threads go on a shared queue.
+//Idle workers spin briefly, then sleep on a semaphore until work comes.
+//
+//Tasks are not copied or allocated by the pool: the caller owns each Task
+//and must keep it alive until it has run.  A Task may be waited on by 
+//itself, as a future, or through a TaskGroup.  Waiting threads run other
+//tasks while they wait, so tasks may wait on the tasks that they submit.
+//
+//Usage:
+//ThreadPool pool;
+//FunctionTask a(doSomething, &data1), b(doSomething, &data2);
+//{
+//  TaskGroup group(pool);
+//  group.run(a);
+//  group.run(b);
+//} //Both have run.
+
+#ifndef SEASHELL_THREADPOOL_H_
+#define SEASHELL_THREADPOOL_H_
+
+#ifdef _WINDOWS
+#include <windows.h>
+#elif defined(_LINUX)
+#include <semaphore.h>
+#endif
+
+namespace seashell
+{
+
+class TaskGroup;
+class ThreadPool;
+class ThreadPoolWorker;
+
+//Work for a ThreadPool.  Derive from it and implement run().  A Task may 
+//be submitted again once it has run.
+class Task
+{
+    friend class TaskGroup;
+    friend class ThreadPool;
+
+public:
+    Task()
+      : next_(0), group_(0), done_(1)
+    {
+    }
+
+    virtual ~Task()
+    {
+    }
+
+    /**Does the task's work, on a pool thread or on a thread that waits.
+      *Exceptions other than Exception are not caught.
+      */
+    virtual void run() = 0;
+
+    /** @return Returns non-zero if the task has run since it was last
+      *submitted, or was never submitted.
+      */
+    char isDone() const
+    {
+        return atomic::loadAcquire(&done_) != 0;
+    }
+
+private:
+    //Next task in the pool's shared queue.
+    Task* next_;
+
+    //Group that the task was submitted through, if any.
+    TaskGroup* group_;
+
+    //Non-zero once the task has run.
+    volatile sint32 done_;
+};
+
+
+
+//Task that calls a function.
+class FunctionTask : public Task
+{
+public:
+    /**A task that calls function(param). */
+    FunctionTask(void (*function)(void*), void* param)
+      : function_(function), param_(param)
+    {
+    }
+
+    void run()
+    {
+        function_(param_);
+    }
+
+private:
+    void (*function_)(void*);
+    void* param_;
+};
+
+
+
+class ThreadPool
+{
+    friend class TaskGroup;
+    friend class ThreadPoolWorker;
+
+public:
+    /**Starts one worker per active processor. */
+    ThreadPool();
+
+    /**Starts workerCount workers (at least one). */
+    explicit ThreadPool(sint workerCount);
+
+    /**Runs every task already submitted, then stops the workers. */
+    ~ThreadPool();
+
+    /** @return Returns the number of worker threads. */
+    sint getWorkerCount() const
+    {
+        return workerCount_;
+    }
+
+    /**Queues a task to be run.  Does not allocate.
+      */
+    void submit(Task& task);
+
+    /**Returns once task has run, running other tasks meanwhile.
+      */
+    void wait(Task& task);
+
+private:
+    /**Starts the workers. */
+    void start_(sint workerCount);
+
+    /**Queues task, which is counted in group (if not 0). */
+    void submit_(Task& task, TaskGroup* group);
+
+    /** @return Returns a task to run, or 0 if none was found.
+      * @param self Calling worker, or 0 if called from another thread.
+      */
+    Task* findTask_(ThreadPoolWorker* self);
+
+    /**Runs task and marks it done. */
+    void runTask_(Task* task);
+
+    /**Runs tasks until *value equals target.
+      */
+    void helpUntil_(const volatile sint32* value, sint32 target);
+
+    /** @return Returns non-zero if any task is waiting to be run. */
+    char hasWork_();
+
+    /**Wakes a sleeping worker, if there is one. */
+    void wakeWorker_();
+
+    /**Puts the calling worker to sleep until wakeWorker_(), unless there is
+      *work.
+      */
+    void sleepWorker_();
+
+    //Workers, and how many.
+    ThreadPoolWorker* workers_;
+    sint workerCount_;
+
+    //Tasks submitted from other threads, oldest first.  queueHead_ may be
+    //read without the lock, to check for work.
+    SpinMutex queueLock_;
+    Task* volatile queueHead_;
+    Task* queueTail_;
+
+    //Number of workers asleep or about to be, and the semaphore they sleep
+    //on.
+    volatile sint32 sleepers_;
+#ifdef _WINDOWS
+    HANDLE wakeups_;
+#elif defined(_LINUX)
+    sem_t wakeups_;
+#endif
+
+    //Non-zero once the pool is being destroyed.
+    volatile sint32 stopping_;
+};
+
+
+
+//Set of tasks that may be waited on together.  Waits for its tasks when
+//destroyed.
+class TaskGroup
+{
+    friend class ThreadPool;
+
+public:
+    /**An empty group, on pool. */
+    explicit TaskGroup(ThreadPool& pool)
+      : pool_(pool), pending_(0)
+    {
+    }
+
+    /**Waits for the group's tasks. */
+    ~TaskGroup()
+    {
+        wait();
+    }
+
+    /**Submits task to the group's pool, as part of the group.
+      */
+    void run(Task& task)
+    {
+        pool_.submit_(task, this);
+    }
+
+    /**Returns once every task run through this group has run, running other
+      *tasks meanwhile.
+      */
+    void wait()
+    {
+        pool_.helpUntil_(&pending_, 0);
+    }
+
+private:
+    ThreadPool& pool_;
+
+    //Tasks submitted and not yet run.
+    volatile sint32 pending_;
+};
+
+} //seashell
+
+#endif//SEASHELL_THREADPOOL_H_
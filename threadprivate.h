@@ -14,7 +14,7 @@ namespace seashell
 //Thread-local storage class.  Note that, if the class is being deleted, any 
 //other members called silently fail.
 template<typename T>
-class ThreadPrivate : public seashell::Mutex
+class ThreadPrivate : public seashell::RWMutex
 {
 public:
     /**Initializes thread storages
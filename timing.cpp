@@ -7,11 +7,21 @@
 #elif defined(_LINUX)
 
 #include <unistd.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
 #endif //Operating system types
 
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define TIMING_TICKS_TSC 1
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define TIMING_TICKS_TSC 1
+#else
+#define TIMING_TICKS_TSC 0
+#endif
+
 #include "seashell.h"
 
 namespace timing
@@ -77,6 +87,70 @@ big_suint getThreadExecutionUs()
 #endif //Operating Systems
 }
 
+//Reference clock for tick calibration, in nanoseconds.
+static big_suint getReferenceNs()
+{
+#ifdef _WINDOWS
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (big_suint)((real64)count.QuadPart * 1e9 / 
+      (real64)frequency.QuadPart);
+#elif defined(_LINUX)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (big_suint)ts.tv_sec * 1000000000 + (big_suint)ts.tv_nsec;
+#endif //Operating Systems
+}
+
+big_suint getTicks()
+{
+#if TIMING_TICKS_TSC
+#ifdef _MSC_VER
+    return (big_suint)__rdtsc();
+#else
+    suint32 low, high;
+    __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+    return ((big_suint)high << 32) | low;
+#endif
+#elif defined(_WINDOWS)
+    LARGE_INTEGER count;
+    QueryPerformanceCounter(&count);
+    return (big_suint)count.QuadPart;
+#elif defined(_LINUX)
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (big_suint)ts.tv_sec * 1000000000 + (big_suint)ts.tv_nsec;
+#endif
+}
+
+real64 getTicksPerSecond()
+{
+    static real64 ticksPerSecond = 0;
+    if (ticksPerSecond == 0) {
+#if TIMING_TICKS_TSC
+        //The time stamp counter's rate is not reported anywhere portable;
+        //measure it against the reference clock over a short interval.
+        const big_suint calibrationNs = 20000000;
+        const big_suint startNs = getReferenceNs();
+        const big_suint startTicks = getTicks();
+        big_suint ns;
+        do {
+            ns = getReferenceNs() - startNs;
+        } while (ns < calibrationNs);
+        const big_suint ticks = getTicks() - startTicks;
+        ticksPerSecond = (real64)ticks * 1e9 / (real64)ns;
+#elif defined(_WINDOWS)
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        ticksPerSecond = (real64)frequency.QuadPart;
+#elif defined(_LINUX)
+        ticksPerSecond = 1e9;
+#endif
+    }
+    return ticksPerSecond;
+}
+
 #ifdef _WINDOWS
 void sleepThread(suint ms) { Sleep((DWORD)ms); }
 #elif defined(_LINUX)
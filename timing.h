@@ -32,6 +32,19 @@ big_suint getThreadExecutionMs();
   */
 big_suint getThreadExecutionUs();
 
+/**Reads a high resolution tick counter: the time stamp counter on x86, or a
+  *raw monotonic clock elsewhere.  Used for profiling purposes.
+  * @return Returns the current tick count.  Only differences between tick
+  *counts are meaningful; see getTicksPerSecond().
+  */
+big_suint getTicks();
+
+/** @return Returns the rate at which getTicks() advances.  The first call 
+  *may calibrate the tick counter against the system clock, which takes a 
+  *few milliseconds; later calls return the same value.
+  */
+real64 getTicksPerSecond();
+
 /**Sleeps a thread for the specified number of milliseconds.
   * @param ms Time, in milliseconds, to sleep the current thread for.
   */